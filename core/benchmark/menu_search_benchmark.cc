@@ -0,0 +1,95 @@
+// Measures filtering huge menus through the search index, without a display.
+// Every keystroke must be handled within a frame, a benchmark exceeding
+// `kFrameBudget` per keystroke reports an error.
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "menu_model.h"
+#include "menu_search.h"
+
+namespace {
+
+// Time available to handle a keystroke at 60 frames per second.
+constexpr auto kFrameBudget = std::chrono::microseconds(16667);
+
+// Queries typed by the benchmarks, one keystroke at a time.
+constexpr const char* kQueries[] = {"item 12", "item 4", "x", "item"};
+
+// A menu of `count` top-level items titled "Item <id>".
+MenuModel make_model(int64_t count) {
+  MenuModel model;
+  model.reserve(count, count * 12);
+  for (int64_t id = 0; id < count; id++) {
+    std::string title = "Item " + std::to_string(id);
+    model.add(id, title.c_str(), title.size(), kRootNode, kNoNode);
+  }
+  return model;
+}
+
+void BM_BuildSearchIndex(benchmark::State& state) {
+  MenuModel model = make_model(state.range(0));
+  for (auto _ : state) {
+    MenuSearchIndex index;
+    index.build(model, kRootNode);
+    benchmark::DoNotOptimize(index.entries.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Types each query & erases it again, a keystroke at a time, counting the
+// items shown or hidden by each keystroke as the menu would.
+void BM_FilterMenu(benchmark::State& state) {
+  MenuModel model = make_model(state.range(0));
+  MenuSearchIndex index;
+  index.build(model, kRootNode);
+  int64_t keystrokes = 0;
+  int64_t changed = 0;
+  auto slowest = std::chrono::nanoseconds(0);
+  for (auto _ : state) {
+    for (const char* query : kQueries) {
+      std::string typed;
+      MenuSearchIndex::Range range = index.all();
+      auto type = [&](const std::string& text) {
+        auto start = std::chrono::steady_clock::now();
+        MenuSearchIndex::Range next = index.find(text.c_str(), text.size());
+        index.diff(range, next, [&](NodeIndex node, bool) {
+          benchmark::DoNotOptimize(node);
+          changed++;
+        });
+        range = next;
+        slowest = std::max<std::chrono::nanoseconds>(
+            slowest, std::chrono::steady_clock::now() - start);
+        keystrokes++;
+      };
+      for (const char* c = query; *c != '\0'; c++) type(typed += *c);
+      while (!typed.empty()) {
+        typed.pop_back();
+        type(typed);
+      }
+    }
+  }
+  state.counters["keystrokes"] =
+      benchmark::Counter(static_cast<double>(keystrokes),
+                         benchmark::Counter::kIsRate);
+  state.counters["changed_per_keystroke"] =
+      static_cast<double>(changed) / static_cast<double>(keystrokes);
+  state.counters["slowest_keystroke_us"] =
+      std::chrono::duration<double, std::micro>(slowest).count();
+  if (slowest > kFrameBudget) {
+    state.SkipWithError("A keystroke took longer than a frame.");
+  }
+}
+
+BENCHMARK(BM_BuildSearchIndex)
+    ->Arg(1000)
+    ->Arg(50000)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_FilterMenu)->Arg(1000)->Arg(50000)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
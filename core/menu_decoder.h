@@ -0,0 +1,202 @@
+#ifndef NATIVE_CONTEXT_MENU_CORE_MENU_DECODER_H_
+#define NATIVE_CONTEXT_MENU_CORE_MENU_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "menu_model.h"
+
+// Errors reported for malformed items, shared by the platforms.
+constexpr static auto kMenuItemsNotListError = "Menu items must be a list.";
+constexpr static auto kMenuItemNotMapError = "Menu items must be maps.";
+constexpr static auto kMenuItemIdError = "Menu item ids must be integers.";
+constexpr static auto kMenuItemTitleError = "Menu item titles must be strings.";
+constexpr static auto kMenuItemItemsError =
+    "Menu item sub-items must be lists.";
+constexpr static auto kMenuItemDynamicError =
+    "Menu item dynamic flags must be booleans.";
+constexpr static auto kMenuItemIconError = "Menu item icons must be bytes.";
+constexpr static auto kMenuItemIconPathError =
+    "Menu item icon paths must be strings.";
+constexpr static auto kMenuItemTypeError =
+    "Menu item types must be \"check\" or \"radio\".";
+constexpr static auto kMenuItemCheckedError =
+    "Menu item checked flags must be booleans.";
+constexpr static auto kMenuItemDuplicateIdError =
+    "Menu items have invalid or duplicate ids.";
+
+// Keys of an item map, see `menu_item_field`.
+enum class MenuItemField : uint8_t {
+  kUnknown,
+  kId,
+  kTitle,
+  kItems,
+  kDynamic,
+  kIcon,
+  kIconPath,
+  kType,
+  kChecked,
+};
+
+// Returns the field named by the `length` bytes of `key`. Keys are matched by
+// length before their bytes are compared, so that a reader walking an item
+// map once dispatches each key with at most one comparison.
+inline MenuItemField menu_item_field(const char* key, size_t length) {
+  switch (length) {
+    case 2:
+      return memcmp(key, "id", 2) == 0 ? MenuItemField::kId
+                                       : MenuItemField::kUnknown;
+    case 4:
+      if (memcmp(key, "icon", 4) == 0) return MenuItemField::kIcon;
+      return memcmp(key, "type", 4) == 0 ? MenuItemField::kType
+                                         : MenuItemField::kUnknown;
+    case 5:
+      if (memcmp(key, "title", 5) == 0) return MenuItemField::kTitle;
+      return memcmp(key, "items", 5) == 0 ? MenuItemField::kItems
+                                          : MenuItemField::kUnknown;
+    case 7:
+      if (memcmp(key, "dynamic", 7) == 0) return MenuItemField::kDynamic;
+      return memcmp(key, "checked", 7) == 0 ? MenuItemField::kChecked
+                                            : MenuItemField::kUnknown;
+    case 8:
+      return memcmp(key, "iconPath", 8) == 0 ? MenuItemField::kIconPath
+                                             : MenuItemField::kUnknown;
+    default:
+      return MenuItemField::kUnknown;
+  }
+}
+
+// Reads the `type` of an item named by the `length` bytes of `name` into
+// `type`. Returns `false` if it is not a known type.
+inline bool menu_item_type(const char* name, size_t length,
+                           MenuItemType* type) {
+  if (length == 5 && memcmp(name, "check", 5) == 0) {
+    *type = MenuItemType::kCheck;
+  } else if (length == 5 && memcmp(name, "radio", 5) == 0) {
+    *type = MenuItemType::kRadio;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Fields of an item passed in the `items` of a method call. `Items` refers to
+// a list of items in the value type of the platform's codec.
+template <typename Items>
+struct DecodedMenuItem {
+  int64_t id = -1;
+  const char* title = nullptr;
+  size_t title_length = 0;
+  bool dynamic = false;
+  // Encoded image bytes, or the path of an image file if `icon_is_path`.
+  const char* icon = nullptr;
+  size_t icon_length = 0;
+  bool icon_is_path = false;
+  MenuItemType type = MenuItemType::kNormal;
+  bool checked = false;
+  // Sub-items, which `Reader::size` reports as empty if there are none.
+  Items items = {};
+};
+
+// Why the items of a method call could not be read.
+struct MenuDecodeError {
+  const char* message = nullptr;
+  // Id of the rejected item, or -1 if it was not read yet.
+  int64_t id = -1;
+};
+
+// The decoders below are shared by the platforms, which adapt the value type
+// of their codec through a `Reader` providing:
+//
+//   using Items = ...;  // A list of items, e.g. `FlValue*`.
+//   using Item = ...;   // A single item, e.g. `FlValue*`.
+//   static size_t size(Items items);
+//   static Item at(Items items, size_t index);
+//   // Returns one of the errors above if `item` is malformed, else `nullptr`.
+//   static const char* read(Item item, DecodedMenuItem<Items>& decoded);
+
+// Adds the node of a passed item `value` under `parent`, before its sub-item
+// `next` or last if `next` is `kNoNode`, along with all of its sub-items at
+// any depth. Each item is read exactly once. Returns `kNoNode`, fills `error`
+// if passed & leaves `model` unchanged if any item is invalid. The tree is
+// walked with an explicit stack rather than recursion, so that deep trees
+// built from generated data cannot overflow the native stack.
+template <typename Reader>
+NodeIndex decode_menu_item(typename Reader::Item value, NodeIndex parent,
+                           NodeIndex next, MenuModel& model,
+                           MenuDecodeError* error = nullptr) {
+  using Items = typename Reader::Items;
+  // Sub-items of `parent` which are yet to be added, starting at `next`.
+  struct Pending {
+    Items items;
+    size_t next;
+    NodeIndex parent;
+  };
+  std::vector<Pending> stack;
+  DecodedMenuItem<Items> decoded;
+  auto add = [&](typename Reader::Item value, NodeIndex parent,
+                 NodeIndex next) {
+    decoded = DecodedMenuItem<Items>();
+    const char* message = Reader::read(value, decoded);
+    NodeIndex node = kNoNode;
+    if (message == nullptr) {
+      node = model.add(decoded.id, decoded.title, decoded.title_length, parent,
+                       next, decoded.dynamic);
+      if (node == kNoNode) {
+        message = kMenuItemDuplicateIdError;
+      } else {
+        model.nodes[node].type = decoded.type;
+        model.nodes[node].checked =
+            decoded.type != MenuItemType::kNormal && decoded.checked;
+        if (decoded.icon != nullptr) {
+          model.set_icon(node, decoded.icon, decoded.icon_length,
+                         decoded.icon_is_path);
+        }
+      }
+    }
+    if (message != nullptr) {
+      if (error != nullptr) *error = {message, decoded.id};
+      return kNoNode;
+    }
+    if (Reader::size(decoded.items) > 0) {
+      stack.push_back({decoded.items, 0, node});
+    }
+    return node;
+  };
+  NodeIndex root = add(value, parent, next);
+  if (root == kNoNode) return kNoNode;
+  while (!stack.empty()) {
+    Pending& pending = stack.back();
+    if (pending.next == Reader::size(pending.items)) {
+      stack.pop_back();
+      continue;
+    }
+    // `pending` is invalidated once the sub-items are pushed.
+    if (add(Reader::at(pending.items, pending.next++), pending.parent,
+            kNoNode) == kNoNode) {
+      model.remove(root);
+      return kNoNode;
+    }
+  }
+  return root;
+}
+
+// Reads the `items` list of a method call into the empty `model`, in a single
+// pass over the items. Returns `false` & fills `error` if passed if any item
+// is invalid.
+template <typename Reader>
+bool decode_menu(typename Reader::Items items, MenuModel& model,
+                 MenuDecodeError* error = nullptr) {
+  model.reserve(Reader::size(items), 0);
+  for (size_t i = 0; i < Reader::size(items); i++) {
+    if (decode_menu_item<Reader>(Reader::at(items, i), kRootNode, kNoNode,
+                                 model, error) == kNoNode) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif  // NATIVE_CONTEXT_MENU_CORE_MENU_DECODER_H_
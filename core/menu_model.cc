@@ -0,0 +1,181 @@
+#include "menu_model.h"
+
+#include <algorithm>
+
+uint64_t hash_bytes(const char* data, size_t length, uint64_t seed) {
+  uint64_t hash = 14695981039346656037ull ^ seed;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+void MenuModel::reserve(size_t node_count, size_t titles_size) {
+  nodes.reserve(node_count + 1);
+  titles.reserve(titles_size);
+  node_by_id.reserve(node_count);
+}
+
+NodeIndex MenuModel::child_at(NodeIndex parent, size_t position) const {
+  if (position >= nodes[parent].child_count) return kNoNode;
+  NodeIndex child = nodes[parent].first_child;
+  while (position-- > 0) child = nodes[child].next_sibling;
+  return child;
+}
+
+bool MenuModel::contains(NodeIndex ancestor, NodeIndex node) const {
+  for (; node != kNoNode; node = nodes[node].parent) {
+    if (node == ancestor) return true;
+  }
+  return false;
+}
+
+NodeIndex MenuModel::add(int64_t id, const char* title, size_t title_length,
+                         NodeIndex parent, NodeIndex next, bool dynamic) {
+  if (id < 0 || id > kMaxMenuItemId || find(id) != kNoNode) return kNoNode;
+  NodeIndex node = free_node;
+  if (node != kNoNode) {
+    free_node = nodes[node].next_sibling;
+    nodes[node] = MenuNode();
+  } else {
+    node = static_cast<NodeIndex>(nodes.size());
+    nodes.emplace_back();
+  }
+  nodes[node].id = static_cast<int32_t>(id);
+  nodes[node].title_offset = static_cast<uint32_t>(titles.size());
+  nodes[node].title_length = static_cast<uint32_t>(title_length);
+  nodes[node].dynamic = dynamic;
+  titles.append(title, title_length);
+  titles.push_back('\0');
+  if (node_by_id.size() <= static_cast<size_t>(id)) {
+    node_by_id.resize(id + 1, kNoNode);
+  }
+  node_by_id[id] = node;
+  node_added(node);
+  link(node, parent, next);
+  return node;
+}
+
+void MenuModel::link(NodeIndex node, NodeIndex parent, NodeIndex next) {
+  NodeIndex previous =
+      next == kNoNode ? nodes[parent].last_child : nodes[next].previous_sibling;
+  nodes[node].parent = parent;
+  nodes[node].previous_sibling = previous;
+  nodes[node].next_sibling = next;
+  if (previous != kNoNode) {
+    nodes[previous].next_sibling = node;
+  } else {
+    nodes[parent].first_child = node;
+  }
+  if (next != kNoNode) {
+    nodes[next].previous_sibling = node;
+  } else {
+    nodes[parent].last_child = node;
+  }
+  nodes[parent].child_count++;
+}
+
+void MenuModel::unlink(NodeIndex node) {
+  MenuNode& unlinked = nodes[node];
+  MenuNode& parent = nodes[unlinked.parent];
+  if (unlinked.previous_sibling != kNoNode) {
+    nodes[unlinked.previous_sibling].next_sibling = unlinked.next_sibling;
+  } else {
+    parent.first_child = unlinked.next_sibling;
+  }
+  if (unlinked.next_sibling != kNoNode) {
+    nodes[unlinked.next_sibling].previous_sibling = unlinked.previous_sibling;
+  } else {
+    parent.last_child = unlinked.previous_sibling;
+  }
+  parent.child_count--;
+  unlinked.parent = kNoNode;
+  unlinked.previous_sibling = kNoNode;
+  unlinked.next_sibling = kNoNode;
+}
+
+size_t MenuModel::move(NodeIndex node, NodeIndex parent, int64_t position) {
+  unlink(node);
+  auto clamped = static_cast<size_t>(std::min<int64_t>(
+      std::max<int64_t>(position, 0), nodes[parent].child_count));
+  link(node, parent, child_at(parent, clamped));
+  return clamped;
+}
+
+void MenuModel::set_title(NodeIndex node, const char* title,
+                          size_t title_length) {
+  unused_titles_size += nodes[node].title_length + 1;
+  nodes[node].title_offset = static_cast<uint32_t>(titles.size());
+  nodes[node].title_length = static_cast<uint32_t>(title_length);
+  titles.append(title, title_length);
+  titles.push_back('\0');
+  // Compact once most of the buffer is unused, so that repeated renames use
+  // amortized constant time & bounded memory.
+  if (unused_titles_size * 2 <= titles.size()) return;
+  std::string compacted;
+  compacted.reserve(titles.size() - unused_titles_size);
+  for (auto& live : nodes) {
+    if (live.id < 0) continue;
+    size_t offset = compacted.size();
+    compacted.append(titles, live.title_offset, live.title_length + 1);
+    live.title_offset = static_cast<uint32_t>(offset);
+  }
+  titles.swap(compacted);
+  unused_titles_size = 0;
+}
+
+void MenuModel::set_icon(NodeIndex node, const char* source, size_t length,
+                         bool is_path) {
+  uint64_t hash = hash_bytes(source, length, is_path ? 1 : 0);
+  auto it = icon_by_hash.find(hash);
+  if (it == icon_by_hash.end()) {
+    auto icon = static_cast<IconIndex>(icons.size());
+    icons.push_back({hash, std::string(source, length), is_path});
+    it = icon_by_hash.emplace(hash, icon).first;
+  }
+  nodes[node].icon = it->second;
+}
+
+void MenuModel::toggle(NodeIndex node, std::vector<NodeIndex>& changed) {
+  if (nodes[node].type == MenuItemType::kCheck) {
+    nodes[node].checked = !nodes[node].checked;
+    changed.push_back(node);
+    return;
+  }
+  if (nodes[node].type != MenuItemType::kRadio || nodes[node].checked) return;
+  NodeIndex first = node;
+  while (nodes[first].previous_sibling != kNoNode &&
+         nodes[nodes[first].previous_sibling].type == MenuItemType::kRadio) {
+    first = nodes[first].previous_sibling;
+  }
+  for (NodeIndex sibling = first;
+       sibling != kNoNode && nodes[sibling].type == MenuItemType::kRadio;
+       sibling = nodes[sibling].next_sibling) {
+    if (nodes[sibling].checked) {
+      nodes[sibling].checked = false;
+      changed.push_back(sibling);
+    }
+  }
+  nodes[node].checked = true;
+  changed.push_back(node);
+}
+
+void MenuModel::remove(NodeIndex node) {
+  unlink(node);
+  std::vector<NodeIndex> stack = {node};
+  while (!stack.empty()) {
+    NodeIndex top = stack.back();
+    stack.pop_back();
+    for (NodeIndex child = nodes[top].first_child; child != kNoNode;
+         child = nodes[child].next_sibling) {
+      stack.push_back(child);
+    }
+    node_by_id[nodes[top].id] = kNoNode;
+    unused_titles_size += nodes[top].title_length + 1;
+    nodes[top] = MenuNode();
+    nodes[top].next_sibling = free_node;
+    free_node = top;
+    node_removed(top);
+  }
+}
@@ -0,0 +1,147 @@
+#ifndef NATIVE_CONTEXT_MENU_CORE_MENU_MODEL_H_
+#define NATIVE_CONTEXT_MENU_CORE_MENU_MODEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Index of a `MenuNode` within the node table of its `MenuModel`.
+using NodeIndex = uint32_t;
+// Refers to no node, e.g. the sibling after the last item.
+constexpr static NodeIndex kNoNode = UINT32_MAX;
+// First node of every menu, whose sub-items are the top-level items.
+constexpr static NodeIndex kRootNode = 0;
+// Item ids are assigned densely from 0 by Dart & index a lookup table.
+constexpr static int64_t kMaxMenuItemId = (1 << 24) - 1;
+// Index of a `MenuIcon` within the icons of its `MenuModel`.
+using IconIndex = uint32_t;
+// Marks a node without an icon.
+constexpr static IconIndex kNoIcon = UINT32_MAX;
+
+// Kind of a menu item. Check & radio items show whether they are `checked`,
+// which is kept in the model & toggled by `MenuModel::toggle`.
+enum class MenuItemType : uint8_t { kNormal, kCheck, kRadio };
+
+// Returns the 64-bit FNV-1a hash of the `length` bytes at `data`.
+uint64_t hash_bytes(const char* data, size_t length, uint64_t seed);
+
+// The icon of one or more items, either encoded image bytes or the path of an
+// image file. Identical icons within a menu are stored once.
+struct MenuIcon {
+  // Hash of `source` & its kind, which caches of decoded icons are keyed by.
+  uint64_t hash = 0;
+  std::string source = {};
+  bool is_path = false;
+};
+
+// Represents a menu item, stores its id, title & possible sub-menu items.
+// Nodes are plain values stored in the node table of their `MenuModel` & refer
+// to each other by index. Sub-items are linked as siblings rather than kept in
+// a contiguous range, so that a node keeps its index (which the platform
+// widgets showing it hold) while the menu is patched.
+struct MenuNode {
+  int32_t id = -1;
+  NodeIndex parent = kNoNode;
+  NodeIndex first_child = kNoNode;
+  NodeIndex last_child = kNoNode;
+  NodeIndex previous_sibling = kNoNode;
+  NodeIndex next_sibling = kNoNode;
+  uint32_t child_count = 0;
+  // Location of the NUL-terminated title within the `titles` of the menu.
+  uint32_t title_offset = 0;
+  uint32_t title_length = 0;
+  // Whether the sub-items are requested from Dart when the item is opened.
+  bool dynamic = false;
+  MenuItemType type = MenuItemType::kNormal;
+  bool checked = false;
+  IconIndex icon = kNoIcon;
+};
+
+// The items of a menu, independent of the toolkit showing them. All items are
+// stored in a single node table & all of their titles in a single buffer,
+// which are sized up-front when the menu is read.
+struct MenuModel {
+  // Node table, starting with `kRootNode`. Removed nodes are chained through
+  // `next_sibling` from `free_node` & reused by later insertions.
+  std::vector<MenuNode> nodes = {};
+  NodeIndex free_node = kNoNode;
+  std::string titles = {};
+  // Bytes of `titles` no longer used by any node.
+  size_t unused_titles_size = 0;
+  // Node of each item keyed by its `id`, so that an item can be patched
+  // without walking the tree.
+  std::vector<NodeIndex> node_by_id = {};
+  // Icons referred by the nodes, kept until the model is destroyed.
+  std::vector<MenuIcon> icons = {};
+  std::unordered_map<uint64_t, IconIndex> icon_by_hash = {};
+
+  MenuModel() { nodes.emplace_back(); }
+  virtual ~MenuModel() = default;
+
+  // Allocates room for `node_count` items with `titles_size` bytes of titles,
+  // including their terminators.
+  void reserve(size_t node_count, size_t titles_size);
+
+  const char* title(NodeIndex node) const {
+    return titles.c_str() + nodes[node].title_offset;
+  }
+
+  // Returns the node of the item with `id`, or `kNoNode`.
+  NodeIndex find(int64_t id) const {
+    return id >= 0 && id < static_cast<int64_t>(node_by_id.size())
+               ? node_by_id[id]
+               : kNoNode;
+  }
+
+  // Returns the sub-item of `parent` at `position`, or `kNoNode` if `position`
+  // is past the last one.
+  NodeIndex child_at(NodeIndex parent, size_t position) const;
+
+  // Returns whether `node` is `ancestor` or one of its sub-items at any depth.
+  bool contains(NodeIndex ancestor, NodeIndex node) const;
+
+  // Adds a node for the item `id` under `parent`, before its sub-item `next`
+  // or last if `next` is `kNoNode`. Returns `kNoNode` if `id` is out of range
+  // or already present.
+  NodeIndex add(int64_t id, const char* title, size_t title_length,
+                NodeIndex parent, NodeIndex next, bool dynamic = false);
+
+  // Places `node` under `parent`, before its sub-item `next` or last if `next`
+  // is `kNoNode`.
+  void link(NodeIndex node, NodeIndex parent, NodeIndex next);
+
+  // Takes `node` out of the sub-items of its parent.
+  void unlink(NodeIndex node);
+
+  // Moves `node` under `parent` at `position`, clamped to the number of its
+  // sub-items. Returns the position `node` was placed at. `parent` must not be
+  // `node` or one of its sub-items, see `contains`.
+  size_t move(NodeIndex node, NodeIndex parent, int64_t position);
+
+  void set_title(NodeIndex node, const char* title, size_t title_length);
+
+  // Sets the icon of `node` to the image whose encoded bytes, or path if
+  // `is_path`, are the `length` bytes at `source`.
+  void set_icon(NodeIndex node, const char* source, size_t length,
+                bool is_path);
+
+  // Toggles `node` as if it was clicked: a check item is flipped, a radio item
+  // is checked & the other items of its group unchecked. A group is a run of
+  // radio items among the sub-items of a parent, ended by any other item.
+  // Appends each node whose state changed to `changed`.
+  void toggle(NodeIndex node, std::vector<NodeIndex>& changed);
+
+  // Unlinks `node` & frees it along with its sub-items.
+  void remove(NodeIndex node);
+
+ protected:
+  // Called with each node once it is added, before it is linked to its
+  // parent, & once it is freed, so that the platform can keep its own state
+  // for each node.
+  virtual void node_added(NodeIndex) {}
+  virtual void node_removed(NodeIndex) {}
+};
+
+#endif  // NATIVE_CONTEXT_MENU_CORE_MENU_MODEL_H_
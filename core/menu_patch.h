@@ -0,0 +1,209 @@
+#ifndef NATIVE_CONTEXT_MENU_CORE_MENU_PATCH_H_
+#define NATIVE_CONTEXT_MENU_CORE_MENU_PATCH_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "menu_decoder.h"
+#include "menu_model.h"
+
+// Errors reported for malformed `updateMenu` patches, shared by the
+// platforms.
+constexpr static auto kMenuPatchNotMapError = "Patches must be maps.";
+constexpr static auto kMenuPatchOpError = "Unknown patch op.";
+constexpr static auto kMenuPatchIdError = "No item is present with this id.";
+constexpr static auto kMenuPatchParentError =
+    "No parent item is present with this id.";
+constexpr static auto kMenuPatchMoveError =
+    "An item cannot be moved into itself.";
+
+// Operations of a patch.
+enum class MenuPatchOp : uint8_t {
+  kUnknown,
+  kInsert,
+  kRemove,
+  kSetTitle,
+  kMove,
+};
+
+// Returns the operation named by the `length` bytes of `name`.
+inline MenuPatchOp menu_patch_op(const char* name, size_t length) {
+  switch (length) {
+    case 4:
+      return memcmp(name, "move", 4) == 0 ? MenuPatchOp::kMove
+                                          : MenuPatchOp::kUnknown;
+    case 6:
+      if (memcmp(name, "insert", 6) == 0) return MenuPatchOp::kInsert;
+      return memcmp(name, "remove", 6) == 0 ? MenuPatchOp::kRemove
+                                            : MenuPatchOp::kUnknown;
+    case 8:
+      return memcmp(name, "setTitle", 8) == 0 ? MenuPatchOp::kSetTitle
+                                              : MenuPatchOp::kUnknown;
+    default:
+      return MenuPatchOp::kUnknown;
+  }
+}
+
+// Keys of a patch map, see `menu_patch_field`.
+enum class MenuPatchField : uint8_t {
+  kUnknown,
+  kOp,
+  kId,
+  kParent,
+  kIndex,
+  kTitle,
+  kItem,
+};
+
+// Returns the field named by the `length` bytes of `key`, matched as in
+// `menu_item_field`.
+inline MenuPatchField menu_patch_field(const char* key, size_t length) {
+  switch (length) {
+    case 2:
+      if (memcmp(key, "op", 2) == 0) return MenuPatchField::kOp;
+      return memcmp(key, "id", 2) == 0 ? MenuPatchField::kId
+                                       : MenuPatchField::kUnknown;
+    case 4:
+      return memcmp(key, "item", 4) == 0 ? MenuPatchField::kItem
+                                         : MenuPatchField::kUnknown;
+    case 5:
+      if (memcmp(key, "index", 5) == 0) return MenuPatchField::kIndex;
+      return memcmp(key, "title", 5) == 0 ? MenuPatchField::kTitle
+                                          : MenuPatchField::kUnknown;
+    case 6:
+      return memcmp(key, "parent", 6) == 0 ? MenuPatchField::kParent
+                                           : MenuPatchField::kUnknown;
+    default:
+      return MenuPatchField::kUnknown;
+  }
+}
+
+// Fields of a patch passed to `updateMenu`. `Item` refers to a single item
+// in the value type of the platform's codec.
+template <typename Item>
+struct DecodedMenuPatch {
+  MenuPatchOp op = MenuPatchOp::kUnknown;
+  // Ids of the patched item & of its new parent. A missing or null id refers
+  // to the top level.
+  bool has_id = false;
+  int64_t id = -1;
+  bool has_parent = false;
+  int64_t parent = -1;
+  // Position among the sub-items of the parent, last if missing.
+  int64_t index = INT64_MAX;
+  // `nullptr` if missing or mistyped.
+  const char* title = nullptr;
+  size_t title_length = 0;
+  bool has_item = false;
+  Item item = {};
+};
+
+// A patch checked against the model it applies to, see `decode_menu_patch`.
+template <typename Item>
+struct MenuPatch {
+  MenuPatchOp op = MenuPatchOp::kUnknown;
+  // The patched node, or the inserted node once applied.
+  NodeIndex node = kNoNode;
+  // The new parent of an inserted or moved node.
+  NodeIndex parent = kRootNode;
+  int64_t index = INT64_MAX;
+  const char* title = nullptr;
+  size_t title_length = 0;
+  Item item = {};
+  // Set once applied: the position of an inserted or moved node among its
+  // siblings, & the parent of a removed or moved node before the patch.
+  size_t position = 0;
+  NodeIndex old_parent = kNoNode;
+};
+
+// Patches are applied by the platforms in two steps around the updates of
+// their widgets, with the `Reader` of `decode_menu_item` also providing:
+//
+//   using Patch = ...;  // A single patch, e.g. `FlValue*`.
+//   // Returns one of the errors above if `patch` is malformed, else
+//   // `nullptr`. Mistyped ids are reported as `kMenuPatchIdError` or
+//   // `kMenuPatchParentError`.
+//   static const char* read_patch(Patch patch,
+//                                 DecodedMenuPatch<Item>& decoded);
+
+// Reads the patch `value` & resolves the items it refers to in `model`, which
+// is left unchanged. Returns an error message if the patch cannot be applied.
+template <typename Reader>
+const char* decode_menu_patch(typename Reader::Patch value,
+                              const MenuModel& model,
+                              MenuPatch<typename Reader::Item>& patch) {
+  DecodedMenuPatch<typename Reader::Item> decoded;
+  const char* message = Reader::read_patch(value, decoded);
+  if (message != nullptr) return message;
+  patch = MenuPatch<typename Reader::Item>();
+  patch.op = decoded.op;
+  patch.index = decoded.index;
+  if (decoded.op == MenuPatchOp::kUnknown) return kMenuPatchOpError;
+  if (decoded.has_parent) {
+    patch.parent = model.find(decoded.parent);
+    if (patch.parent == kNoNode &&
+        (decoded.op == MenuPatchOp::kInsert ||
+         decoded.op == MenuPatchOp::kMove)) {
+      return kMenuPatchParentError;
+    }
+  }
+  if (decoded.op == MenuPatchOp::kInsert) {
+    if (!decoded.has_item) return kMenuItemNotMapError;
+    patch.item = decoded.item;
+    return nullptr;
+  }
+  patch.node = decoded.has_id ? model.find(decoded.id) : kNoNode;
+  if (patch.node == kNoNode) return kMenuPatchIdError;
+  if (decoded.op == MenuPatchOp::kSetTitle) {
+    if (decoded.title == nullptr) return kMenuItemTitleError;
+    patch.title = decoded.title;
+    patch.title_length = decoded.title_length;
+  } else if (decoded.op == MenuPatchOp::kMove &&
+             model.contains(patch.node, patch.parent)) {
+    return kMenuPatchMoveError;
+  }
+  return nullptr;
+}
+
+// Applies a patch returned by `decode_menu_patch` to the same `model`. Only
+// an insert can fail, if its item is malformed, in which case an error
+// message is returned, `error` is filled if passed & `model` is unchanged.
+template <typename Reader>
+const char* apply_menu_model_patch(MenuModel& model,
+                                  MenuPatch<typename Reader::Item>& patch,
+                                  MenuDecodeError* error = nullptr) {
+  switch (patch.op) {
+    case MenuPatchOp::kInsert: {
+      patch.position = static_cast<size_t>(std::min<int64_t>(
+          std::max<int64_t>(patch.index, 0),
+          model.nodes[patch.parent].child_count));
+      NodeIndex next = model.child_at(patch.parent, patch.position);
+      MenuDecodeError decode_error;
+      patch.node = decode_menu_item<Reader>(patch.item, patch.parent, next,
+                                            model, &decode_error);
+      if (patch.node == kNoNode) {
+        if (error != nullptr) *error = decode_error;
+        return decode_error.message;
+      }
+      break;
+    }
+    case MenuPatchOp::kRemove:
+      patch.old_parent = model.nodes[patch.node].parent;
+      model.remove(patch.node);
+      break;
+    case MenuPatchOp::kSetTitle:
+      model.set_title(patch.node, patch.title, patch.title_length);
+      break;
+    case MenuPatchOp::kMove:
+      patch.old_parent = model.nodes[patch.node].parent;
+      patch.position = model.move(patch.node, patch.parent, patch.index);
+      break;
+    case MenuPatchOp::kUnknown:
+      return kMenuPatchOpError;
+  }
+  return nullptr;
+}
+
+#endif  // NATIVE_CONTEXT_MENU_CORE_MENU_PATCH_H_
@@ -0,0 +1,57 @@
+#include "menu_search.h"
+
+#include <cstring>
+
+void fold_menu_title(const char* title, size_t length, std::string& key) {
+  for (size_t i = 0; i < length; i++) {
+    char byte = title[i];
+    key.push_back(byte >= 'A' && byte <= 'Z' ? byte - 'A' + 'a' : byte);
+  }
+}
+
+// Compares the first `length` bytes of `a` & `b`, shorter strings first.
+static int compare_keys(const char* a, size_t a_length, const char* b,
+                        size_t b_length) {
+  int result = memcmp(a, b, std::min(a_length, b_length));
+  if (result != 0) return result;
+  return a_length < b_length ? -1 : a_length > b_length ? 1 : 0;
+}
+
+void MenuSearchIndex::build(const MenuModel& model, NodeIndex parent) {
+  entries.clear();
+  keys.clear();
+  entries.reserve(model.nodes[parent].child_count);
+  for (NodeIndex child = model.nodes[parent].first_child; child != kNoNode;
+       child = model.nodes[child].next_sibling) {
+    auto offset = static_cast<uint32_t>(keys.size());
+    fold_menu_title(model.title(child), model.nodes[child].title_length, keys);
+    entries.push_back({offset, model.nodes[child].title_length, child});
+  }
+  // Stable, so that items with equal titles keep their menu order.
+  std::stable_sort(entries.begin(), entries.end(),
+                   [this](const Entry& a, const Entry& b) {
+                     return compare_keys(keys.data() + a.key_offset,
+                                         a.key_length,
+                                         keys.data() + b.key_offset,
+                                         b.key_length) < 0;
+                   });
+}
+
+MenuSearchIndex::Range MenuSearchIndex::find(const char* prefix,
+                                             size_t length) const {
+  // Keys truncated to the length of `prefix` are sorted as well, matching
+  // keys are the ones equal to `prefix` once truncated.
+  auto compare = [&](const Entry& entry) {
+    return compare_keys(keys.data() + entry.key_offset,
+                        std::min<size_t>(entry.key_length, length), prefix,
+                        length);
+  };
+  auto begin = std::partition_point(
+      entries.begin(), entries.end(),
+      [&](const Entry& entry) { return compare(entry) < 0; });
+  auto end = std::partition_point(
+      begin, entries.end(),
+      [&](const Entry& entry) { return compare(entry) == 0; });
+  return {static_cast<size_t>(begin - entries.begin()),
+          static_cast<size_t>(end - entries.begin())};
+}
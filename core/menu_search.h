@@ -0,0 +1,64 @@
+#ifndef NATIVE_CONTEXT_MENU_CORE_MENU_SEARCH_H_
+#define NATIVE_CONTEXT_MENU_CORE_MENU_SEARCH_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "menu_model.h"
+
+// Appends the `length` bytes of `title` to `key`, folded for searching. ASCII
+// letters are lowercased, other bytes are kept as they are.
+void fold_menu_title(const char* title, size_t length, std::string& key);
+
+// Sorted prefix index over the titles of the sub-items of a node. The items
+// whose title starts with a typed prefix form a contiguous range of
+// `entries`, found in logarithmic time. Changing the prefix only touches the
+// items entering or leaving that range.
+struct MenuSearchIndex {
+  struct Entry {
+    // Location of the folded title within `keys`.
+    uint32_t key_offset;
+    uint32_t key_length;
+    NodeIndex node;
+  };
+
+  // A range of `entries`, from `begin` until `end`.
+  struct Range {
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  // Entries sorted by folded title, items with equal titles in menu order.
+  std::vector<Entry> entries = {};
+  std::string keys = {};
+
+  // Indexes the sub-items of `parent` in `model`, replacing the previous ones.
+  void build(const MenuModel& model, NodeIndex parent);
+
+  Range all() const { return {0, entries.size()}; }
+
+  // Returns the entries whose folded title starts with `prefix`, which is
+  // folded already.
+  Range find(const char* prefix, size_t length) const;
+
+  // Calls `changed(node, matches)` for every entry within only one of `from`
+  // & `to`, `matches` being whether it is within `to`.
+  template <typename Changed>
+  void diff(Range from, Range to, Changed changed) const {
+    auto visit = [&](Range range, Range other, bool matches) {
+      for (size_t i = range.begin; i < std::min(range.end, other.begin); i++) {
+        changed(entries[i].node, matches);
+      }
+      for (size_t i = std::max(range.begin, other.end); i < range.end; i++) {
+        changed(entries[i].node, matches);
+      }
+    };
+    visit(from, to, false);
+    visit(to, from, true);
+  }
+};
+
+#endif  // NATIVE_CONTEXT_MENU_CORE_MENU_SEARCH_H_
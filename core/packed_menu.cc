@@ -0,0 +1,85 @@
+#include "packed_menu.h"
+
+#include <cstring>
+
+bool is_valid_utf8(const char* data, size_t size) {
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  size_t i = 0;
+  while (i < size) {
+    uint8_t lead = bytes[i];
+    if (lead < 0x80) {
+      i++;
+      continue;
+    }
+    size_t length;
+    uint32_t code_point;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      length = 2;
+      code_point = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      length = 3;
+      code_point = lead & 0x0F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      length = 4;
+      code_point = lead & 0x07;
+    } else {
+      return false;
+    }
+    if (size - i < length) return false;
+    for (size_t j = 1; j < length; j++) {
+      if ((bytes[i + j] & 0xC0) != 0x80) return false;
+      code_point = (code_point << 6) | (bytes[i + j] & 0x3F);
+    }
+    // Overlong encodings, surrogates & code points past U+10FFFF.
+    if ((length == 3 && code_point < 0x800) ||
+        (length == 4 && code_point < 0x10000) || code_point > 0x10FFFF ||
+        (code_point >= 0xD800 && code_point <= 0xDFFF)) {
+      return false;
+    }
+    i += length;
+  }
+  return true;
+}
+
+bool read_packed_menu(const uint8_t* data, size_t size, MenuModel& model) {
+  PackedMenuHeader header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, data, sizeof(header));
+  size_t nodes_size = size_t{header.node_count} * sizeof(PackedMenuNode);
+  if (header.version != kPackedMenuVersion ||
+      size - sizeof(header) < nodes_size ||
+      size - sizeof(header) - nodes_size != header.strings_size) {
+    return false;
+  }
+  const uint8_t* nodes = data + sizeof(header);
+  const char* strings = reinterpret_cast<const char*>(nodes + nodes_size);
+  model.reserve(header.node_count,
+                size_t{header.strings_size} + header.node_count);
+  for (uint32_t i = 0; i < header.node_count; i++) {
+    PackedMenuNode node;
+    memcpy(&node, nodes + i * sizeof(node), sizeof(node));
+    // Titles are passed on as C strings, which an embedded NUL would cut.
+    if (node.parent < -1 || node.parent >= static_cast<int64_t>(i) ||
+        node.title_offset > header.strings_size ||
+        node.title_length > header.strings_size - node.title_offset ||
+        memchr(strings + node.title_offset, '\0', node.title_length) ||
+        !is_valid_utf8(strings + node.title_offset, node.title_length)) {
+      return false;
+    }
+    NodeIndex parent = node.parent < 0 ? kRootNode : node.parent + 1;
+    NodeIndex added =
+        model.add(node.id, strings + node.title_offset, node.title_length,
+                  parent, kNoNode,
+                  (node.flags & kPackedMenuItemHasDynamicItems) != 0);
+    if (added == kNoNode) return false;
+    if ((node.flags & kPackedMenuItemIsCheck) != 0) {
+      model.nodes[added].type = MenuItemType::kCheck;
+    } else if ((node.flags & kPackedMenuItemIsRadio) != 0) {
+      model.nodes[added].type = MenuItemType::kRadio;
+    }
+    model.nodes[added].checked =
+        model.nodes[added].type != MenuItemType::kNormal &&
+        (node.flags & kPackedMenuItemChecked) != 0;
+  }
+  return true;
+}
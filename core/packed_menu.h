@@ -0,0 +1,50 @@
+#ifndef NATIVE_CONTEXT_MENU_CORE_PACKED_MENU_H_
+#define NATIVE_CONTEXT_MENU_CORE_PACKED_MENU_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "menu_model.h"
+
+// Packed menu format version, the first field of the header.
+constexpr static uint32_t kPackedMenuVersion = 1;
+// Set in the `flags` of a packed node which has sub-items.
+constexpr static uint32_t kPackedMenuItemHasItems = 1 << 0;
+// Set in the `flags` of a packed node whose sub-items are requested from Dart
+// when it is opened.
+constexpr static uint32_t kPackedMenuItemHasDynamicItems = 1 << 1;
+// Set in the `flags` of a packed check or radio item, & of a checked one.
+constexpr static uint32_t kPackedMenuItemIsCheck = 1 << 2;
+constexpr static uint32_t kPackedMenuItemIsRadio = 1 << 3;
+constexpr static uint32_t kPackedMenuItemChecked = 1 << 4;
+
+// Header of a packed menu. All fields are little-endian, the header is
+// followed by `node_count` nodes & `strings_size` bytes of UTF-8 titles.
+struct PackedMenuHeader {
+  uint32_t version;
+  uint32_t node_count;
+  uint32_t strings_size;
+};
+
+// A packed menu item. Nodes are stored in pre-order, so that the parent of a
+// node always comes before it & siblings keep their order. `parent` is the
+// index of the parent node, or -1 for top-level items.
+struct PackedMenuNode {
+  int32_t id;
+  int32_t parent;
+  uint32_t flags;
+  uint32_t title_offset;
+  uint32_t title_length;
+};
+
+// Returns whether the `size` bytes at `data` are valid UTF-8.
+bool is_valid_utf8(const char* data, size_t size);
+
+// Reads a menu in the packed binary format into the empty `model`. Nodes are
+// read in place & added in order, so that the packed node `i` becomes the
+// node `i + 1`. Returns `false` if the payload is malformed, e.g. a parent
+// below -1 or a title holding a NUL byte, in which case `model` is left
+// partially filled.
+bool read_packed_menu(const uint8_t* data, size_t size, MenuModel& model);
+
+#endif  // NATIVE_CONTEXT_MENU_CORE_PACKED_MENU_H_
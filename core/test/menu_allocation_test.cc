@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "menu_decoder.h"
+#include "packed_menu.h"
+
+// Number of `operator new` calls since the test binary started, counting
+// those of the other tests too, so only differences are meaningful.
+static size_t allocation_count = 0;
+
+void* operator new(size_t size) {
+  allocation_count++;
+  if (void* pointer = malloc(size == 0 ? 1 : size)) return pointer;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept { free(pointer); }
+
+void operator delete(void* pointer, size_t) noexcept { free(pointer); }
+
+namespace {
+
+// Items decoded in both formats, enough for per-item allocations to show.
+constexpr int32_t kItemCount = 100000;
+
+std::string item_title(int32_t id) { return "Item " + std::to_string(id); }
+
+// Reads a flat list of titles, item `i` having the id `i`.
+struct TitleReader {
+  struct Item {
+    const std::vector<std::string>* titles;
+    size_t index;
+  };
+  using Items = const std::vector<std::string>*;
+
+  static size_t size(Items items) {
+    return items == nullptr ? 0 : items->size();
+  }
+
+  static Item at(Items items, size_t index) { return {items, index}; }
+
+  static const char* read(Item item, DecodedMenuItem<Items>& decoded) {
+    const std::string& title = (*item.titles)[item.index];
+    decoded.id = static_cast<int64_t>(item.index);
+    decoded.title = title.c_str();
+    decoded.title_length = title.size();
+    return nullptr;
+  }
+};
+
+TEST(MenuAllocationTest, ReadsPackedMenusInThreeAllocations) {
+  std::vector<PackedMenuNode> nodes;
+  std::string strings;
+  for (int32_t id = 0; id < kItemCount; id++) {
+    std::string title = item_title(id);
+    // Groups of 100 items, each under the first item of the previous group.
+    int32_t parent = id < 100 ? -1 : (id / 100 - 1) * 100;
+    nodes.push_back({id, parent, 0, static_cast<uint32_t>(strings.size()),
+                     static_cast<uint32_t>(title.size())});
+    strings += title;
+  }
+  PackedMenuHeader header = {kPackedMenuVersion,
+                             static_cast<uint32_t>(nodes.size()),
+                             static_cast<uint32_t>(strings.size())};
+  size_t nodes_size = nodes.size() * sizeof(PackedMenuNode);
+  std::vector<uint8_t> data(sizeof(header) + nodes_size + strings.size());
+  memcpy(data.data(), &header, sizeof(header));
+  memcpy(data.data() + sizeof(header), nodes.data(), nodes_size);
+  memcpy(data.data() + sizeof(header) + nodes_size, strings.data(),
+         strings.size());
+
+  MenuModel model;
+  size_t before = allocation_count;
+  ASSERT_TRUE(read_packed_menu(data.data(), data.size(), model));
+  // The nodes, the titles & the ids, each sized once from the header.
+  EXPECT_LE(allocation_count - before, 3u);
+  EXPECT_EQ(model.nodes.size(), static_cast<size_t>(kItemCount + 1));
+}
+
+TEST(MenuAllocationTest, DecodesItemsWithoutPerItemAllocations) {
+  std::vector<std::string> titles;
+  for (int32_t id = 0; id < kItemCount; id++) titles.push_back(item_title(id));
+
+  MenuModel model;
+  size_t before = allocation_count;
+  ASSERT_TRUE(decode_menu<TitleReader>(&titles, model));
+  // The nodes & the ids are sized once from the item count. The size of the
+  // titles is not known up front, so their buffer grows geometrically.
+  EXPECT_LE(allocation_count - before, 32u);
+  EXPECT_EQ(model.nodes.size(), static_cast<size_t>(kItemCount + 1));
+}
+
+}  // namespace
@@ -0,0 +1,172 @@
+#include "menu_decoder.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+// An item as a platform codec would decode it.
+struct TestItem {
+  int64_t id;
+  std::string title;
+  std::vector<TestItem> items = {};
+  bool dynamic = false;
+  MenuItemType type = MenuItemType::kNormal;
+  bool checked = false;
+  // Stands in for a missing or mistyped field.
+  bool malformed = false;
+};
+
+struct TestReader {
+  using Items = const std::vector<TestItem>*;
+  using Item = const TestItem*;
+
+  static size_t size(Items items) {
+    return items == nullptr ? 0 : items->size();
+  }
+
+  static Item at(Items items, size_t index) { return &(*items)[index]; }
+
+  static const char* read(Item item, DecodedMenuItem<Items>& decoded) {
+    decoded.id = item->id;
+    if (item->malformed) return kMenuItemTitleError;
+    decoded.title = item->title.c_str();
+    decoded.title_length = item->title.size();
+    decoded.dynamic = item->dynamic;
+    decoded.type = item->type;
+    decoded.checked = item->checked;
+    decoded.items = &item->items;
+    return nullptr;
+  }
+};
+
+TEST(MenuDecoderTest, DecodesItemsAtAnyDepth) {
+  std::vector<TestItem> items = {{0, "File", {{1, "Open"}, {2, "Save"}}},
+                                 {3, "Recent", {}, true}};
+  // A chain of sub-menus 10k levels deep, walked without recursion.
+  TestItem* deepest = &items[0].items[0];
+  for (int64_t id = 4; id < 10000; id++) {
+    deepest->items.push_back({id, std::to_string(id)});
+    deepest = &deepest->items.back();
+  }
+  MenuModel model;
+  ASSERT_TRUE(decode_menu<TestReader>(&items, model));
+  EXPECT_EQ(model.nodes.size(), 10001u);
+  NodeIndex file = model.find(0);
+  EXPECT_EQ(model.nodes[file].child_count, 2u);
+  EXPECT_STREQ(model.title(model.child_at(file, 1)), "Save");
+  EXPECT_TRUE(model.nodes[model.find(3)].dynamic);
+  EXPECT_EQ(model.nodes[model.find(9999)].parent, model.find(9998));
+}
+
+TEST(MenuDecoderTest, DecodesDeepWideMenus) {
+  // 64 levels of 1563 items, about 100k in all, the first item of each level
+  // opening the next.
+  constexpr int64_t kWidth = 1563;
+  constexpr int64_t kDepth = 64;
+  std::vector<TestItem> items;
+  std::vector<TestItem>* level = &items;
+  int64_t id = 0;
+  for (int64_t depth = 0; depth < kDepth; depth++) {
+    level->reserve(kWidth);
+    for (int64_t i = 0; i < kWidth; i++) {
+      level->push_back({id, std::to_string(id)});
+      id++;
+    }
+    level = &(*level)[0].items;
+  }
+  MenuModel model;
+  ASSERT_TRUE(decode_menu<TestReader>(&items, model));
+  EXPECT_EQ(model.nodes.size(), static_cast<size_t>(kWidth * kDepth + 1));
+  NodeIndex parent = kRootNode;
+  for (int64_t depth = 0; depth < kDepth; depth++) {
+    EXPECT_EQ(model.nodes[parent].child_count, static_cast<uint32_t>(kWidth));
+    NodeIndex first = model.find(depth * kWidth);
+    ASSERT_NE(first, kNoNode);
+    EXPECT_EQ(model.nodes[first].parent, parent);
+    EXPECT_EQ(model.child_at(parent, kWidth - 1),
+              model.find((depth + 1) * kWidth - 1));
+    parent = first;
+  }
+  EXPECT_STREQ(model.title(model.find(id - 1)), std::to_string(id - 1).c_str());
+}
+
+TEST(MenuDecoderTest, RejectsMalformedItems) {
+  std::vector<TestItem> items = {{0, "File", {{1, "Open"}}}};
+  items[0].items[0].malformed = true;
+  MenuModel model;
+  MenuDecodeError error;
+  EXPECT_FALSE(decode_menu<TestReader>(&items, model, &error));
+  EXPECT_STREQ(error.message, kMenuItemTitleError);
+  EXPECT_EQ(error.id, 1);
+}
+
+TEST(MenuDecoderTest, LeavesModelUnchangedOnDuplicateIds) {
+  std::vector<TestItem> items = {{0, "File"}};
+  MenuModel model;
+  ASSERT_TRUE(decode_menu<TestReader>(&items, model));
+  TestItem edit = {1, "Edit", {{2, "Cut"}, {0, "Copy"}}};
+  MenuDecodeError error;
+  EXPECT_EQ(
+      decode_menu_item<TestReader>(&edit, kRootNode, kNoNode, model, &error),
+      kNoNode);
+  EXPECT_STREQ(error.message, kMenuItemDuplicateIdError);
+  EXPECT_EQ(error.id, 0);
+  EXPECT_EQ(model.nodes[kRootNode].child_count, 1u);
+  EXPECT_EQ(model.find(1), kNoNode);
+  EXPECT_EQ(model.find(2), kNoNode);
+}
+
+TEST(MenuDecoderTest, InsertsBeforeNext) {
+  std::vector<TestItem> items = {{0, "Copy"}, {1, "Paste"}};
+  MenuModel model;
+  ASSERT_TRUE(decode_menu<TestReader>(&items, model));
+  TestItem cut = {2, "Cut"};
+  NodeIndex node = decode_menu_item<TestReader>(
+      &cut, kRootNode, model.child_at(kRootNode, 1), model);
+  EXPECT_EQ(model.child_at(kRootNode, 1), node);
+}
+
+TEST(MenuDecoderTest, KeepsCheckedStateOfCheckableItems) {
+  std::vector<TestItem> items = {{0, "Wrap"}, {1, "Small"}, {2, "Copy"}};
+  items[0].type = MenuItemType::kCheck;
+  items[0].checked = true;
+  items[1].type = MenuItemType::kRadio;
+  // Only check & radio items are checked.
+  items[2].checked = true;
+  MenuModel model;
+  ASSERT_TRUE(decode_menu<TestReader>(&items, model));
+  EXPECT_EQ(model.nodes[model.find(0)].type, MenuItemType::kCheck);
+  EXPECT_TRUE(model.nodes[model.find(0)].checked);
+  EXPECT_EQ(model.nodes[model.find(1)].type, MenuItemType::kRadio);
+  EXPECT_FALSE(model.nodes[model.find(1)].checked);
+  EXPECT_FALSE(model.nodes[model.find(2)].checked);
+}
+
+TEST(MenuDecoderTest, MatchesItemTypes) {
+  MenuItemType type = MenuItemType::kNormal;
+  EXPECT_TRUE(menu_item_type("check", 5, &type));
+  EXPECT_EQ(type, MenuItemType::kCheck);
+  EXPECT_TRUE(menu_item_type("radio", 5, &type));
+  EXPECT_EQ(type, MenuItemType::kRadio);
+  EXPECT_FALSE(menu_item_type("normal", 6, &type));
+  EXPECT_FALSE(menu_item_type("radios", 6, &type));
+}
+
+TEST(MenuDecoderTest, MatchesItemFields) {
+  EXPECT_EQ(menu_item_field("id", 2), MenuItemField::kId);
+  EXPECT_EQ(menu_item_field("title", 5), MenuItemField::kTitle);
+  EXPECT_EQ(menu_item_field("items", 5), MenuItemField::kItems);
+  EXPECT_EQ(menu_item_field("dynamic", 7), MenuItemField::kDynamic);
+  EXPECT_EQ(menu_item_field("icon", 4), MenuItemField::kIcon);
+  EXPECT_EQ(menu_item_field("iconPath", 8), MenuItemField::kIconPath);
+  EXPECT_EQ(menu_item_field("type", 4), MenuItemField::kType);
+  EXPECT_EQ(menu_item_field("checked", 7), MenuItemField::kChecked);
+  EXPECT_EQ(menu_item_field("ids", 3), MenuItemField::kUnknown);
+  EXPECT_EQ(menu_item_field("icons", 5), MenuItemField::kUnknown);
+  EXPECT_EQ(menu_item_field("", 0), MenuItemField::kUnknown);
+}
+
+}  // namespace
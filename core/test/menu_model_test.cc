@@ -0,0 +1,180 @@
+#include "menu_model.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+NodeIndex add(MenuModel& model, int64_t id, const char* title,
+              NodeIndex parent = kRootNode, NodeIndex next = kNoNode) {
+  return model.add(id, title, strlen(title), parent, next);
+}
+
+// Titles of the sub-items of `parent`, in order.
+std::vector<std::string> child_titles(const MenuModel& model,
+                                      NodeIndex parent) {
+  std::vector<std::string> titles;
+  for (NodeIndex child = model.nodes[parent].first_child; child != kNoNode;
+       child = model.nodes[child].next_sibling) {
+    titles.push_back(model.title(child));
+  }
+  return titles;
+}
+
+// Records the nodes passed to `node_added` & `node_removed`.
+struct RecordingModel : MenuModel {
+  std::vector<NodeIndex> added;
+  std::vector<NodeIndex> removed;
+
+ protected:
+  void node_added(NodeIndex node) override { added.push_back(node); }
+  void node_removed(NodeIndex node) override { removed.push_back(node); }
+};
+
+TEST(MenuModelTest, StartsWithRootNode) {
+  MenuModel model;
+  ASSERT_EQ(model.nodes.size(), 1u);
+  EXPECT_EQ(model.nodes[kRootNode].child_count, 0u);
+  EXPECT_EQ(model.find(0), kNoNode);
+}
+
+TEST(MenuModelTest, AddsItemsInOrder) {
+  MenuModel model;
+  NodeIndex copy = add(model, 0, "Copy");
+  NodeIndex paste = add(model, 1, "Paste");
+  add(model, 2, "Cut", kRootNode, paste);
+  EXPECT_EQ(child_titles(model, kRootNode),
+            (std::vector<std::string>{"Copy", "Cut", "Paste"}));
+  EXPECT_EQ(model.find(0), copy);
+  EXPECT_EQ(model.find(1), paste);
+  EXPECT_EQ(model.nodes[copy].parent, kRootNode);
+  EXPECT_EQ(model.child_at(kRootNode, 2), paste);
+  EXPECT_EQ(model.child_at(kRootNode, 3), kNoNode);
+}
+
+TEST(MenuModelTest, RejectsDuplicateAndOutOfRangeIds) {
+  MenuModel model;
+  add(model, 0, "Copy");
+  EXPECT_EQ(add(model, 0, "Paste"), kNoNode);
+  EXPECT_EQ(add(model, -1, "Paste"), kNoNode);
+  EXPECT_EQ(add(model, kMaxMenuItemId + 1, "Paste"), kNoNode);
+  EXPECT_NE(add(model, kMaxMenuItemId, "Paste"), kNoNode);
+  EXPECT_EQ(model.nodes[kRootNode].child_count, 2u);
+}
+
+TEST(MenuModelTest, KeepsDynamicFlag) {
+  MenuModel model;
+  NodeIndex node = model.add(0, "Open", 4, kRootNode, kNoNode, true);
+  EXPECT_TRUE(model.nodes[node].dynamic);
+}
+
+TEST(MenuModelTest, StoresIdenticalIconsOnce) {
+  MenuModel model;
+  NodeIndex open = add(model, 0, "Open");
+  NodeIndex save = add(model, 1, "Save");
+  NodeIndex close = add(model, 2, "Close");
+  model.set_icon(open, "icon.png", 8, true);
+  model.set_icon(save, "icon.png", 8, true);
+  // The same bytes as encoded image data are a different icon.
+  model.set_icon(close, "icon.png", 8, false);
+  EXPECT_EQ(model.nodes[open].icon, model.nodes[save].icon);
+  EXPECT_NE(model.nodes[open].icon, model.nodes[close].icon);
+  EXPECT_EQ(model.icons.size(), 2u);
+  EXPECT_TRUE(model.icons[model.nodes[open].icon].is_path);
+  EXPECT_EQ(model.nodes[kRootNode].icon, kNoIcon);
+}
+
+TEST(MenuModelTest, TogglesCheckAndRadioItems) {
+  MenuModel model;
+  NodeIndex wrap = add(model, 0, "Wrap");
+  NodeIndex small = add(model, 1, "Small");
+  NodeIndex large = add(model, 2, "Large");
+  add(model, 3, "Zoom");
+  NodeIndex other = add(model, 4, "Other");
+  model.nodes[wrap].type = MenuItemType::kCheck;
+  for (NodeIndex node : {small, large, other}) {
+    model.nodes[node].type = MenuItemType::kRadio;
+  }
+  model.nodes[small].checked = true;
+  model.nodes[other].checked = true;
+
+  std::vector<NodeIndex> changed;
+  model.toggle(wrap, changed);
+  EXPECT_TRUE(model.nodes[wrap].checked);
+  model.toggle(large, changed);
+  EXPECT_EQ(changed, (std::vector<NodeIndex>{wrap, small, large}));
+  EXPECT_FALSE(model.nodes[small].checked);
+  // "Zoom" ends the group, the radio item after it is left alone.
+  EXPECT_TRUE(model.nodes[other].checked);
+
+  // A checked radio item stays checked.
+  changed.clear();
+  model.toggle(large, changed);
+  EXPECT_TRUE(changed.empty());
+  EXPECT_TRUE(model.nodes[large].checked);
+}
+
+TEST(MenuModelTest, RemovesSubItemsAndReusesNodes) {
+  RecordingModel model;
+  NodeIndex file = add(model, 0, "File");
+  add(model, 1, "Open", file);
+  add(model, 2, "Save", file);
+  NodeIndex edit = add(model, 3, "Edit");
+  size_t node_count = model.nodes.size();
+  model.remove(file);
+  EXPECT_EQ(model.removed.size(), 3u);
+  EXPECT_EQ(child_titles(model, kRootNode), std::vector<std::string>{"Edit"});
+  EXPECT_EQ(model.find(0), kNoNode);
+  EXPECT_EQ(model.find(1), kNoNode);
+  EXPECT_EQ(model.find(3), edit);
+  // Ids & nodes of removed items are free for later insertions.
+  add(model, 0, "View");
+  add(model, 1, "Help");
+  add(model, 2, "Window");
+  EXPECT_EQ(model.nodes.size(), node_count);
+  EXPECT_EQ(model.added.size(), 7u);
+}
+
+TEST(MenuModelTest, MovesAndClampsPosition) {
+  MenuModel model;
+  NodeIndex file = add(model, 0, "File");
+  NodeIndex open = add(model, 1, "Open", file);
+  add(model, 2, "Edit");
+  EXPECT_EQ(model.move(open, kRootNode, 1), 1u);
+  EXPECT_EQ(child_titles(model, kRootNode),
+            (std::vector<std::string>{"File", "Open", "Edit"}));
+  EXPECT_EQ(model.nodes[file].child_count, 0u);
+  EXPECT_EQ(model.move(open, file, 10), 0u);
+  EXPECT_EQ(model.move(file, kRootNode, -1), 0u);
+  EXPECT_EQ(child_titles(model, file), std::vector<std::string>{"Open"});
+}
+
+TEST(MenuModelTest, ContainsSubItemsAtAnyDepth) {
+  MenuModel model;
+  NodeIndex file = add(model, 0, "File");
+  NodeIndex recent = add(model, 1, "Recent", file);
+  NodeIndex notes = add(model, 2, "Notes.txt", recent);
+  NodeIndex edit = add(model, 3, "Edit");
+  EXPECT_TRUE(model.contains(file, notes));
+  EXPECT_TRUE(model.contains(file, file));
+  EXPECT_FALSE(model.contains(recent, file));
+  EXPECT_FALSE(model.contains(edit, notes));
+}
+
+TEST(MenuModelTest, CompactsTitlesOnceMostlyUnused) {
+  MenuModel model;
+  NodeIndex copy = add(model, 0, "Copy");
+  NodeIndex paste = add(model, 1, "Paste");
+  for (int i = 0; i < 1000; i++) {
+    std::string title = "Copy " + std::to_string(i);
+    model.set_title(copy, title.c_str(), title.size());
+  }
+  EXPECT_STREQ(model.title(copy), "Copy 999");
+  EXPECT_STREQ(model.title(paste), "Paste");
+  EXPECT_LT(model.titles.size(), 64u);
+}
+
+}  // namespace
@@ -0,0 +1,183 @@
+#include "menu_patch.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// An item as a platform codec would decode it.
+struct TestItem {
+  int64_t id;
+  std::string title;
+  std::vector<TestItem> items = {};
+};
+
+// A patch as a platform codec would decode it, see `DecodedMenuPatch`.
+struct TestPatch {
+  MenuPatchOp op;
+  int64_t id = -1;
+  int64_t parent = -1;
+  int64_t index = INT64_MAX;
+  const char* title = nullptr;
+  const TestItem* item = nullptr;
+};
+
+struct TestReader {
+  using Items = const std::vector<TestItem>*;
+  using Item = const TestItem*;
+  using Patch = const TestPatch*;
+
+  static size_t size(Items items) {
+    return items == nullptr ? 0 : items->size();
+  }
+
+  static Item at(Items items, size_t index) { return &(*items)[index]; }
+
+  static const char* read(Item item, DecodedMenuItem<Items>& decoded) {
+    decoded.id = item->id;
+    decoded.title = item->title.c_str();
+    decoded.title_length = item->title.size();
+    decoded.items = &item->items;
+    return nullptr;
+  }
+
+  // Ids below 0 stand in for missing ones.
+  static const char* read_patch(Patch patch,
+                                DecodedMenuPatch<Item>& decoded) {
+    decoded.op = patch->op;
+    decoded.has_id = patch->id >= 0;
+    decoded.id = patch->id;
+    decoded.has_parent = patch->parent >= 0;
+    decoded.parent = patch->parent;
+    decoded.index = patch->index;
+    if (patch->title != nullptr) {
+      decoded.title = patch->title;
+      decoded.title_length = strlen(patch->title);
+    }
+    decoded.has_item = patch->item != nullptr;
+    decoded.item = patch->item;
+    return nullptr;
+  }
+};
+
+// Decodes & applies `patch`, returning the error message if any.
+const char* apply(MenuModel& model, const TestPatch& patch) {
+  MenuPatch<const TestItem*> decoded;
+  const char* error = decode_menu_patch<TestReader>(&patch, model, decoded);
+  if (error != nullptr) return error;
+  return apply_menu_model_patch<TestReader>(model, decoded);
+}
+
+// Titles of the sub-items of `parent`, in order.
+std::vector<std::string> child_titles(const MenuModel& model,
+                                      NodeIndex parent) {
+  std::vector<std::string> titles;
+  for (NodeIndex child = model.nodes[parent].first_child; child != kNoNode;
+       child = model.nodes[child].next_sibling) {
+    titles.push_back(model.title(child));
+  }
+  return titles;
+}
+
+// File > {Open, Save}, Edit.
+MenuModel sample_model() {
+  std::vector<TestItem> items = {{0, "File", {{1, "Open"}, {2, "Save"}}},
+                                 {3, "Edit"}};
+  MenuModel model;
+  decode_menu<TestReader>(&items, model);
+  return model;
+}
+
+TEST(MenuPatchTest, MatchesOps) {
+  EXPECT_EQ(menu_patch_op("insert", 6), MenuPatchOp::kInsert);
+  EXPECT_EQ(menu_patch_op("remove", 6), MenuPatchOp::kRemove);
+  EXPECT_EQ(menu_patch_op("setTitle", 8), MenuPatchOp::kSetTitle);
+  EXPECT_EQ(menu_patch_op("move", 4), MenuPatchOp::kMove);
+  EXPECT_EQ(menu_patch_op("moves", 5), MenuPatchOp::kUnknown);
+  EXPECT_EQ(menu_patch_field("parent", 6), MenuPatchField::kParent);
+  EXPECT_EQ(menu_patch_field("items", 5), MenuPatchField::kUnknown);
+}
+
+TEST(MenuPatchTest, InsertsItemsWithSubItems) {
+  MenuModel model = sample_model();
+  TestItem recent = {4, "Recent", {{5, "a.txt"}}};
+  EXPECT_EQ(apply(model, {MenuPatchOp::kInsert, -1, 0, 1, nullptr, &recent}),
+            nullptr);
+  EXPECT_EQ(child_titles(model, model.find(0)),
+            (std::vector<std::string>{"Open", "Recent", "Save"}));
+  EXPECT_EQ(child_titles(model, model.find(4)),
+            std::vector<std::string>{"a.txt"});
+
+  // Out of range indices are clamped.
+  TestItem help = {6, "Help"};
+  EXPECT_EQ(apply(model, {MenuPatchOp::kInsert, -1, -1, 99, nullptr, &help}),
+            nullptr);
+  TestItem quit = {7, "Quit"};
+  EXPECT_EQ(apply(model, {MenuPatchOp::kInsert, -1, -1, -5, nullptr, &quit}),
+            nullptr);
+  EXPECT_EQ(child_titles(model, kRootNode),
+            (std::vector<std::string>{"Quit", "File", "Edit", "Help"}));
+}
+
+TEST(MenuPatchTest, ReportsPositionsAndOldParents) {
+  MenuModel model = sample_model();
+  TestPatch move = {MenuPatchOp::kMove, 2, -1, 1};
+  MenuPatch<const TestItem*> patch;
+  ASSERT_EQ(decode_menu_patch<TestReader>(&move, model, patch), nullptr);
+  EXPECT_EQ(patch.node, model.find(2));
+  EXPECT_EQ(patch.parent, kRootNode);
+  ASSERT_EQ(apply_menu_model_patch<TestReader>(model, patch), nullptr);
+  EXPECT_EQ(patch.position, 1u);
+  EXPECT_EQ(patch.old_parent, model.find(0));
+  EXPECT_EQ(child_titles(model, kRootNode),
+            (std::vector<std::string>{"File", "Save", "Edit"}));
+
+  TestPatch remove = {MenuPatchOp::kRemove, 1};
+  ASSERT_EQ(decode_menu_patch<TestReader>(&remove, model, patch), nullptr);
+  ASSERT_EQ(apply_menu_model_patch<TestReader>(model, patch), nullptr);
+  EXPECT_EQ(patch.old_parent, model.find(0));
+  EXPECT_EQ(model.find(1), kNoNode);
+  EXPECT_EQ(model.nodes[model.find(0)].child_count, 0u);
+}
+
+TEST(MenuPatchTest, SetsTitles) {
+  MenuModel model = sample_model();
+  EXPECT_EQ(apply(model, {MenuPatchOp::kSetTitle, 3, -1, INT64_MAX, "Edits"}),
+            nullptr);
+  EXPECT_STREQ(model.title(model.find(3)), "Edits");
+}
+
+TEST(MenuPatchTest, RejectsInvalidPatchesUnchanged) {
+  MenuModel model = sample_model();
+  TestItem duplicate = {1, "Open"};
+  TestItem nested = {8, "New", {{2, "Save"}}};
+  std::vector<std::pair<TestPatch, const char*>> patches = {
+      {{MenuPatchOp::kUnknown, 1}, kMenuPatchOpError},
+      {{MenuPatchOp::kRemove}, kMenuPatchIdError},
+      {{MenuPatchOp::kRemove, 9}, kMenuPatchIdError},
+      {{MenuPatchOp::kSetTitle, 1}, kMenuItemTitleError},
+      {{MenuPatchOp::kInsert, -1, 9, 0, nullptr, &duplicate},
+       kMenuPatchParentError},
+      {{MenuPatchOp::kInsert}, kMenuItemNotMapError},
+      {{MenuPatchOp::kInsert, -1, -1, 0, nullptr, &duplicate},
+       kMenuItemDuplicateIdError},
+      {{MenuPatchOp::kInsert, -1, 0, 0, nullptr, &nested},
+       kMenuItemDuplicateIdError},
+      {{MenuPatchOp::kMove, 0, 1}, kMenuPatchMoveError},
+      {{MenuPatchOp::kMove, 0, 0}, kMenuPatchMoveError},
+      {{MenuPatchOp::kMove, 1, 9}, kMenuPatchParentError},
+  };
+  for (auto& [patch, error] : patches) {
+    EXPECT_EQ(apply(model, patch), error);
+  }
+  EXPECT_EQ(model.find(8), kNoNode);
+  EXPECT_EQ(child_titles(model, kRootNode),
+            (std::vector<std::string>{"File", "Edit"}));
+  EXPECT_EQ(child_titles(model, model.find(0)),
+            (std::vector<std::string>{"Open", "Save"}));
+}
+
+}  // namespace
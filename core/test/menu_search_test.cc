@@ -0,0 +1,92 @@
+#include "menu_search.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// A menu whose top-level items have `titles`, their ids being their index.
+MenuModel make_model(const std::vector<std::string>& titles) {
+  MenuModel model;
+  for (size_t i = 0; i < titles.size(); i++) {
+    model.add(static_cast<int64_t>(i), titles[i].c_str(), titles[i].size(),
+              kRootNode, kNoNode);
+  }
+  return model;
+}
+
+// Ids of the items matching `prefix`, in index order.
+std::vector<int32_t> find_ids(const MenuModel& model,
+                              const MenuSearchIndex& index,
+                              const std::string& prefix) {
+  std::string key;
+  fold_menu_title(prefix.c_str(), prefix.size(), key);
+  MenuSearchIndex::Range range = index.find(key.c_str(), key.size());
+  std::vector<int32_t> ids;
+  for (size_t i = range.begin; i < range.end; i++) {
+    ids.push_back(model.nodes[index.entries[i].node].id);
+  }
+  return ids;
+}
+
+TEST(MenuSearchTest, FoldsAsciiLetters) {
+  std::string key;
+  fold_menu_title("Copy Path \xC3\x89", 12, key);
+  EXPECT_EQ(key, "copy path \xC3\x89");
+}
+
+TEST(MenuSearchTest, FindsItemsByPrefix) {
+  MenuModel model =
+      make_model({"Paste", "copy", "Copy Path", "Cut", "Delete", "co"});
+  MenuSearchIndex index;
+  index.build(model, kRootNode);
+  EXPECT_EQ(find_ids(model, index, "co"), (std::vector<int32_t>{5, 1, 2}));
+  EXPECT_EQ(find_ids(model, index, "COPY"), (std::vector<int32_t>{1, 2}));
+  EXPECT_EQ(find_ids(model, index, "copy p"), std::vector<int32_t>{2});
+  EXPECT_EQ(find_ids(model, index, "x"), std::vector<int32_t>{});
+  EXPECT_EQ(find_ids(model, index, "").size(), 6u);
+}
+
+TEST(MenuSearchTest, KeepsMenuOrderOfEqualTitles) {
+  MenuModel model = make_model({"b", "a", "B", "A"});
+  MenuSearchIndex index;
+  index.build(model, kRootNode);
+  EXPECT_EQ(find_ids(model, index, "a"), (std::vector<int32_t>{1, 3}));
+  EXPECT_EQ(find_ids(model, index, "b"), (std::vector<int32_t>{0, 2}));
+}
+
+TEST(MenuSearchTest, DiffsOnlyChangedItems) {
+  MenuModel model = make_model({"cat", "car", "dog", "cow"});
+  MenuSearchIndex index;
+  index.build(model, kRootNode);
+  std::vector<std::pair<int32_t, bool>> changes;
+  auto record = [&](NodeIndex node, bool matches) {
+    changes.push_back({model.nodes[node].id, matches});
+  };
+  MenuSearchIndex::Range ca = index.find("ca", 2);
+  index.diff(index.all(), ca, record);
+  EXPECT_EQ(changes, (std::vector<std::pair<int32_t, bool>>{{3, false},
+                                                            {2, false}}));
+  changes.clear();
+  index.diff(ca, index.find("d", 1), record);
+  EXPECT_EQ(changes, (std::vector<std::pair<int32_t, bool>>{
+                         {1, false}, {0, false}, {2, true}}));
+  changes.clear();
+  index.diff(ca, ca, record);
+  EXPECT_TRUE(changes.empty());
+}
+
+TEST(MenuSearchTest, IndexesSubItemsOfParent) {
+  MenuModel model;
+  NodeIndex tags = model.add(0, "Tags", 4, kRootNode, kNoNode);
+  model.add(1, "todo", 4, tags, kNoNode);
+  model.add(2, "Tools", 5, kRootNode, kNoNode);
+  MenuSearchIndex index;
+  index.build(model, tags);
+  EXPECT_EQ(find_ids(model, index, "t"), std::vector<int32_t>{1});
+}
+
+}  // namespace
@@ -0,0 +1,152 @@
+#include "packed_menu.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Builds packed menus in the format written by Dart.
+struct PackedMenuBuilder {
+  std::vector<PackedMenuNode> nodes;
+  std::string strings;
+
+  PackedMenuBuilder& add(int32_t id, int32_t parent, const std::string& title,
+                         uint32_t flags = 0) {
+    nodes.push_back({id, parent, flags, static_cast<uint32_t>(strings.size()),
+                     static_cast<uint32_t>(title.size())});
+    strings += title;
+    return *this;
+  }
+
+  std::vector<uint8_t> build() const {
+    PackedMenuHeader header = {kPackedMenuVersion,
+                               static_cast<uint32_t>(nodes.size()),
+                               static_cast<uint32_t>(strings.size())};
+    size_t nodes_size = nodes.size() * sizeof(PackedMenuNode);
+    std::vector<uint8_t> data(sizeof(header) + nodes_size + strings.size());
+    memcpy(data.data(), &header, sizeof(header));
+    memcpy(data.data() + sizeof(header), nodes.data(), nodes_size);
+    memcpy(data.data() + sizeof(header) + nodes_size, strings.data(),
+           strings.size());
+    return data;
+  }
+};
+
+bool read(const std::vector<uint8_t>& data, MenuModel& model) {
+  return read_packed_menu(data.data(), data.size(), model);
+}
+
+TEST(PackedMenuTest, ReadsNodesInOrder) {
+  std::vector<uint8_t> data = PackedMenuBuilder()
+                                  .add(0, -1, "File", kPackedMenuItemHasItems)
+                                  .add(1, 0, "Open")
+                                  .add(2, -1, "Recent",
+                                       kPackedMenuItemHasDynamicItems)
+                                  .build();
+  MenuModel model;
+  ASSERT_TRUE(read(data, model));
+  ASSERT_EQ(model.nodes.size(), 4u);
+  EXPECT_EQ(model.nodes[kRootNode].child_count, 2u);
+  EXPECT_EQ(model.nodes[2].parent, 1u);
+  EXPECT_STREQ(model.title(2), "Open");
+  EXPECT_EQ(model.find(2), 3u);
+  EXPECT_TRUE(model.nodes[3].dynamic);
+  EXPECT_FALSE(model.nodes[1].dynamic);
+}
+
+TEST(PackedMenuTest, ReadsCheckableItems) {
+  std::vector<uint8_t> data =
+      PackedMenuBuilder()
+          .add(0, -1, "Wrap", kPackedMenuItemIsCheck | kPackedMenuItemChecked)
+          .add(1, -1, "Small", kPackedMenuItemIsRadio)
+          .add(2, -1, "Copy", kPackedMenuItemChecked)
+          .build();
+  MenuModel model;
+  ASSERT_TRUE(read(data, model));
+  EXPECT_EQ(model.nodes[1].type, MenuItemType::kCheck);
+  EXPECT_TRUE(model.nodes[1].checked);
+  EXPECT_EQ(model.nodes[2].type, MenuItemType::kRadio);
+  EXPECT_FALSE(model.nodes[2].checked);
+  EXPECT_EQ(model.nodes[3].type, MenuItemType::kNormal);
+  EXPECT_FALSE(model.nodes[3].checked);
+}
+
+TEST(PackedMenuTest, RejectsTruncatedPayloads) {
+  std::vector<uint8_t> data = PackedMenuBuilder().add(0, -1, "Copy").build();
+  for (size_t size = 0; size < data.size(); size++) {
+    MenuModel model;
+    EXPECT_FALSE(read_packed_menu(data.data(), size, model)) << size;
+  }
+  data.push_back(0);
+  MenuModel model;
+  EXPECT_FALSE(read(data, model));
+}
+
+TEST(PackedMenuTest, RejectsUnknownVersion) {
+  std::vector<uint8_t> data = PackedMenuBuilder().add(0, -1, "Copy").build();
+  data[0] = kPackedMenuVersion + 1;
+  MenuModel model;
+  EXPECT_FALSE(read(data, model));
+}
+
+TEST(PackedMenuTest, RejectsForwardParents) {
+  std::vector<uint8_t> data =
+      PackedMenuBuilder().add(0, 1, "Copy").add(1, -1, "Edit").build();
+  MenuModel model;
+  EXPECT_FALSE(read(data, model));
+}
+
+TEST(PackedMenuTest, RejectsNegativeParents) {
+  std::vector<uint8_t> data =
+      PackedMenuBuilder().add(0, -1, "Edit").add(1, -2, "Copy").build();
+  MenuModel model;
+  EXPECT_FALSE(read(data, model));
+}
+
+TEST(PackedMenuTest, RejectsTitlesOutOfBounds) {
+  PackedMenuBuilder builder;
+  builder.add(0, -1, "Copy");
+  builder.nodes[0].title_length = 5;
+  MenuModel model;
+  EXPECT_FALSE(read(builder.build(), model));
+}
+
+TEST(PackedMenuTest, RejectsDuplicateIds) {
+  std::vector<uint8_t> data =
+      PackedMenuBuilder().add(0, -1, "Copy").add(0, -1, "Paste").build();
+  MenuModel model;
+  EXPECT_FALSE(read(data, model));
+}
+
+TEST(PackedMenuTest, RejectsInvalidUtf8) {
+  std::vector<uint8_t> data =
+      PackedMenuBuilder().add(0, -1, std::string("\xC3\x28", 2)).build();
+  MenuModel model;
+  EXPECT_FALSE(read(data, model));
+}
+
+TEST(PackedMenuTest, RejectsNulInTitles) {
+  std::vector<uint8_t> data =
+      PackedMenuBuilder().add(0, -1, std::string("Co\0py", 5)).build();
+  MenuModel model;
+  EXPECT_FALSE(read(data, model));
+}
+
+TEST(PackedMenuTest, ValidatesUtf8) {
+  EXPECT_TRUE(is_valid_utf8("", 0));
+  EXPECT_TRUE(is_valid_utf8("Copy", 4));
+  EXPECT_TRUE(is_valid_utf8("…", 3));
+  EXPECT_TRUE(is_valid_utf8("\U0001F600", 4));
+  // Truncated, overlong, surrogate & out of range sequences.
+  EXPECT_FALSE(is_valid_utf8("\xE2\x80", 2));
+  EXPECT_FALSE(is_valid_utf8("\xC0\xAF", 2));
+  EXPECT_FALSE(is_valid_utf8("\xE0\x80\xAF", 3));
+  EXPECT_FALSE(is_valid_utf8("\xED\xA0\x80", 3));
+  EXPECT_FALSE(is_valid_utf8("\xF4\x90\x80\x80", 4));
+  EXPECT_FALSE(is_valid_utf8("\x80", 1));
+}
+
+}  // namespace
@@ -1,2 +1,16 @@
 export 'src/context_menu_region.dart';
-export 'src/method_channel.dart' show MenuItem, ShowMenuArgs, showContextMenu;
+export 'src/method_channel.dart'
+    show
+        MenuEncoding,
+        MenuHighlight,
+        MenuItem,
+        MenuItemType,
+        MenuPatch,
+        RegisteredMenu,
+        ShowMenuArgs,
+        configureContextMenu,
+        contextMenuHighlights,
+        debugPendingContextMenuShows,
+        getContextMenuStats,
+        registerMenu,
+        showContextMenu;
@@ -26,6 +26,34 @@ class ContextMenuRegion extends StatefulWidget {
 class _ContextMenuRegionState extends State<ContextMenuRegion> {
   bool shouldReact = false;
 
+  // Native menu built from `_menuItems`, registered on first use and shown
+  // by handle afterwards, where menus are not cached by their items.
+  Future<RegisteredMenu>? _menu;
+  List<MenuItem>? _menuItems;
+
+  @override
+  void didUpdateWidget(ContextMenuRegion oldWidget) {
+    super.didUpdateWidget(oldWidget);
+    // Items are usually rebuilt along with the widget, so the menu is only
+    // registered again once they differ.
+    final menuItems = _menuItems;
+    if (menuItems != null && !menuItemsEqual(menuItems, widget.menuItems)) {
+      _disposeMenu();
+    }
+  }
+
+  @override
+  void dispose() {
+    _disposeMenu();
+    super.dispose();
+  }
+
+  void _disposeMenu() {
+    _menu?.then((menu) => menu.dispose());
+    _menu = null;
+    _menuItems = null;
+  }
+
   @override
   Widget build(BuildContext context) {
     return Listener(
@@ -43,13 +71,26 @@ class _ContextMenuRegionState extends State<ContextMenuRegion> {
           e.position.dy + widget.menuOffset.dy,
         );
 
-        final selectedItem = await showContextMenu(
-          ShowMenuArgs(
-            MediaQuery.of(context).devicePixelRatio,
+        final devicePixelRatio = MediaQuery.of(context).devicePixelRatio;
+        MenuItem? selectedItem;
+        if (canCacheContextMenu(widget.menuItems)) {
+          // Regions showing identical items, e.g. the rows of a list, share
+          // the menu cached natively by the hash of the items.
+          selectedItem = await showContextMenu(ShowMenuArgs(
+            devicePixelRatio,
             position,
             widget.menuItems,
-          ),
-        );
+            cached: true,
+          ));
+        } else {
+          final menuItems = _menuItems ??= widget.menuItems;
+          final menu = await (_menu ??= registerMenu(menuItems));
+          selectedItem = await menu.show(devicePixelRatio, position);
+          // The menu may be registered from an equal list of earlier items.
+          if (selectedItem != null && identical(_menuItems, menuItems)) {
+            selectedItem = _sameItem(selectedItem, menuItems, widget.menuItems);
+          }
+        }
 
         if (selectedItem != null) {
           widget.onItemSelected?.call(selectedItem);
@@ -61,3 +102,15 @@ class _ContextMenuRegionState extends State<ContextMenuRegion> {
     );
   }
 }
+
+/// Returns the item of [to] at the place of [item] in [from], trees which
+/// [menuItemsEqual], or [item] if it is not part of [from], e.g. a sub-item
+/// built by [MenuItem.itemsBuilder].
+MenuItem _sameItem(MenuItem item, List<MenuItem> from, List<MenuItem> to) {
+  for (var i = 0; i < from.length; i++) {
+    if (identical(from[i], item)) return to[i];
+    final found = _sameItem(item, from[i].items, to[i].items);
+    if (!identical(found, item)) return found;
+  }
+  return item;
+}
@@ -1,45 +1,201 @@
 import 'dart:async';
+import 'dart:convert';
+import 'dart:math' show max;
+import 'dart:typed_data';
 
-import 'package:flutter/services.dart' show MethodChannel;
+import 'package:flutter/foundation.dart'
+    show TargetPlatform, defaultTargetPlatform, visibleForTesting;
+import 'package:flutter/services.dart'
+    show
+        BasicMessageChannel,
+        BinaryCodec,
+        EventChannel,
+        MethodChannel,
+        MissingPluginException,
+        PlatformException;
 import 'package:flutter/widgets.dart' show Offset, VoidCallback;
 
+import 'native_buffer.dart';
+import 'native_port.dart';
+
 /// Method channel name of the plugin.
 const String _kChannelName = 'native_context_menu';
 
+/// Binary channel name of the plugin.
+/// Registers a menu sent in the packed format & replies with its handle.
+const String _kPackedChannelName = 'native_context_menu/packed';
+
+/// Event channel name of the plugin.
+/// While listened to, streams the highlight changes of the shown menu, at most
+/// one batch per frame: `{request, highlights}` where `highlights` is the list
+/// of `{id, highlighted}` changes since the previous batch.
+const String _kHighlightsChannelName = 'native_context_menu/highlights';
+
+/// Packed menu format version, the first field of the header.
+const int _kPackedMenuVersion = 1;
+
+/// Set in the flags of a packed node which has sub-items.
+const int _kPackedMenuItemHasItems = 1 << 0;
+
+/// Set in the flags of a packed node whose sub-items are built on demand.
+const int _kPackedMenuItemHasDynamicItems = 1 << 1;
+
+/// Set in the flags of a packed node of a [MenuItemType.check] item.
+const int _kPackedMenuItemIsCheck = 1 << 2;
+
+/// Set in the flags of a packed node of a [MenuItemType.radio] item.
+const int _kPackedMenuItemIsRadio = 1 << 3;
+
+/// Set in the flags of a packed node of a checked check or radio item.
+const int _kPackedMenuItemChecked = 1 << 4;
+
+/// Header of a packed menu: version, node count & size of the titles.
+const int _kPackedMenuHeaderSize = 12;
+
+/// Packed menu node: id, parent index, flags, title offset & title length.
+const int _kPackedMenuNodeSize = 20;
+
 /// Show menu call.
 /// Shows context menu at passed position or cursor position.
 /// Pass `devicePixelRatio` and `position` from Dart to show menu at specified position.
 /// If it is not defined, native code will show the context menu at the cursor's position.
+/// Pass `handle` instead of `items` to show a menu created by [registerMenu].
+/// Pass `buffer` & `bufferSize` instead of `items` to show a menu written in
+/// the packed format into a [NativeMenuBuffer].
+/// `request` identifies the show in the outcome reported by the native side.
+/// `keepOpen` keeps the menu open while check & radio items are toggled.
+/// Pass `hash` to show the menu cached for the structural hash of the items,
+/// which fails with `cache_miss` if there is none, or if its item count & title
+/// bytes differ from the `check` passed along. The show is then sent again
+/// with the items & `hash`, which caches them.
+/// `port` is the native port of a `SendPort` which the outcome is posted to,
+/// instead of calling [_kOnItemSelected] or [_kOnMenuDismissed].
 const String _kShowMenu = "showMenu";
 
-/// Called when an item is selected from the context menu.
+/// Register menu call.
+/// Builds a native menu once & returns a handle to show it later. Takes
+/// `items`, or a `buffer` as [_kShowMenu].
+const String _kRegisterMenu = "registerMenu";
+
+/// Update menu call.
+/// Applies a list of patches to a native menu created by [registerMenu] in place.
+const String _kUpdateMenu = "updateMenu";
+
+/// Dispose menu call.
+/// Releases a native menu created by [registerMenu].
+const String _kDisposeMenu = "disposeMenu";
+
+/// Configure call.
+/// Sets plugin options, platforms ignore the ones they do not support.
+const String _kConfigure = "configure";
+
+/// Get stats call.
+/// Returns the latency of each phase of recent menu shows.
+const String _kGetStats = "getStats";
+
+/// Called when an item is selected from the context menu, with the `request`
+/// of its show & the `id` of the item. Both outcomes carry `toggled`, the list
+/// of `{id, checked}` of the check & radio items toggled while the menu was
+/// shown, if any.
 const String _kOnItemSelected = "onItemSelected";
 
-/// Called when menu is dismissed without clicking any item.
+/// Called when menu is dismissed without clicking any item, with the `request`
+/// of its show & the `reason`: `dismissed`, or `superseded` if it was closed
+/// because another menu is shown.
 const String _kOnMenuDismissed = "onMenuDismissed";
 
+/// Called when an item with [MenuItem.itemsBuilder] is opened.
+/// Replies with its sub-items.
+const String _kOnItemsRequested = "onItemsRequested";
+
+/// Kind of a [MenuItem].
+enum MenuItemType {
+  /// An item which closes the menu when picked.
+  normal,
+
+  /// An item showing a check mark, toggled when picked.
+  check,
+
+  /// An item of a group of radio items, checked when picked while the others
+  /// of the group are unchecked. A group is a run of radio items next to each
+  /// other among the same parent.
+  radio,
+}
+
 class MenuItem {
   MenuItem({
     required this.title,
     this.onSelected,
     this.action,
     this.items = const <MenuItem>[],
-  });
+    this.itemsBuilder,
+    this.icon,
+    this.iconPath,
+    this.type = MenuItemType.normal,
+    this.checked = false,
+    this.onToggled,
+  })  : assert(
+          itemsBuilder == null || items.isEmpty,
+          'Either items or itemsBuilder can be passed.',
+        ),
+        assert(
+          icon == null || iconPath == null,
+          'Either icon or iconPath can be passed.',
+        );
 
   late int _id;
-  final String title;
+  String title;
   final List<MenuItem> items;
   final Object? action;
 
+  /// Builds the sub-items when the user opens this item, instead of before
+  /// the menu is shown. The result is kept until the menu is closed.
+  ///
+  /// Only Linux builds sub-items on demand, other platforms call
+  /// [itemsBuilder] before showing the menu.
+  final FutureOr<List<MenuItem>> Function()? itemsBuilder;
+
   final VoidCallback? onSelected;
 
+  /// Encoded image, e.g. PNG, shown before the title. Icons are decoded off
+  /// the UI thread & cached, so the menu is shown at once & each icon appears
+  /// once decoded. Showing the same icon again does not decode it again.
+  ///
+  /// Currently shown on Linux only.
+  final Uint8List? icon;
+
+  /// Path of an image file shown before the title, like [icon].
+  final String? iconPath;
+
+  final MenuItemType type;
+
+  /// Whether a check or radio item is checked. Updated once the menu it was
+  /// toggled in closes, see [ShowMenuArgs.keepOpen].
+  ///
+  /// Check & radio items are toggled natively on Linux only, other platforms
+  /// only show their state.
+  bool checked;
+
+  /// Called with the new state of a check or radio item once the menu it was
+  /// toggled in closes.
+  final void Function(bool checked)? onToggled;
+
+  bool get isCheckable => type != MenuItemType.normal;
+
   bool get hasSubitems => items.isNotEmpty;
 
+  bool get hasDynamicItems => itemsBuilder != null;
+
   Map<String, dynamic> toJson() {
     return {
       'id': _id,
       'title': title,
       'items': items.map((e) => e.toJson()).toList(),
+      if (hasDynamicItems) 'dynamic': true,
+      if (icon != null) 'icon': icon,
+      if (iconPath != null) 'iconPath': iconPath,
+      if (isCheckable) 'type': type == MenuItemType.check ? 'check' : 'radio',
+      if (isCheckable) 'checked': checked,
     };
   }
 }
@@ -48,62 +204,880 @@ class ShowMenuArgs {
   ShowMenuArgs(
     this.devicePixelRatio,
     this.position,
-    this.items,
-  );
+    this.items, {
+    this.searchable = false,
+    this.keepOpen = false,
+    this.encoding = MenuEncoding.standard,
+    this.cached = false,
+  });
 
   final double devicePixelRatio;
   final Offset position;
   final List<MenuItem> items;
 
+  /// Whether typing while the menu is shown hides the top-level items whose
+  /// title does not start with the typed text. Meant for menus listing
+  /// thousands of items. Currently implemented on Linux only.
+  final bool searchable;
+
+  /// Whether picking a check or radio item toggles it without closing the
+  /// menu. The toggles are reported together once the menu closes. Currently
+  /// implemented on Linux only.
+  final bool keepOpen;
+
+  /// How [items] are sent to the native side. Shown menus are only sent
+  /// through [MenuEncoding.nativeBuffer], [MenuEncoding.packed] is sent as
+  /// [MenuEncoding.standard].
+  final MenuEncoding encoding;
+
+  /// Whether the native side keeps the built menu, to show it again when the
+  /// same tree of items is shown later, e.g. from another row of a list. The
+  /// tree is then hashed instead of sent & built again. Currently implemented
+  /// on Linux only, & not for menus with check or radio items, whose state
+  /// changes natively. See [configureContextMenu] for the cache budgets.
+  final bool cached;
+
   Map<String, dynamic> toJson() {
+    return {
+      ..._optionsToJson(),
+      'items': items.map((e) => e.toJson()).toList(),
+    };
+  }
+
+  Map<String, dynamic> _optionsToJson() {
     return {
       'devicePixelRatio': devicePixelRatio,
       'position': <double>[position.dx, position.dy],
-      'items': items.map((e) => e.toJson()).toList(),
+      if (searchable) 'searchable': true,
+      if (keepOpen) 'keepOpen': true,
     };
   }
 }
 
+/// How [registerMenu] sends the item tree to the native side.
+enum MenuEncoding {
+  /// Nested maps encoded by the standard method codec.
+  standard,
+
+  /// A single buffer holding a table of nodes & their UTF-8 titles, which the
+  /// native side reads without decoding a map per item. Falls back to
+  /// [standard] on platforms which do not support it & for menus with icons.
+  packed,
+
+  /// The [packed] table written through `dart:ffi` straight into a buffer of
+  /// the plugin, which reads it in place. Neither the table nor its titles are
+  /// copied through the platform channel or decoded by a codec. Only supported
+  /// on Linux, falls back to [packed] elsewhere & to [standard] for menus with
+  /// icons.
+  nativeBuffer,
+}
+
+/// A change applied in place to a [RegisteredMenu] by [RegisteredMenu.update].
+class MenuPatch {
+  /// Inserts [item] & its sub-items at [index] among the items of [parent], or
+  /// among the top-level items if [parent] is `null`.
+  MenuPatch.insert(this.item, {required int this.index, this.parent})
+      : _op = 'insert',
+        _title = null;
+
+  /// Removes [item] & its sub-items.
+  MenuPatch.remove(this.item)
+      : _op = 'remove',
+        index = null,
+        parent = null,
+        _title = null;
+
+  /// Changes the title of [item].
+  MenuPatch.setTitle(this.item, String title)
+      : _op = 'setTitle',
+        index = null,
+        parent = null,
+        _title = title;
+
+  /// Moves [item] to [index] among the items of [parent], or among the
+  /// top-level items if [parent] is `null`. [index] is counted after [item] is
+  /// taken out of its current place.
+  MenuPatch.move(this.item, {required int this.index, this.parent})
+      : _op = 'move',
+        _title = null;
+
+  final MenuItem item;
+  final MenuItem? parent;
+  final int? index;
+
+  final String _op;
+  final String? _title;
+}
+
+/// A change of the highlighted state of an item of the shown menu, e.g. as the
+/// pointer moves over it. See [contextMenuHighlights].
+class MenuHighlight {
+  const MenuHighlight(this.item, {required this.highlighted});
+
+  final MenuItem item;
+
+  /// Whether [item] became highlighted, or is no longer.
+  final bool highlighted;
+}
+
+/// A native menu built once by [registerMenu] & shown by its [handle].
+///
+/// The native side keeps the built menu alive until [dispose] is called, so
+/// showing it does not send or rebuild the item tree again.
+class RegisteredMenu {
+  RegisteredMenu._(this.handle, this._items, this._nextId);
+
+  final int handle;
+  final Map<int, MenuItem> _items;
+
+  // Id given to the next inserted item. The ids of dynamic sub-items are
+  // reused on every show, ids of inserted items are never reused.
+  int _nextId;
+
+  bool _disposed = false;
+
+  bool get isDisposed => _disposed;
+
+  /// Shows the menu at [position]. See [ShowMenuArgs.searchable] &
+  /// [ShowMenuArgs.keepOpen].
+  ///
+  /// Completes with the selected item, or `null` once the menu is dismissed
+  /// or closed because another menu is shown meanwhile.
+  Future<MenuItem?> show(
+    double devicePixelRatio,
+    Offset position, {
+    bool searchable = false,
+    bool keepOpen = false,
+  }) async {
+    assert(!_disposed, 'Cannot show a disposed menu.');
+
+    final shown = _ShownMenu(_items, _nextId);
+    _shownMenu = shown;
+    final id = await _showMenu(
+      shown,
+      _ShowCall({
+        'handle': handle,
+        'devicePixelRatio': devicePixelRatio,
+        'position': <double>[position.dx, position.dy],
+        if (searchable) 'searchable': true,
+        if (keepOpen) 'keepOpen': true,
+      }),
+    );
+
+    final item = _items[id];
+    // Dynamic sub-items are requested again on the next show, under the same
+    // ids, which the native side drops before the menu is shown or updated.
+    shown.dynamicIds.forEach(_items.remove);
+    if (identical(_shownMenu, shown)) _shownMenu = null;
+
+    return item;
+  }
+
+  /// Applies [patches] in order to the native menu, without rebuilding it.
+  ///
+  /// Only items changed by a patch are touched on the native side.
+  /// Currently implemented on Linux only.
+  Future<void> update(List<MenuPatch> patches) async {
+    assert(!_disposed, 'Cannot update a disposed menu.');
+
+    await _channel.invokeMethod(_kUpdateMenu, {
+      'handle': handle,
+      'patches': patches.map(_applyPatch).toList(),
+    });
+  }
+
+  Map<String, dynamic> _applyPatch(MenuPatch patch) {
+    final item = patch.item;
+    final parent = patch.parent;
+
+    if (patch._op == 'insert') {
+      // While this menu is shown, inserted items are numbered after its
+      // dynamic sub-items, which are still part of the native menu.
+      final shown = _shownMenu;
+      final isShown = shown != null && identical(shown.items, _items);
+      _menuItemId = isShown ? max(_nextId, shown!.nextId) : _nextId;
+      _items.addAll(_buildMenu([item]));
+      _nextId = _menuItemId;
+      if (isShown) shown!.nextId = _menuItemId;
+      _menuItemId = 0;
+    } else {
+      assert(_items[item._id] == item, 'Item is not part of this menu.');
+    }
+    assert(
+      parent == null || _items[parent._id] == parent,
+      'Parent is not part of this menu.',
+    );
+
+    switch (patch._op) {
+      case 'insert':
+        return {
+          'op': patch._op,
+          'parent': parent?._id,
+          'index': patch.index,
+          'item': item.toJson(),
+        };
+      case 'remove':
+        _removeItem(item);
+
+        return {'op': patch._op, 'id': item._id};
+      case 'setTitle':
+        item.title = patch._title!;
+
+        return {'op': patch._op, 'id': item._id, 'title': item.title};
+      default:
+        return {
+          'op': patch._op,
+          'id': item._id,
+          'parent': parent?._id,
+          'index': patch.index,
+        };
+    }
+  }
+
+  void _removeItem(MenuItem item) {
+    _items.remove(item._id);
+    item.items.forEach(_removeItem);
+  }
+
+  Future<void> dispose() async {
+    if (_disposed) return;
+    _disposed = true;
+
+    await _channel.invokeMethod(_kDisposeMenu, {'handle': handle});
+  }
+}
+
+const _packedChannel =
+    BasicMessageChannel<ByteData>(_kPackedChannelName, BinaryCodec());
+
 final _channel = const MethodChannel(_kChannelName)
   ..setMethodCallHandler(
     (call) async {
       switch (call.method) {
         case _kOnItemSelected:
           {
-            _contextMenuCompleter.complete(call.arguments);
+            final arguments = call.arguments as Map;
+            _completeShow(arguments, arguments['id'] as int);
             break;
           }
         case _kOnMenuDismissed:
           {
-            _contextMenuCompleter.complete(null);
+            final arguments = call.arguments as Map;
+            _completeShow(arguments, null);
             break;
           }
-        default:
+        case _kOnItemsRequested:
           {
-            _contextMenuCompleter.completeError(
-              Exception('$_kChannelName: Invalid method call received.'),
-            );
+            return _buildDynamicItems(call.arguments as int);
           }
+        default:
+          throw MissingPluginException(
+            '$_kChannelName: Invalid method call received.',
+          );
       }
     },
   );
 
-Completer<int?> _contextMenuCompleter = Completer<int?>();
+/// Shows waiting for their outcome, keyed by the request id sent with them.
+/// Every show completes exactly once: when an item is selected, when the menu
+/// is dismissed, when a later show supersedes it or when it fails.
+final _shows = <int, _ShownMenu>{};
+
+int _lastShowRequest = 0;
+
+/// Receives the outcomes of shows posted by the native side, where supported.
+final _outcomePort = openOutcomePort(
+  (outcome) => _completeShow(outcome, outcome['id'] as int?),
+);
+
+/// Number of shows waiting for their outcome, which is zero once every menu
+/// is closed.
+@visibleForTesting
+int get debugPendingContextMenuShows => _shows.length;
+
+/// Arguments of a show call, along with the [buffer] the menu is written into,
+/// which is freed once the call returns.
+class _ShowCall {
+  _ShowCall(this.arguments, [this.buffer]);
+
+  final Map<String, dynamic> arguments;
+  final NativeMenuBuffer? buffer;
+}
+
+/// Sends the show [call] of [shown] & returns the id of the selected item, or
+/// `null` if the menu is dismissed or superseded by a later show.
+///
+/// If [call] only passes a `hash` & no menu is cached for it, the show is sent
+/// again as [onCacheMiss], unless a later show was sent meanwhile.
+Future<int?> _showMenu(
+  _ShownMenu shown,
+  _ShowCall call, {
+  _ShowCall Function()? onCacheMiss,
+}) {
+  final request = ++_lastShowRequest;
+  shown.request = request;
+  _shows[request] = shown;
+  final port = _outcomePort?.sendPort.nativePort;
+
+  Future<void> send(_ShowCall call) {
+    return _channel.invokeMethod<void>(_kShowMenu, {
+      ...call.arguments,
+      'request': request,
+      if (port != null) 'port': port,
+    }).whenComplete(() => call.buffer?.free());
+  }
+
+  send(call).catchError(
+    (Object error) async {
+      // A later show superseded this one before it was shown.
+      if (request != _lastShowRequest) {
+        _shows.remove(request)?.outcome.complete(null);
+        return;
+      }
+      await send(onCacheMiss!());
+    },
+    test: (error) =>
+        onCacheMiss != null &&
+        error is PlatformException &&
+        error.code == 'cache_miss',
+  ).then(
+    (_) {},
+    onError: (Object error, StackTrace stackTrace) {
+      _shows.remove(request)?.outcome.completeError(error, stackTrace);
+    },
+  );
+
+  return shown.outcome.future;
+}
+
+/// Completes the show of the outcome [arguments] with the selected item [id],
+/// after applying the check & radio items it toggled.
+void _completeShow(Map arguments, int? id) {
+  final shown = _shows.remove(arguments['request']);
+  if (shown == null) return;
+
+  final toggled = arguments['toggled'] as List? ?? const [];
+  for (final Map toggle in toggled) {
+    final item = shown.items[toggle['id']];
+    if (item == null) continue;
+    item.checked = toggle['checked'] as bool;
+    item.onToggled?.call(item.checked);
+  }
+  shown.outcome.complete(id);
+}
 
 int _menuItemId = 0;
 
+/// Items of the menu currently shown, which dynamic sub-items are added to.
+class _ShownMenu {
+  _ShownMenu(this.items, this.nextId);
+
+  final Map<int, MenuItem> items;
+
+  // Request id of the show, set once it is sent.
+  int request = 0;
+
+  // Completes with the id of the selected item, or `null`.
+  final Completer<int?> outcome = Completer<int?>();
+
+  // Id given to the next dynamic sub-item.
+  int nextId;
+
+  // Ids of the dynamic sub-items built while the menu is shown.
+  final List<int> dynamicIds = [];
+}
+
+_ShownMenu? _shownMenu;
+
+/// Builds the sub-items of the item [id] of the shown menu & returns them
+/// encoded for the native side, or `null` if the menu is closed meanwhile.
+Future<List<Map<String, dynamic>>?> _buildDynamicItems(int id) async {
+  final shown = _shownMenu;
+  final builder = shown?.items[id]?.itemsBuilder;
+  if (shown == null || builder == null) return null;
+
+  final items = await builder();
+  if (!identical(_shownMenu, shown)) return null;
+
+  _menuItemId = shown.nextId;
+  final built = _buildMenu(items);
+  shown.nextId = _menuItemId;
+  _menuItemId = 0;
+  shown.items.addAll(built);
+  shown.dynamicIds.addAll(built.keys);
+
+  return items.map((e) => e.toJson()).toList();
+}
+
+/// FNV-1a offset basis & prime, over integers which wrap around on overflow.
+const int _kFnvOffsetBasis = 0xcbf29ce484222325;
+const int _kFnvPrime = 0x100000001b3;
+
+/// Whether the native side can cache the menu of [items], see
+/// [ShowMenuArgs.cached]. Check & radio items are not cached, since their
+/// state changes natively as they are toggled.
+bool canCacheContextMenu(List<MenuItem> items) =>
+    defaultTargetPlatform == TargetPlatform.linux &&
+    !_hasCheckableItems(items);
+
+bool _hasCheckableItems(List<MenuItem> items) => items.any(
+      (item) => item.isCheckable || _hasCheckableItems(item.items),
+    );
+
+/// Whether the trees of [a] & [b] show the same items, so that a native menu
+/// built from one can be shown for the other. Callbacks & actions are not
+/// compared.
+bool menuItemsEqual(List<MenuItem> a, List<MenuItem> b) {
+  if (identical(a, b)) return true;
+  if (a.length != b.length) return false;
+  for (var i = 0; i < a.length; i++) {
+    final x = a[i];
+    final y = b[i];
+    if (identical(x, y)) continue;
+    if (x.title != y.title ||
+        x.iconPath != y.iconPath ||
+        x.type != y.type ||
+        x.checked != y.checked ||
+        x.hasDynamicItems != y.hasDynamicItems ||
+        !_bytesEqual(x.icon, y.icon) ||
+        !menuItemsEqual(x.items, y.items)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool _bytesEqual(Uint8List? a, Uint8List? b) {
+  if (identical(a, b)) return true;
+  if (a == null || b == null || a.length != b.length) return false;
+  for (var i = 0; i < a.length; i++) {
+    if (a[i] != b[i]) return false;
+  }
+  return true;
+}
+
+/// Structural hash of a tree of items, along with a check value which the
+/// native side compares to the menu it cached for [hash], so that trees whose
+/// hashes collide are told apart.
+class _MenuDigest {
+  _MenuDigest(this.hash, this.check);
+
+  final int hash;
+
+  /// Number of items in the upper 32 bits, & bytes of their UTF-8 titles in
+  /// the lower ones.
+  final int check;
+}
+
+/// Hashes of icon bytes, so that the bytes of an icon shown again, usually
+/// from the same [Uint8List], are only hashed once.
+final _iconHashes = Expando<int>('iconHash');
+
+int _hashIcon(Uint8List icon) {
+  var hash = _kFnvOffsetBasis;
+  for (final byte in icon) {
+    hash = (hash ^ byte) * _kFnvPrime;
+  }
+  return hash;
+}
+
+/// Returns the bytes taken by [value] encoded as UTF-8, as sent to the native
+/// side. Unpaired surrogates are encoded as U+FFFD.
+int _utf8Length(String value) {
+  var length = 0;
+  for (var i = 0; i < value.length; i++) {
+    final unit = value.codeUnitAt(i);
+    if (unit < 0x80) {
+      length += 1;
+    } else if (unit < 0x800) {
+      length += 2;
+    } else if ((unit & 0xFC00) == 0xD800 &&
+        i + 1 < value.length &&
+        (value.codeUnitAt(i + 1) & 0xFC00) == 0xDC00) {
+      length += 4;
+      i++;
+    } else {
+      length += 3;
+    }
+  }
+  return length;
+}
+
+/// Returns a hash of the titles, icons & shape of the tree of [items]. Equal
+/// trees are given the same ids by [_buildMenu], so that a menu built for one
+/// can be shown for the other.
+_MenuDigest _hashMenu(List<MenuItem> items) {
+  var hash = _kFnvOffsetBasis;
+  var itemCount = 0;
+  var titleLength = 0;
+  void add(int value) => hash = (hash ^ value) * _kFnvPrime;
+  void addString(String? value) {
+    add(value?.length ?? -1);
+    value?.codeUnits.forEach(add);
+  }
+
+  void addItems(List<MenuItem> items) {
+    add(items.length);
+    for (final item in items) {
+      itemCount++;
+      titleLength += _utf8Length(item.title);
+      addString(item.title);
+      addString(item.iconPath);
+      add(item.hasDynamicItems ? 1 : 0);
+      final icon = item.icon;
+      add(icon?.length ?? -1);
+      if (icon != null) add(_iconHashes[icon] ??= _hashIcon(icon));
+      addItems(item.items);
+    }
+  }
+
+  addItems(items);
+
+  return _MenuDigest(hash, (itemCount << 32) | (titleLength & 0xFFFFFFFF));
+}
+
+/// Whether the native side requests dynamic sub-items when they are opened.
+/// Otherwise they are built before the menu is sent.
+bool get _supportsDynamicItems => defaultTargetPlatform == TargetPlatform.linux;
+
+/// Returns [items] with the sub-items of every [MenuItem.itemsBuilder] built,
+/// for platforms which cannot request them on demand. Items are only copied
+/// when they or their sub-items are dynamic.
+Future<List<MenuItem>> _resolveDynamicItems(List<MenuItem> items) async {
+  final resolved = <MenuItem>[];
+  var changed = false;
+  for (final item in items) {
+    final builder = item.itemsBuilder;
+    final subitems = builder != null
+        ? await _resolveDynamicItems(await builder())
+        : await _resolveDynamicItems(item.items);
+    if (builder == null && identical(subitems, item.items)) {
+      resolved.add(item);
+      continue;
+    }
+    changed = true;
+    resolved.add(MenuItem(
+      title: item.title,
+      onSelected: item.onSelected,
+      action: item.action,
+      items: subitems,
+      icon: item.icon,
+      iconPath: item.iconPath,
+      type: item.type,
+      checked: item.checked,
+      onToggled: item.onToggled,
+    ));
+  }
+
+  return changed ? resolved : items;
+}
+
+/// Shows a menu of [ShowMenuArgs.items] & completes with the selected item, or
+/// `null` once the menu is dismissed or closed because another menu is shown
+/// meanwhile. Overlapping calls each complete with their own outcome.
 Future<MenuItem?> showContextMenu(ShowMenuArgs args) async {
+  if (!_supportsDynamicItems) {
+    args = ShowMenuArgs(
+      args.devicePixelRatio,
+      args.position,
+      await _resolveDynamicItems(args.items),
+      searchable: args.searchable,
+      keepOpen: args.keepOpen,
+      encoding: args.encoding,
+      cached: args.cached,
+    );
+  }
   final menu = _buildMenu(args.items);
+  final shown = _ShownMenu(menu, _menuItemId);
   _menuItemId = 0;
 
-  _channel.invokeMethod(_kShowMenu, args.toJson());
+  final digest = args.cached && canCacheContextMenu(args.items)
+      ? _hashMenu(args.items)
+      : null;
+
+  _ShowCall itemsCall() {
+    NativeMenuBuffer? buffer;
+    if (args.encoding == MenuEncoding.nativeBuffer && !_hasIcons(args.items)) {
+      buffer = _writeNativeMenu(args.items);
+    }
+    final arguments = buffer != null
+        ? {
+            ...args._optionsToJson(),
+            'buffer': buffer.address,
+            'bufferSize': buffer.size,
+          }
+        : args.toJson();
+    if (digest != null) arguments['hash'] = digest.hash;
 
-  final id = await _contextMenuCompleter.future;
-  _contextMenuCompleter = Completer<int?>();
+    return _ShowCall(arguments, buffer);
+  }
+
+  _shownMenu = shown;
+  final id = await _showMenu(
+    shown,
+    digest != null
+        ? _ShowCall({
+            ...args._optionsToJson(),
+            'hash': digest.hash,
+            'check': digest.check,
+          })
+        : itemsCall(),
+    onCacheMiss: digest != null ? itemsCall : null,
+  );
+  if (identical(_shownMenu, shown)) _shownMenu = null;
 
   return menu[id];
 }
 
+/// Configures the native side of the plugin. Options left `null` are not
+/// changed.
+///
+/// [widgetPoolSize] is the number of native menu item widgets kept for reuse
+/// by later menus, which makes showing menus of a similar size again cheaper.
+/// [iconCacheSize] is the number of bytes of decoded [MenuItem.icon]s kept for
+/// later menus, 8 MiB by default. Only used on Linux.
+/// [menuCacheSize] & [menuCacheWidgets] are the bytes & native item widgets of
+/// the [ShowMenuArgs.cached] menus kept for later shows, 4 MiB & 1024 by
+/// default. The least recently shown menus are dropped over either, & both
+/// are lowered while the system warns of low memory. Only used on Linux.
+/// [traceFile] starts recording every menu shown, its timing & outcome to that
+/// file, to replay them with the `native_context_menu_replay` tool. An empty
+/// path stops recording. Only used on Linux.
+Future<void> configureContextMenu({
+  int? widgetPoolSize,
+  int? iconCacheSize,
+  int? menuCacheSize,
+  int? menuCacheWidgets,
+  String? traceFile,
+}) async {
+  await _channel.invokeMethod(_kConfigure, {
+    if (widgetPoolSize != null) 'widgetPoolSize': widgetPoolSize,
+    if (iconCacheSize != null) 'iconCacheSize': iconCacheSize,
+    if (menuCacheSize != null) 'menuCacheSize': menuCacheSize,
+    if (menuCacheWidgets != null) 'menuCacheWidgets': menuCacheWidgets,
+    if (traceFile != null) 'traceFile': traceFile,
+  });
+}
+
+/// Returns the latency of each phase of the recent menu shows, in
+/// microseconds, to find where the time of a slow right-click went.
+///
+/// Phases are `decode` (reading the items), `build` (creating the widgets),
+/// `popup` (the native popup call), `firstPaint` & `outcome` (from the show
+/// request until the menu is first painted, and until an item is selected or
+/// the menu is dismissed). The first paint of the first menu is reported as
+/// `firstShow` instead, apart from the steady state, & `warmUp` is the hidden
+/// menu built after the app's first frame so that the first menu is not the
+/// slowest. Each phase maps to the `count` of measurements &
+/// the `p50`, `p95`, `p99` & `max` of the last 1024 of them. `widgetPool` holds
+/// the `hits`, `misses` & `size` of the widget pool, `iconCache` the `hits`,
+/// `misses`, `size` in bytes & `count` of the decoded icons, `menuCache` the
+/// `hits`, `misses`, `hitRate` in percent, `size` in bytes, `widgets` & `count`
+/// of the [ShowMenuArgs.cached] menus. Debug builds of the plugin also report
+/// `live`, the number of `menus`, `widgets` & `nodes` currently alive, which
+/// stay flat as menus are shown & dismissed.
+///
+/// Currently implemented on Linux only.
+Future<Map<String, Map<String, int>>> getContextMenuStats() async {
+  final stats = await _channel.invokeMapMethod<String, Map>(_kGetStats);
+
+  return {
+    for (final entry in stats!.entries)
+      entry.key: entry.value.cast<String, int>(),
+  };
+}
+
+/// Highlight changes of the shown menu, e.g. to start loading what the item
+/// under the pointer leads to before it is picked.
+///
+/// The native side only collects them while the stream is listened to, and
+/// sends at most one batch per frame, so moving the pointer quickly over the
+/// menu does not flood the platform channel. An item highlighted & left within
+/// a frame is not reported. Batches of menus closed meanwhile are dropped.
+///
+/// Currently implemented on Linux only.
+Stream<List<MenuHighlight>> get contextMenuHighlights => _highlights;
+
+final _highlights = const EventChannel(_kHighlightsChannelName)
+    .receiveBroadcastStream()
+    .map(_readHighlights)
+    .where((highlights) => highlights.isNotEmpty);
+
+/// Reads a batch of highlight changes sent by the native side, keeping those
+/// of items of the shown menu.
+List<MenuHighlight> _readHighlights(dynamic event) {
+  final shown = _shownMenu;
+  if (shown == null || shown.request != event['request']) return const [];
+
+  final highlights = <MenuHighlight>[];
+  for (final Map highlight in event['highlights']) {
+    final item = shown.items[highlight['id']];
+    if (item == null) continue;
+    highlights.add(
+      MenuHighlight(item, highlighted: highlight['highlighted'] as bool),
+    );
+  }
+
+  return highlights;
+}
+
+/// Builds a native menu from [items] once, to be shown any number of times
+/// with [RegisteredMenu.show]. Call [RegisteredMenu.dispose] once the menu is
+/// no longer needed.
+///
+/// Large menus can be sent in a more compact form with [MenuEncoding.packed].
+Future<RegisteredMenu> registerMenu(
+  List<MenuItem> items, {
+  MenuEncoding encoding = MenuEncoding.standard,
+}) async {
+  if (!_supportsDynamicItems) items = await _resolveDynamicItems(items);
+  final menu = _buildMenu(items);
+  final nextId = _menuItemId;
+  _menuItemId = 0;
+
+  int? handle;
+  if (encoding == MenuEncoding.nativeBuffer && !_hasIcons(items)) {
+    handle = await _registerNativeMenu(items);
+  }
+  if (encoding != MenuEncoding.standard && !_hasIcons(items)) {
+    handle ??= await _registerPackedMenu(items);
+  }
+  handle ??= await _channel.invokeMethod<int>(_kRegisterMenu, {
+    'items': items.map((e) => e.toJson()).toList(),
+  });
+
+  return RegisteredMenu._(handle!, menu, nextId);
+}
+
+/// Whether any of [items] or their sub-items has an icon, which the packed
+/// format does not carry.
+bool _hasIcons(List<MenuItem> items) => items.any(
+      (item) =>
+          item.icon != null || item.iconPath != null || _hasIcons(item.items),
+    );
+
+/// Registers [items] written into a native buffer. Returns `null` if the
+/// platform does not support native buffers.
+Future<int?> _registerNativeMenu(List<MenuItem> items) async {
+  final buffer = _writeNativeMenu(items);
+  if (buffer == null) return null;
+
+  try {
+    return await _channel.invokeMethod<int>(_kRegisterMenu, {
+      'buffer': buffer.address,
+      'bufferSize': buffer.size,
+    });
+  } finally {
+    buffer.free();
+  }
+}
+
+/// Registers [items] through the binary channel. Returns `null` if the
+/// platform does not handle packed menus.
+Future<int?> _registerPackedMenu(List<MenuItem> items) async {
+  final reply = await _packedChannel.send(
+    ByteData.sublistView(_encodePackedMenu(items)),
+  );
+  if (reply == null) return null;
+  if (reply.lengthInBytes != 8) {
+    throw PlatformException(
+      code: 'invalid_menu',
+      message: '$_kPackedChannelName: Malformed packed menu.',
+    );
+  }
+
+  return reply.getInt64(0, Endian.little);
+}
+
+/// Encodes [items], whose ids are already assigned, in the packed format.
+Uint8List _encodePackedMenu(List<MenuItem> items) {
+  final packed = _PackedMenu(items);
+  final bytes = Uint8List(packed.size);
+  packed.write(bytes);
+
+  return bytes;
+}
+
+/// Writes [items], whose ids are already assigned, in the packed format into a
+/// buffer of the plugin, which reads it in place. Returns `null` if the
+/// platform does not support native buffers.
+NativeMenuBuffer? _writeNativeMenu(List<MenuItem> items) {
+  final packed = _PackedMenu(items);
+  final buffer = NativeMenuBuffer.allocate(packed.size);
+  if (buffer != null) packed.write(buffer.bytes);
+
+  return buffer;
+}
+
+/// [MenuItem]s laid out in the packed format, before they are written.
+///
+/// Nodes are stored in pre-order, so that the parent of a node always comes
+/// before it. Identical titles are stored once.
+class _PackedMenu {
+  _PackedMenu(List<MenuItem> items) {
+    _collect(items, -1);
+    for (final item in _nodes) {
+      if (_titles.containsKey(item.title)) continue;
+      final title = const Utf8Encoder().convert(item.title);
+      _titles[item.title] = title;
+      _titleOffsets[item.title] = _stringsSize;
+      _stringsSize += title.length;
+    }
+  }
+
+  final _nodes = <MenuItem>[];
+  final _parents = <int>[];
+  final _titles = <String, Uint8List>{};
+  final _titleOffsets = <String, int>{};
+  var _stringsSize = 0;
+
+  int get _stringsStart =>
+      _kPackedMenuHeaderSize + _nodes.length * _kPackedMenuNodeSize;
+
+  /// Size of the packed menu in bytes.
+  int get size => _stringsStart + _stringsSize;
+
+  void _collect(List<MenuItem> items, int parent) {
+    for (final item in items) {
+      final index = _nodes.length;
+      _nodes.add(item);
+      _parents.add(parent);
+      _collect(item.items, index);
+    }
+  }
+
+  /// Writes the packed menu into the first [size] bytes of [bytes].
+  void write(Uint8List bytes) {
+    final data = ByteData.sublistView(bytes)
+      ..setUint32(0, _kPackedMenuVersion, Endian.little)
+      ..setUint32(4, _nodes.length, Endian.little)
+      ..setUint32(8, _stringsSize, Endian.little);
+
+    for (var i = 0; i < _nodes.length; i++) {
+      final item = _nodes[i];
+      final offset = _kPackedMenuHeaderSize + i * _kPackedMenuNodeSize;
+      data
+        ..setInt32(offset, item._id, Endian.little)
+        ..setInt32(offset + 4, _parents[i], Endian.little)
+        ..setUint32(
+          offset + 8,
+          (item.hasSubitems ? _kPackedMenuItemHasItems : 0) |
+              (item.hasDynamicItems ? _kPackedMenuItemHasDynamicItems : 0) |
+              (item.type == MenuItemType.check ? _kPackedMenuItemIsCheck : 0) |
+              (item.type == MenuItemType.radio ? _kPackedMenuItemIsRadio : 0) |
+              (item.isCheckable && item.checked ? _kPackedMenuItemChecked : 0),
+          Endian.little,
+        )
+        ..setUint32(offset + 12, _titleOffsets[item.title]!, Endian.little)
+        ..setUint32(offset + 16, _titles[item.title]!.length, Endian.little);
+    }
+    final stringsStart = _stringsStart;
+    _titles.forEach((title, encoded) {
+      bytes.setAll(stringsStart + _titleOffsets[title]!, encoded);
+    });
+  }
+}
+
 Map<int, MenuItem> _buildMenu(List<MenuItem> items) {
   final built = <int, MenuItem>{};
 
@@ -0,0 +1,83 @@
+import 'dart:ffi';
+import 'dart:io' show Platform;
+import 'dart:typed_data';
+
+/// Name of the shared library of the Linux plugin.
+const String _kPluginLibraryName = 'libnative_context_menu_plugin.so';
+
+typedef _BufferNewNative = Pointer<Uint8> Function(Int64 size);
+typedef _BufferNew = Pointer<Uint8> Function(int size);
+typedef _BufferFreeNative = Void Function(Pointer<Uint8> buffer);
+typedef _BufferFree = void Function(Pointer<Uint8> buffer);
+
+/// A buffer allocated by the plugin, which Dart writes a packed menu into &
+/// the plugin reads in place, without a copy through the platform channel.
+class NativeMenuBuffer {
+  NativeMenuBuffer._(this._pointer, this.size);
+
+  final Pointer<Uint8> _pointer;
+  final int size;
+
+  /// Address of the buffer, passed to the plugin.
+  int get address => _pointer.address;
+
+  /// Bytes of the buffer, valid until [free] is called.
+  Uint8List get bytes => _pointer.asTypedList(size);
+
+  bool _freed = false;
+
+  /// Frees the buffer once the call it was passed to has completed.
+  void free() {
+    if (_freed) return;
+    _freed = true;
+    _allocator!._free(_pointer);
+  }
+
+  /// Allocates a buffer of [size] bytes, or returns `null` if the plugin does
+  /// not export buffers, i.e. on platforms other than Linux.
+  static NativeMenuBuffer? allocate(int size) {
+    final allocator = _allocator;
+    if (allocator == null) return null;
+
+    final pointer = allocator._new(size);
+    if (pointer.address == 0) return null;
+
+    return NativeMenuBuffer._(pointer, size);
+  }
+}
+
+/// Buffer functions exported by the plugin library.
+class _Allocator {
+  _Allocator(DynamicLibrary library)
+      : _new = library.lookupFunction<_BufferNewNative, _BufferNew>(
+          'native_context_menu_buffer_new',
+        ),
+        _free = library.lookupFunction<_BufferFreeNative, _BufferFree>(
+          'native_context_menu_buffer_free',
+        );
+
+  final _BufferNew _new;
+  final _BufferFree _free;
+}
+
+/// Looked up once, `null` if the plugin library is not loaded.
+final _Allocator? _allocator = _openAllocator();
+
+_Allocator? _openAllocator() {
+  final library = pluginLibrary;
+
+  return library != null ? _Allocator(library) : null;
+}
+
+/// The shared library of the plugin, which exports functions called through
+/// `dart:ffi`, or `null` on platforms other than Linux.
+final DynamicLibrary? pluginLibrary = _openPluginLibrary();
+
+DynamicLibrary? _openPluginLibrary() {
+  if (!Platform.isLinux) return null;
+  try {
+    return DynamicLibrary.open(_kPluginLibraryName);
+  } on ArgumentError {
+    return null;
+  }
+}
@@ -0,0 +1,40 @@
+import 'dart:ffi';
+import 'dart:isolate';
+
+import 'native_buffer.dart';
+
+typedef _InitializeDartApiNative = IntPtr Function(Pointer<Void> data);
+typedef _InitializeDartApi = int Function(Pointer<Void> data);
+
+/// Opens a port which the plugin posts the outcomes of shown menus to with
+/// `Dart_PostCObject`, instead of calling back through the method channel.
+/// Each outcome is passed to [onOutcome] as the map the method channel would
+/// carry. Returns `null` if the plugin does not support native ports, i.e. on
+/// platforms other than Linux, or if its Dart API is incompatible with the VM.
+ReceivePort? openOutcomePort(void Function(Map outcome) onOutcome) {
+  final library = pluginLibrary;
+  if (library == null) return null;
+
+  final initialized =
+      library.lookupFunction<_InitializeDartApiNative, _InitializeDartApi>(
+    'native_context_menu_initialize_dart_api',
+  )(NativeApi.initializeApiDLData);
+  if (initialized != 0) return null;
+
+  return ReceivePort()
+    ..listen((message) => onOutcome(_readMap(message as List)));
+}
+
+/// Reads a map posted as a list of its keys & values in turn. The `toggled`
+/// items of an outcome are maps too.
+Map _readMap(List pairs) {
+  final map = <Object?, Object?>{};
+  for (var i = 0; i + 1 < pairs.length; i += 2) {
+    final value = pairs[i + 1];
+    map[pairs[i]] = pairs[i] == 'toggled'
+        ? [for (final item in value as List) _readMap(item as List)]
+        : value;
+  }
+
+  return map;
+}
@@ -0,0 +1,458 @@
+// Measures how long the Linux plugin takes to decode, read, build, pop up,
+// search & tear down menus of various shapes. Needs a display, run it through
+// the `native_context_menu_benchmark_run` target to use Xvfb & write the
+// results as JSON.
+
+#include <benchmark/benchmark.h>
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../menu.h"
+
+namespace {
+
+// Menu item handlers, nothing is clicked while benchmarking.
+void ignore_signal(GtkWidget*, gpointer) {}
+const MenuCallbacks kCallbacks = {ignore_signal, ignore_signal, ignore_signal,
+                                  ignore_signal, ignore_signal, nullptr};
+
+// A menu with `depth` levels of `width` items each, the first item of every
+// level but the last opening the next one. Titles are `title_length` bytes.
+struct MenuShape {
+  int64_t width;
+  int64_t depth;
+  int64_t title_length;
+
+  MenuShape(int64_t width, int64_t depth, int64_t title_length)
+      : width(width), depth(depth), title_length(title_length) {}
+  explicit MenuShape(const benchmark::State& state)
+      : MenuShape(state.range(0), state.range(1), state.range(2)) {}
+
+  int64_t item_count() const { return width * depth; }
+  // Only the widgets of the top-level items are created with a menu, those of
+  // sub-menus as they are opened.
+  int64_t widget_count() const { return width; }
+
+  std::string title(int32_t id) const {
+    std::string title = std::to_string(id);
+    title.resize(title_length, 'x');
+    return title;
+  }
+};
+
+// Builds the `items` argument of `registerMenu` for `shape`.
+FlValue* make_items(const MenuShape& shape) {
+  int32_t next_id = 0;
+  FlValue* top_level = fl_value_new_list();
+  FlValue* level = top_level;
+  for (int64_t depth = 0; depth < shape.depth; depth++) {
+    FlValue* next_level = nullptr;
+    for (int64_t i = 0; i < shape.width; i++) {
+      FlValue* item = fl_value_new_map();
+      FlValue* sub_items = fl_value_new_list();
+      fl_value_set_string_take(item, "id", fl_value_new_int(next_id));
+      fl_value_set_string_take(
+          item, "title", fl_value_new_string(shape.title(next_id).c_str()));
+      fl_value_set_string(item, "items", sub_items);
+      if (i == 0 && depth + 1 < shape.depth) next_level = sub_items;
+      fl_value_unref(sub_items);
+      fl_value_append_take(level, item);
+      next_id++;
+    }
+    level = next_level;
+  }
+  return top_level;
+}
+
+// Appends the items of `shape` at `depth` & below to a packed node table, in
+// pre-order as Dart sends them.
+void append_packed_items(const MenuShape& shape, int64_t depth, int32_t parent,
+                         std::vector<PackedMenuNode>& nodes,
+                         std::string& strings) {
+  for (int64_t i = 0; i < shape.width; i++) {
+    auto index = static_cast<int32_t>(nodes.size());
+    std::string title = shape.title(index);
+    bool has_items = i == 0 && depth + 1 < shape.depth;
+    nodes.push_back({index, parent, has_items ? kPackedMenuItemHasItems : 0,
+                     static_cast<uint32_t>(strings.size()),
+                     static_cast<uint32_t>(title.size())});
+    strings += title;
+    if (has_items) append_packed_items(shape, depth + 1, index, nodes, strings);
+  }
+}
+
+// Encodes `shape` in the packed format read by `build_packed_menu`.
+std::vector<uint8_t> make_packed_items(const MenuShape& shape) {
+  std::vector<PackedMenuNode> nodes;
+  std::string strings;
+  nodes.reserve(shape.item_count());
+  append_packed_items(shape, 0, -1, nodes, strings);
+  PackedMenuHeader header = {kPackedMenuVersion,
+                             static_cast<uint32_t>(nodes.size()),
+                             static_cast<uint32_t>(strings.size())};
+  size_t nodes_size = nodes.size() * sizeof(PackedMenuNode);
+  std::vector<uint8_t> data(sizeof(header) + nodes_size + strings.size());
+  memcpy(data.data(), &header, sizeof(header));
+  memcpy(data.data() + sizeof(header), nodes.data(), nodes_size);
+  memcpy(data.data() + sizeof(header) + nodes_size, strings.data(),
+         strings.size());
+  return data;
+}
+
+void set_items_counter(benchmark::State& state, const MenuShape& shape) {
+  state.counters["items"] = benchmark::Counter(
+      static_cast<double>(shape.item_count() * state.iterations()),
+      benchmark::Counter::kIsRate);
+}
+
+void set_widgets_counter(benchmark::State& state, const MenuShape& shape) {
+  state.counters["widgets"] = benchmark::Counter(
+      static_cast<double>(shape.widget_count() * state.iterations()),
+      benchmark::Counter::kIsRate);
+}
+
+// Decoding the standard codec message sent by `registerMenu`.
+void BM_DecodeItems(benchmark::State& state) {
+  MenuShape shape(state);
+  g_autoptr(FlStandardMessageCodec) codec = fl_standard_message_codec_new();
+  g_autoptr(FlValue) items = make_items(shape);
+  g_autoptr(GBytes) message =
+      fl_message_codec_encode_message(FL_MESSAGE_CODEC(codec), items, nullptr);
+  for (auto _ : state) {
+    g_autoptr(FlValue) decoded = fl_message_codec_decode_message(
+        FL_MESSAGE_CODEC(codec), message, nullptr);
+    benchmark::DoNotOptimize(decoded);
+  }
+  set_items_counter(state, shape);
+  state.counters["bytes"] = static_cast<double>(g_bytes_get_size(message));
+}
+
+// Reading decoded items into the menu model, without creating any widget.
+void BM_ReadItems(benchmark::State& state) {
+  MenuShape shape(state);
+  g_autoptr(FlValue) items = make_items(shape);
+  for (auto _ : state) {
+    MenuModel model;
+    if (!read_menu_items(items, model)) {
+      state.SkipWithError("Malformed menu items.");
+      break;
+    }
+    benchmark::DoNotOptimize(model.nodes.data());
+  }
+  set_items_counter(state, shape);
+}
+
+// Reading a packed payload into the menu model, without creating any widget,
+// the counterpart of `BM_DecodeItems` & `BM_ReadItems`.
+void BM_ReadPackedItems(benchmark::State& state) {
+  MenuShape shape(state);
+  std::vector<uint8_t> data = make_packed_items(shape);
+  for (auto _ : state) {
+    MenuModel model;
+    if (!read_packed_menu(data.data(), data.size(), model)) {
+      state.SkipWithError("Malformed packed menu.");
+      break;
+    }
+    benchmark::DoNotOptimize(model.nodes.data());
+  }
+  set_items_counter(state, shape);
+  state.counters["bytes"] = static_cast<double>(data.size());
+}
+
+// Building the `GtkMenu` from decoded items, without the widget pool.
+void BM_BuildMenu(benchmark::State& state) {
+  MenuShape shape(state);
+  g_autoptr(FlValue) items = make_items(shape);
+  for (auto _ : state) {
+    auto menu = build_menu(items, &kCallbacks, nullptr, nullptr);
+    state.PauseTiming();
+    menu.reset();
+    state.ResumeTiming();
+  }
+  set_widgets_counter(state, shape);
+}
+
+// Building the `GtkMenu` from decoded items, reusing pooled widgets.
+void BM_BuildMenuPooled(benchmark::State& state) {
+  MenuShape shape(state);
+  g_autoptr(FlValue) items = make_items(shape);
+  WidgetPool pool;
+  pool.set_limit(shape.width);
+  for (auto _ : state) {
+    auto menu = build_menu(items, &kCallbacks, &pool, nullptr);
+    state.PauseTiming();
+    menu.reset();
+    state.ResumeTiming();
+  }
+  set_widgets_counter(state, shape);
+  state.counters["pool_hits"] = static_cast<double>(pool.hits);
+  state.counters["pool_misses"] = static_cast<double>(pool.misses);
+}
+
+// Building the `GtkMenu` from a packed payload.
+void BM_BuildPackedMenu(benchmark::State& state) {
+  MenuShape shape(state);
+  std::vector<uint8_t> data = make_packed_items(shape);
+  for (auto _ : state) {
+    auto menu =
+        build_packed_menu(data.data(), data.size(), &kCallbacks, nullptr);
+    if (menu == nullptr) {
+      state.SkipWithError("Malformed packed menu.");
+      break;
+    }
+    state.PauseTiming();
+    menu.reset();
+    state.ResumeTiming();
+  }
+  set_widgets_counter(state, shape);
+  state.counters["bytes"] = static_cast<double>(data.size());
+}
+
+// Time from `gtk_menu_popup_at_rect` until the menu is mapped on screen.
+void BM_PopupMenu(benchmark::State& state) {
+  MenuShape shape(state);
+  g_autoptr(FlValue) items = make_items(shape);
+  GtkWidget* window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_default_size(GTK_WINDOW(window), 800, 600);
+  gtk_widget_show(window);
+  while (gtk_events_pending()) gtk_main_iteration();
+  GdkRectangle rectangle = {100, 100, 1, 1};
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto menu = build_menu(items, &kCallbacks, nullptr, nullptr);
+    state.ResumeTiming();
+    gtk_menu_popup_at_rect(GTK_MENU(menu->widget),
+                           gtk_widget_get_window(window), &rectangle,
+                           GDK_GRAVITY_NORTH_WEST, GDK_GRAVITY_NORTH_WEST,
+                           nullptr);
+    gint64 deadline = g_get_monotonic_time() + 5 * G_USEC_PER_SEC;
+    while (!gtk_widget_get_mapped(menu->widget) &&
+           g_get_monotonic_time() < deadline) {
+      gtk_main_iteration_do(FALSE);
+    }
+    state.PauseTiming();
+    bool mapped = gtk_widget_get_mapped(menu->widget);
+    gtk_menu_popdown(GTK_MENU(menu->widget));
+    menu.reset();
+    while (gtk_events_pending()) gtk_main_iteration();
+    state.ResumeTiming();
+    if (!mapped) {
+      state.SkipWithError("Menu was not mapped, is a display available?");
+      break;
+    }
+  }
+  gtk_widget_destroy(window);
+  set_widgets_counter(state, shape);
+}
+
+// Destroying a built menu, without the widget pool.
+void BM_DestroyMenu(benchmark::State& state) {
+  MenuShape shape(state);
+  g_autoptr(FlValue) items = make_items(shape);
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto menu = build_menu(items, &kCallbacks, nullptr, nullptr);
+    state.ResumeTiming();
+    menu.reset();
+  }
+  set_widgets_counter(state, shape);
+}
+
+// Returns a new `updateMenu` patch map of `op`.
+FlValue* make_patch(const char* op) {
+  FlValue* patch = fl_value_new_map();
+  fl_value_set_string_take(patch, "op", fl_value_new_string(op));
+  return patch;
+}
+
+// Changing a registered menu of `range(0)` top-level items by one renamed,
+// one inserted & one removed item through `updateMenu` patches.
+void BM_PatchMenu(benchmark::State& state) {
+  MenuShape shape(state.range(0), 1, 8);
+  g_autoptr(FlValue) items = make_items(shape);
+  auto menu = build_menu(items, &kCallbacks, nullptr, nullptr);
+  int64_t middle = shape.width / 2;
+  g_autoptr(FlValue) renames = fl_value_new_list();
+  for (const char* title : {"Renamed", "Restored"}) {
+    FlValue* rename = make_patch("setTitle");
+    fl_value_set_string_take(rename, "id", fl_value_new_int(middle));
+    fl_value_set_string_take(rename, "title", fl_value_new_string(title));
+    fl_value_append_take(renames, rename);
+  }
+  g_autoptr(FlValue) insert = make_patch("insert");
+  FlValue* item = fl_value_new_map();
+  fl_value_set_string_take(item, "id", fl_value_new_int(shape.width));
+  fl_value_set_string_take(item, "title", fl_value_new_string("Inserted"));
+  fl_value_set_string_take(insert, "index", fl_value_new_int(middle));
+  fl_value_set_string_take(insert, "item", item);
+  g_autoptr(FlValue) remove = make_patch("remove");
+  fl_value_set_string_take(remove, "id", fl_value_new_int(shape.width));
+  size_t iteration = 0;
+  for (auto _ : state) {
+    const char* error = apply_menu_patch(
+        *menu, fl_value_get_list_value(renames, iteration++ % 2));
+    if (error == nullptr) error = apply_menu_patch(*menu, insert);
+    if (error == nullptr) error = apply_menu_patch(*menu, remove);
+    if (error != nullptr) {
+      state.SkipWithError(error);
+      break;
+    }
+  }
+}
+
+// Rebuilding the menu of `BM_PatchMenu` from all of its items instead, as
+// `showMenu` does, including the teardown of the previous menu.
+void BM_RebuildMenu(benchmark::State& state) {
+  MenuShape shape(state.range(0), 1, 8);
+  g_autoptr(FlValue) items = make_items(shape);
+  auto menu = build_menu(items, &kCallbacks, nullptr, nullptr);
+  for (auto _ : state) {
+    menu = build_menu(items, &kCallbacks, nullptr, nullptr);
+  }
+}
+
+// Time available to handle a keystroke at 60 frames per second, as in the
+// core search benchmark.
+constexpr auto kFrameBudget = std::chrono::microseconds(16667);
+
+// Queries typed by `BM_TypeInMenu`, one keystroke at a time. Titles are the
+// item ids padded with "x".
+constexpr const char* kQueries[] = {"12", "4", "x", "4999"};
+
+// Sends a key press of `keyval` to the shown `menu`, as typed by the user.
+void press_key(GtkWidget* menu, guint keyval) {
+  GdkEvent* event = gdk_event_new(GDK_KEY_PRESS);
+  event->key.window = GDK_WINDOW(g_object_ref(gtk_widget_get_window(menu)));
+  event->key.send_event = TRUE;
+  event->key.time = GDK_CURRENT_TIME;
+  event->key.keyval = keyval;
+  GdkSeat* seat = gdk_display_get_default_seat(gtk_widget_get_display(menu));
+  gdk_event_set_device(event, gdk_seat_get_keyboard(seat));
+  gtk_widget_event(menu, event);
+  gdk_event_free(event);
+}
+
+// Types each query into a shown searchable menu of `range(0)` top-level items
+// & erases it again, a keystroke at a time. Each keystroke is timed until GTK
+// has shown or hidden the matching items & laid out the menu again, which
+// must fit within a frame.
+void BM_TypeInMenu(benchmark::State& state) {
+  MenuShape shape(state.range(0), 1, 8);
+  g_autoptr(FlValue) items = make_items(shape);
+  auto menu = build_menu(items, &kCallbacks, nullptr, nullptr);
+  set_menu_search(*menu, true);
+  GtkWidget* window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+  gtk_window_set_default_size(GTK_WINDOW(window), 800, 600);
+  gtk_widget_show(window);
+  GdkRectangle rectangle = {100, 100, 1, 1};
+  gtk_menu_popup_at_rect(GTK_MENU(menu->widget), gtk_widget_get_window(window),
+                         &rectangle, GDK_GRAVITY_NORTH_WEST,
+                         GDK_GRAVITY_NORTH_WEST, nullptr);
+  gint64 deadline = g_get_monotonic_time() + 30 * G_USEC_PER_SEC;
+  while (!gtk_widget_get_mapped(menu->widget) &&
+         g_get_monotonic_time() < deadline) {
+    gtk_main_iteration_do(FALSE);
+  }
+  while (gtk_events_pending()) gtk_main_iteration();
+  if (!gtk_widget_get_mapped(menu->widget)) {
+    state.SkipWithError("Menu was not mapped, is a display available?");
+  }
+  int64_t keystrokes = 0;
+  auto slowest = std::chrono::nanoseconds(0);
+  auto type = [&](guint keyval) {
+    auto start = std::chrono::steady_clock::now();
+    press_key(menu->widget, keyval);
+    while (gtk_events_pending()) gtk_main_iteration();
+    slowest = std::max<std::chrono::nanoseconds>(
+        slowest, std::chrono::steady_clock::now() - start);
+    keystrokes++;
+  };
+  for (auto _ : state) {
+    if (!gtk_widget_get_mapped(menu->widget)) break;
+    for (const char* query : kQueries) {
+      for (const char* c = query; *c != '\0'; c++) {
+        type(gdk_unicode_to_keyval(static_cast<guint32>(*c)));
+      }
+      for (const char* c = query; *c != '\0'; c++) type(GDK_KEY_BackSpace);
+    }
+  }
+  gtk_menu_popdown(GTK_MENU(menu->widget));
+  menu.reset();
+  gtk_widget_destroy(window);
+  while (gtk_events_pending()) gtk_main_iteration();
+  if (keystrokes == 0) return;
+  state.counters["keystrokes"] =
+      benchmark::Counter(static_cast<double>(keystrokes),
+                         benchmark::Counter::kIsRate);
+  state.counters["slowest_keystroke_us"] =
+      std::chrono::duration<double, std::micro>(slowest).count();
+  if (slowest > kFrameBudget) {
+    state.SkipWithError("A keystroke took longer than a frame.");
+  }
+}
+
+// Width 1 to 10k, depth 1 to 8 & short to long titles, & 100k items over 64
+// levels.
+void MenuShapes(benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"width", "depth", "title"});
+  for (int64_t width : {1, 10, 100, 1000, 10000}) {
+    for (int64_t depth : {1, 2, 4, 8}) {
+      for (int64_t title_length : {8, 64, 512}) {
+        benchmark->Args({width, depth, title_length});
+      }
+    }
+  }
+  benchmark->Args({1563, 64, 8});
+  benchmark->Unit(benchmark::kMicrosecond);
+}
+
+// 100 to 50k items over 4 levels, to compare the size & decoding time of both
+// encodings, reported by the `bytes` counter.
+void NodeCounts(benchmark::internal::Benchmark* benchmark) {
+  for (int64_t item_count : {100, 1000, 10000, 50000}) {
+    benchmark->Args({item_count / 4, 4, 16});
+  }
+}
+
+BENCHMARK(BM_DecodeItems)->Apply(MenuShapes)->Apply(NodeCounts);
+BENCHMARK(BM_ReadItems)->Apply(MenuShapes)->Apply(NodeCounts);
+BENCHMARK(BM_ReadPackedItems)->Apply(MenuShapes)->Apply(NodeCounts);
+BENCHMARK(BM_BuildMenu)->Apply(MenuShapes);
+BENCHMARK(BM_BuildMenuPooled)->Apply(MenuShapes);
+BENCHMARK(BM_BuildPackedMenu)->Apply(MenuShapes)->Apply(NodeCounts);
+BENCHMARK(BM_PopupMenu)->Apply(MenuShapes);
+BENCHMARK(BM_DestroyMenu)->Apply(MenuShapes);
+// Menus of 10 to 10k items, as the build benchmarks.
+BENCHMARK(BM_PatchMenu)
+    ->ArgName("width")
+    ->RangeMultiplier(10)
+    ->Range(10, 10000)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_RebuildMenu)
+    ->ArgName("width")
+    ->RangeMultiplier(10)
+    ->Range(10, 10000)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_TypeInMenu)
+    ->ArgName("width")
+    ->Arg(1000)
+    ->Arg(50000)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  gtk_init(&argc, &argv);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
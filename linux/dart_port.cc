@@ -0,0 +1,80 @@
+#include "dart_port.h"
+
+#include <deque>
+#include <vector>
+
+#include "dart_api_dl.h"
+#include "include/native_context_menu/native_context_menu_plugin.h"
+
+// The objects of a message, kept alive until it is posted, after which Dart
+// has copied them.
+class DartMessage {
+ public:
+  // Adds `value` & its children to the message & returns its object.
+  Dart_CObject* add(FlValue* value) {
+    Dart_CObject* object = &objects_.emplace_back();
+    object->type = Dart_CObject_kNull;
+    switch (fl_value_get_type(value)) {
+      case FL_VALUE_TYPE_BOOL:
+        object->type = Dart_CObject_kBool;
+        object->value.as_bool = fl_value_get_bool(value);
+        break;
+      case FL_VALUE_TYPE_INT:
+        object->type = Dart_CObject_kInt64;
+        object->value.as_int64 = fl_value_get_int(value);
+        break;
+      case FL_VALUE_TYPE_FLOAT:
+        object->type = Dart_CObject_kDouble;
+        object->value.as_double = fl_value_get_float(value);
+        break;
+      case FL_VALUE_TYPE_STRING:
+        object->type = Dart_CObject_kString;
+        // Not `const` in older versions of the Dart SDK, never written to.
+        object->value.as_string = const_cast<char*>(fl_value_get_string(value));
+        break;
+      case FL_VALUE_TYPE_LIST: {
+        std::vector<Dart_CObject*>& values = arrays_.emplace_back();
+        for (size_t i = 0; i < fl_value_get_length(value); i++) {
+          values.push_back(add(fl_value_get_list_value(value, i)));
+        }
+        set_array(object, values);
+        break;
+      }
+      case FL_VALUE_TYPE_MAP: {
+        std::vector<Dart_CObject*>& values = arrays_.emplace_back();
+        for (size_t i = 0; i < fl_value_get_length(value); i++) {
+          values.push_back(add(fl_value_get_map_key(value, i)));
+          values.push_back(add(fl_value_get_map_value(value, i)));
+        }
+        set_array(object, values);
+        break;
+      }
+      default:
+        break;
+    }
+    return object;
+  }
+
+ private:
+  static void set_array(Dart_CObject* object,
+                        std::vector<Dart_CObject*>& values) {
+    object->type = Dart_CObject_kArray;
+    object->value.as_array.length = static_cast<intptr_t>(values.size());
+    object->value.as_array.values = values.data();
+  }
+
+  // Deques, so that objects & arrays do not move as more are added.
+  std::deque<Dart_CObject> objects_;
+  std::deque<std::vector<Dart_CObject*>> arrays_;
+};
+
+bool post_to_dart_port(int64_t port, FlValue* message) {
+  // Set by `Dart_InitializeApiDL`, once Dart has initialized the API.
+  if (Dart_PostCObject_DL == nullptr || port == 0) return false;
+  DartMessage objects;
+  return Dart_PostCObject_DL(port, objects.add(message));
+}
+
+intptr_t native_context_menu_initialize_dart_api(void* data) {
+  return Dart_InitializeApiDL(data);
+}
@@ -0,0 +1,16 @@
+#ifndef NATIVE_CONTEXT_MENU_DART_PORT_H_
+#define NATIVE_CONTEXT_MENU_DART_PORT_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+
+// Posts `message` to the Dart native port `port` with `Dart_PostCObject_DL`,
+// which is delivered to its `ReceivePort` without going through the platform
+// channel. Maps are posted as lists of their keys & values in turn, other
+// values as the matching Dart object. Can be called from any thread. Returns
+// `false` if Dart has not initialized the API yet, see
+// `native_context_menu_initialize_dart_api`, or if the port is closed.
+bool post_to_dart_port(int64_t port, FlValue* message);
+
+#endif  // NATIVE_CONTEXT_MENU_DART_PORT_H_
@@ -0,0 +1,149 @@
+#include "icon_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "menu.h"
+
+// An icon decoded by a `GTask`, which owns it as its task data.
+struct IconDecode {
+  IconKey key;
+  MenuIcon icon;
+};
+
+// Scales an icon being loaded down to fit within `data` pixels, keeping its
+// aspect ratio, before its pixels are decoded.
+static void on_icon_size_prepared(GdkPixbufLoader* loader, gint width,
+                                  gint height, gpointer data) {
+  gint size = GPOINTER_TO_INT(data);
+  if (width <= size && height <= size) return;
+  double scale = static_cast<double>(size) / std::max(width, height);
+  gdk_pixbuf_loader_set_size(loader,
+                             std::max(static_cast<gint>(width * scale), 1),
+                             std::max(static_cast<gint>(height * scale), 1));
+}
+
+// Decodes the icon of a `GTask` on a worker thread.
+static void decode_icon(GTask* task, gpointer source, gpointer data,
+                        GCancellable* cancellable) {
+  auto decode = static_cast<IconDecode*>(data);
+  gint size = decode->key.size;
+  g_autoptr(GError) error = nullptr;
+  GdkPixbuf* pixbuf = nullptr;
+  if (decode->icon.is_path) {
+    pixbuf = gdk_pixbuf_new_from_file_at_size(decode->icon.source.c_str(),
+                                              size, size, &error);
+  } else {
+    g_autoptr(GdkPixbufLoader) loader = gdk_pixbuf_loader_new();
+    g_signal_connect(loader, "size-prepared",
+                     G_CALLBACK(on_icon_size_prepared), GINT_TO_POINTER(size));
+    auto bytes = reinterpret_cast<const guchar*>(decode->icon.source.data());
+    if (gdk_pixbuf_loader_write(loader, bytes, decode->icon.source.size(),
+                                &error) &&
+        gdk_pixbuf_loader_close(loader, &error)) {
+      pixbuf = gdk_pixbuf_loader_get_pixbuf(loader);
+      if (pixbuf != nullptr) g_object_ref(pixbuf);
+    } else {
+      // A loader must be closed before it is finalized, even after an error.
+      gdk_pixbuf_loader_close(loader, nullptr);
+    }
+  }
+  if (pixbuf == nullptr) {
+    g_task_return_new_error(task, GDK_PIXBUF_ERROR,
+                            GDK_PIXBUF_ERROR_CORRUPT_IMAGE, "%s",
+                            error != nullptr ? error->message
+                                             : "Icon could not be decoded.");
+    return;
+  }
+  g_task_return_pointer(task, pixbuf, g_object_unref);
+}
+
+// Shows an icon decoded by a `GTask` on the items waiting for it & keeps it in
+// the cache `data`.
+static void on_icon_decoded(GObject* source, GAsyncResult* result,
+                            gpointer data) {
+  GTask* task = G_TASK(result);
+  // The cache is destroyed once its decodes are cancelled.
+  if (g_cancellable_is_cancelled(g_task_get_cancellable(task))) return;
+  auto cache = static_cast<IconCache*>(data);
+  IconKey key = static_cast<IconDecode*>(g_task_get_task_data(task))->key;
+  auto pixbuf =
+      static_cast<GdkPixbuf*>(g_task_propagate_pointer(task, nullptr));
+  auto it = cache->pending.find(key);
+  if (it != cache->pending.end()) {
+    std::vector<IconCache::Waiter> waiters = std::move(it->second);
+    cache->pending.erase(it);
+    if (pixbuf != nullptr) {
+      for (auto& waiter : waiters) {
+        set_menu_item_icon(*waiter.menu, waiter.node, waiter.id, key.hash,
+                           pixbuf);
+      }
+    }
+  }
+  cache->insert(key, pixbuf);
+}
+
+IconCache::~IconCache() {
+  g_cancellable_cancel(cancellable);
+  g_object_unref(cancellable);
+  for (auto& entry : entries) g_clear_object(&entry.pixbuf);
+}
+
+bool IconCache::lookup(const IconKey& key, GdkPixbuf** pixbuf) {
+  auto it = index.find(key);
+  if (it == index.end()) return false;
+  hits++;
+  entries.splice(entries.begin(), entries, it->second);
+  *pixbuf = it->second->pixbuf;
+  return true;
+}
+
+void IconCache::request(const IconKey& key, const MenuIcon& icon,
+                        Waiter waiter) {
+  auto it = pending.find(key);
+  if (it != pending.end()) {
+    it->second.push_back(waiter);
+    return;
+  }
+  misses++;
+  pending[key].push_back(waiter);
+  GTask* task = g_task_new(nullptr, cancellable, on_icon_decoded, this);
+  g_task_set_task_data(task, new IconDecode{key, icon}, [](gpointer data) {
+    delete static_cast<IconDecode*>(data);
+  });
+  g_task_run_in_thread(task, decode_icon);
+  g_object_unref(task);
+}
+
+void IconCache::cancel(const Menu* menu) {
+  // Decodes are not stopped, other menus may show the same icons.
+  for (auto& entry : pending) {
+    auto& waiters = entry.second;
+    waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                                 [menu](const Waiter& waiter) {
+                                   return waiter.menu == menu;
+                                 }),
+                  waiters.end());
+  }
+}
+
+void IconCache::insert(const IconKey& key, GdkPixbuf* pixbuf) {
+  size_t entry_size =
+      kIconEntrySize +
+      (pixbuf != nullptr ? gdk_pixbuf_get_byte_length(pixbuf) : 0);
+  entries.push_front({key, pixbuf, entry_size});
+  index[key] = entries.begin();
+  size += entry_size;
+  set_budget(budget);
+}
+
+void IconCache::set_budget(size_t value) {
+  budget = value;
+  while (size > budget) {
+    Entry& entry = entries.back();
+    size -= entry.size;
+    index.erase(entry.key);
+    g_clear_object(&entry.pixbuf);
+    entries.pop_back();
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef NATIVE_CONTEXT_MENU_ICON_CACHE_H_
+#define NATIVE_CONTEXT_MENU_ICON_CACHE_H_
+
+#include <gtk/gtk.h>
+
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "menu_model.h"
+
+struct Menu;
+
+// Default number of bytes of decoded icons kept by the `IconCache`.
+constexpr static size_t kDefaultIconCacheBudget = 8 << 20;
+// Approximate bytes taken by a cached icon besides its pixels: its entry, its
+// index node & the `GdkPixbuf` object.
+constexpr static size_t kIconEntrySize = 256;
+// Width & height of the icons shown on menu items, in pixels.
+constexpr static int32_t kMenuIconSize = 16;
+
+// Identifies a decoded icon: the `MenuIcon::hash` of its source & the size it
+// is scaled to, so that the same image shown at another size is decoded again.
+struct IconKey {
+  uint64_t hash;
+  int32_t size;
+
+  bool operator==(const IconKey& other) const {
+    return hash == other.hash && size == other.size;
+  }
+};
+
+struct IconKeyHash {
+  size_t operator()(const IconKey& key) const {
+    return static_cast<size_t>(key.hash ^
+                               (static_cast<uint64_t>(key.size) << 48));
+  }
+};
+
+// Keeps the icons of menu items decoded into `GdkPixbuf`s, so that showing a
+// menu again never decodes its icons again. Icons are decoded on worker
+// threads, the items waiting for one are updated once it is ready. The least
+// recently used icons are dropped once they take more than `budget` bytes.
+struct IconCache {
+  struct Entry {
+    IconKey key;
+    GdkPixbuf* pixbuf;
+    size_t size;
+  };
+  // An item of a shown menu waiting for its icon. `id` is checked once the
+  // icon is ready, in case the node was removed by a patch meanwhile.
+  struct Waiter {
+    Menu* menu;
+    NodeIndex node;
+    int32_t id;
+  };
+
+  // Decoded icons, most recently used first. Icons which failed to decode
+  // are kept without a `pixbuf`, so that they are not decoded again either.
+  std::list<Entry> entries = {};
+  std::unordered_map<IconKey, std::list<Entry>::iterator, IconKeyHash> index =
+      {};
+  // Icons being decoded, with the items waiting for them.
+  std::unordered_map<IconKey, std::vector<Waiter>, IconKeyHash> pending = {};
+  // Cancelled on destruction, so that decodes finishing later are dropped.
+  GCancellable* cancellable = g_cancellable_new();
+  size_t budget = kDefaultIconCacheBudget;
+  // Bytes of `entries`, their pixels & `kIconEntrySize` each.
+  size_t size = 0;
+  // Number of icons found in the cache & decoded because they were not.
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  IconCache() = default;
+  IconCache(const IconCache&) = delete;
+  IconCache& operator=(const IconCache&) = delete;
+  ~IconCache();
+
+  // Returns whether the icon of `key` is decoded, setting `pixbuf` to it or to
+  // `nullptr` if it failed to decode.
+  bool lookup(const IconKey& key, GdkPixbuf** pixbuf);
+
+  // Decodes `icon` at `key.size` on a worker thread, unless it is already
+  // being decoded, & shows it on `waiter` once ready.
+  void request(const IconKey& key, const MenuIcon& icon, Waiter waiter);
+
+  // Forgets the items of `menu` waiting for their icons, e.g. once it is
+  // destroyed.
+  void cancel(const Menu* menu);
+
+  // Keeps the decoded `pixbuf` of `key`, taking over the caller's reference.
+  // Failures, without a `pixbuf`, still count as `kIconEntrySize` bytes, so
+  // that they age out like decoded icons.
+  void insert(const IconKey& key, GdkPixbuf* pixbuf);
+
+  void set_budget(size_t value);
+};
+
+#endif  // NATIVE_CONTEXT_MENU_ICON_CACHE_H_
@@ -21,6 +21,24 @@ FLUTTER_PLUGIN_EXPORT GType native_context_menu_plugin_get_type();
 FLUTTER_PLUGIN_EXPORT void native_context_menu_plugin_register_with_registrar(
     FlPluginRegistrar* registrar);
 
+// Allocates a buffer of `size` bytes, which Dart fills with a packed menu
+// through `dart:ffi` & passes to `showMenu` or `registerMenu` by its address.
+// The plugin reads the menu in place, & rejects any address & size which do
+// not lie within a live buffer. Returns `NULL` if `size` is invalid.
+FLUTTER_PLUGIN_EXPORT uint8_t* native_context_menu_buffer_new(int64_t size);
+
+// Frees a buffer allocated by `native_context_menu_buffer_new`, once the call
+// it was passed to has completed.
+FLUTTER_PLUGIN_EXPORT void native_context_menu_buffer_free(uint8_t* buffer);
+
+// Initializes the dynamically linked Dart API with the
+// `NativeApi.initializeApiDLData` passed by Dart through `dart:ffi`, so that
+// outcomes of shows given a `port` are posted straight to that Dart native
+// port. Returns 0 on success, or another value if the Dart API of the running
+// VM is incompatible with the plugin.
+FLUTTER_PLUGIN_EXPORT intptr_t native_context_menu_initialize_dart_api(
+    void* data);
+
 G_END_DECLS
 
 #endif  // FLUTTER_PLUGIN_NATIVE_CONTEXT_MENU_PLUGIN_H_
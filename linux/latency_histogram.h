@@ -0,0 +1,45 @@
+#ifndef NATIVE_CONTEXT_MENU_LATENCY_HISTOGRAM_H_
+#define NATIVE_CONTEXT_MENU_LATENCY_HISTOGRAM_H_
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+
+// Durations of the most recent `kCapacity` occurrences of a phase, in
+// microseconds. Recording is constant time & never allocates, percentiles are
+// only computed when the stats are read. Valid when zero-filled.
+struct LatencyHistogram {
+  constexpr static size_t kCapacity = 1024;
+
+  std::array<int64_t, kCapacity> samples;
+  // Number of samples recorded so far, including the ones overwritten.
+  uint64_t count;
+
+  void record(int64_t duration) {
+    samples[count % kCapacity] = std::max<int64_t>(duration, 0);
+    count++;
+  }
+
+  size_t size() const {
+    return static_cast<size_t>(std::min<uint64_t>(count, kCapacity));
+  }
+
+  // Returns the given `percentiles` (0 to 100) of the recorded samples in
+  // `values`, or zeros if nothing was recorded yet.
+  template <size_t N>
+  void percentiles(const std::array<double, N>& percentiles,
+                   std::array<int64_t, N>& values) const {
+    std::array<int64_t, kCapacity> sorted = samples;
+    size_t n = size();
+    std::sort(sorted.begin(), sorted.begin() + n);
+    for (size_t i = 0; i < N; i++) {
+      // Nearest-rank percentile.
+      auto rank = static_cast<size_t>(std::ceil(percentiles[i] / 100 * n));
+      rank = std::min(std::max<size_t>(rank, 1), n);
+      values[i] = n == 0 ? 0 : sorted[rank - 1];
+    }
+  }
+};
+
+#endif  // NATIVE_CONTEXT_MENU_LATENCY_HISTOGRAM_H_
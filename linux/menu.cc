@@ -0,0 +1,822 @@
+#include "menu.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Label of the item shown in a dynamic sub-menu until Dart replies.
+constexpr static auto kDynamicItemsPlaceholder = "\u2026";
+
+#ifndef NDEBUG
+LiveObjects live_objects;
+
+void count_live_widget(GtkWidget* widget) {
+  live_objects.widgets++;
+  g_object_weak_ref(
+      G_OBJECT(widget),
+      [](gpointer data, GObject* object) { live_objects.widgets--; }, nullptr);
+}
+#else
+void count_live_widget(GtkWidget* widget) {}
+#endif
+
+Menu::~Menu() {
+#ifndef NDEBUG
+  // Nodes still allocated, i.e. not chained from `free_node`.
+  int64_t node_count = nodes.size();
+  for (NodeIndex node = free_node; node != kNoNode;
+       node = nodes[node].next_sibling) {
+    node_count--;
+  }
+  live_objects.menus--;
+  live_objects.nodes -= node_count;
+#endif
+  if (icon_cache != nullptr) icon_cache->cancel(this);
+  if (widget == nullptr) return;
+  if (pool != nullptr) {
+    // Every item is unparented before any is pooled, so that no sub-menu is
+    // destroyed along with items still inside it.
+    for (auto& node : node_widgets) {
+      if (node.widget == nullptr) continue;
+      g_object_ref(node.widget);
+      gtk_container_remove(GTK_CONTAINER(gtk_widget_get_parent(node.widget)),
+                           node.widget);
+    }
+    for (auto& node : node_widgets) {
+      if (node.widget != nullptr) pool->put(node.widget);
+    }
+  }
+  gtk_widget_destroy(widget);
+  g_object_unref(widget);
+}
+
+void Menu::node_added(NodeIndex node) {
+#ifndef NDEBUG
+  live_objects.nodes++;
+#endif
+  if (node_widgets.size() <= node) node_widgets.resize(node + 1);
+  if (nodes[node].dynamic) {
+    node_widgets[node].dynamic_items = DynamicItems::kUnloaded;
+  }
+}
+
+void Menu::node_removed(NodeIndex node) {
+#ifndef NDEBUG
+  live_objects.nodes--;
+#endif
+  node_widgets[node] = MenuNodeWidget();
+}
+
+// Key of the `Menu` set on each of its `GtkMenuShell`s.
+static GQuark menu_quark() {
+  static GQuark quark = g_quark_from_static_string("native_context_menu_menu");
+  return quark;
+}
+
+// Key of the node index plus one set on each check item, which are never
+// pooled.
+static GQuark node_quark() {
+  static GQuark quark = g_quark_from_static_string("native_context_menu_node");
+  return quark;
+}
+
+// Returns the node of the check or radio item `widget` of `menu`, or `kNoNode`
+// if it is not one.
+static NodeIndex get_check_item_node(Menu& menu, GtkWidget* widget) {
+  if (widget == nullptr) return kNoNode;
+  auto node = GPOINTER_TO_UINT(g_object_get_qdata(G_OBJECT(widget),
+                                                  node_quark())) - 1;
+  if (node >= menu.nodes.size() || menu.node_widgets[node].widget != widget) {
+    return kNoNode;
+  }
+  return node;
+}
+
+// Called when a check or radio item is clicked. In a menu shown with
+// `keep_open`, toggles it in place instead of letting the menu activate it &
+// close.
+static gboolean on_check_item_released(GtkWidget* widget,
+                                       GdkEventButton* event, gpointer data) {
+  Menu* menu = get_menu_item_menu(widget);
+  if (menu == nullptr || !menu->keep_open) return FALSE;
+  NodeIndex node = get_check_item_node(*menu, widget);
+  if (node == kNoNode) return FALSE;
+  toggle_menu_item(*menu, node);
+  return TRUE;
+}
+
+// Called when a key is pressed in any `GtkMenuShell` of `data`. In a menu
+// shown with `keep_open`, Return & Space toggle the selected check or radio
+// item in place. Space is left to a search query being typed.
+static gboolean on_menu_shell_key_pressed(GtkWidget* widget,
+                                          GdkEventKey* event, gpointer data) {
+  Menu& menu = *static_cast<Menu*>(data);
+  if (!menu.keep_open) return FALSE;
+  switch (event->keyval) {
+    case GDK_KEY_Return:
+    case GDK_KEY_ISO_Enter:
+    case GDK_KEY_KP_Enter:
+      break;
+    case GDK_KEY_space:
+    case GDK_KEY_KP_Space:
+      if (menu.search != nullptr && !menu.search->query.empty()) return FALSE;
+      break;
+    default:
+      return FALSE;
+  }
+  NodeIndex node = get_check_item_node(
+      menu, gtk_menu_shell_get_selected_item(GTK_MENU_SHELL(widget)));
+  if (node == kNoNode) return FALSE;
+  toggle_menu_item(menu, node);
+  return TRUE;
+}
+
+Menu* get_menu_item_menu(GtkWidget* menu_item) {
+  GtkWidget* shell = gtk_widget_get_parent(menu_item);
+  if (shell == nullptr) return nullptr;
+  return static_cast<Menu*>(g_object_get_qdata(G_OBJECT(shell), menu_quark()));
+}
+
+// Returns the `GtkMenuShell` holding the widgets of the sub-items of `parent`.
+// A sub-menu is created for `parent` if it does not have one yet.
+static GtkMenuShell* get_menu_shell(Menu& menu, NodeIndex parent) {
+  if (parent == kRootNode) return GTK_MENU_SHELL(menu.widget);
+  GtkMenuItem* parent_item = GTK_MENU_ITEM(menu.node_widgets[parent].widget);
+  GtkWidget* sub_menu = gtk_menu_item_get_submenu(parent_item);
+  if (sub_menu == nullptr) {
+    sub_menu = gtk_menu_new();
+    count_live_widget(sub_menu);
+    g_object_set_qdata(G_OBJECT(sub_menu), menu_quark(), &menu);
+    g_signal_connect(G_OBJECT(sub_menu), "key-press-event",
+                     G_CALLBACK(on_menu_shell_key_pressed), &menu);
+    gtk_menu_item_set_submenu(parent_item, sub_menu);
+  }
+  return GTK_MENU_SHELL(sub_menu);
+}
+
+// Inserts the `GtkMenuItem` of a sub-item of `parent` at `position` among the
+// widgets of its sub-items, or appends it if `position` is -1. Top-level items
+// come after the search header, if any.
+static void insert_menu_item_widget(Menu& menu, NodeIndex parent,
+                                    GtkWidget* menu_item, gint position) {
+  if (position >= 0 && parent == kRootNode && menu.search != nullptr) {
+    position++;
+  }
+  gtk_menu_shell_insert(get_menu_shell(menu, parent), menu_item, position);
+}
+
+// Shows an insensitive placeholder in the sub-menu of `node` until its dynamic
+// sub-items are received.
+static void add_dynamic_items_placeholder(Menu& menu, NodeIndex node) {
+  GtkWidget* placeholder =
+      gtk_menu_item_new_with_label(kDynamicItemsPlaceholder);
+  count_live_widget(placeholder);
+  gtk_widget_set_sensitive(placeholder, FALSE);
+  gtk_menu_shell_append(get_menu_shell(menu, node), placeholder);
+  gtk_widget_show(placeholder);
+}
+
+// Creates a `GtkMenuItem` showing the icon of `node` before its title. The
+// icon is left empty until it is decoded, keeping its room so that the title
+// does not move once it is shown.
+static GtkWidget* create_icon_menu_item(Menu& menu, NodeIndex node) {
+  GtkWidget* menu_item = gtk_menu_item_new();
+  count_live_widget(menu_item);
+  GtkWidget* box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+  GtkWidget* image = gtk_image_new();
+  gtk_widget_set_size_request(image, kMenuIconSize, kMenuIconSize);
+  GtkWidget* label = gtk_label_new(menu.title(node));
+  gtk_label_set_xalign(GTK_LABEL(label), 0);
+  gtk_box_pack_start(GTK_BOX(box), image, FALSE, FALSE, 0);
+  gtk_box_pack_start(GTK_BOX(box), label, TRUE, TRUE, 0);
+  gtk_container_add(GTK_CONTAINER(menu_item), box);
+  gtk_widget_show_all(box);
+  menu.node_widgets[node].image = image;
+  const MenuIcon& icon = menu.icons[menu.nodes[node].icon];
+  IconKey key = {icon.hash, kMenuIconSize};
+  GdkPixbuf* pixbuf = nullptr;
+  if (!menu.icon_cache->lookup(key, &pixbuf)) {
+    menu.icon_cache->request(key, icon, {&menu, node, menu.nodes[node].id});
+  } else if (pixbuf != nullptr) {
+    gtk_image_set_from_pixbuf(GTK_IMAGE(image), pixbuf);
+  }
+  return menu_item;
+}
+
+void set_menu_item_icon(Menu& menu, NodeIndex node, int32_t id,
+                        uint64_t icon_hash, GdkPixbuf* pixbuf) {
+  if (node >= menu.nodes.size() || menu.nodes[node].id != id ||
+      menu.nodes[node].icon == kNoIcon ||
+      menu.icons[menu.nodes[node].icon].hash != icon_hash ||
+      menu.node_widgets[node].image == nullptr) {
+    return;
+  }
+  gtk_image_set_from_pixbuf(GTK_IMAGE(menu.node_widgets[node].image), pixbuf);
+}
+
+// Creates a `GtkCheckMenuItem` showing the state of the check or radio item
+// `node`. Radio items are drawn as such, their groups are kept by the model
+// rather than by `GtkRadioMenuItem`, so that the state lives in one place.
+static GtkWidget* create_check_menu_item(Menu& menu, NodeIndex node) {
+  GtkWidget* menu_item = gtk_check_menu_item_new_with_label(menu.title(node));
+  count_live_widget(menu_item);
+  gtk_check_menu_item_set_draw_as_radio(
+      GTK_CHECK_MENU_ITEM(menu_item),
+      menu.nodes[node].type == MenuItemType::kRadio);
+  gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(menu_item),
+                                 menu.nodes[node].checked);
+  g_object_set_qdata(G_OBJECT(menu_item), node_quark(),
+                     GUINT_TO_POINTER(node + 1));
+  g_signal_connect(G_OBJECT(menu_item), "button-release-event",
+                   G_CALLBACK(on_check_item_released), nullptr);
+  return menu_item;
+}
+
+void toggle_menu_item(Menu& menu, NodeIndex node) {
+  if (menu.nodes[node].type == MenuItemType::kNormal) return;
+  std::vector<NodeIndex> changed;
+  menu.toggle(node, changed);
+  for (NodeIndex toggled : changed) {
+    auto toggle = std::find_if(
+        menu.toggles.begin(), menu.toggles.end(),
+        [toggled](const MenuToggle& toggle) { return toggle.node == toggled; });
+    if (toggle == menu.toggles.end()) {
+      menu.toggles.push_back({toggled, menu.nodes[toggled].id,
+                              !menu.nodes[toggled].checked});
+    }
+  }
+  // `node` is synced even if unchanged, as activating a checked radio item
+  // unchecks its widget.
+  changed.push_back(node);
+  for (NodeIndex toggled : changed) {
+    GtkWidget* widget = menu.node_widgets[toggled].widget;
+    if (widget == nullptr) continue;
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(widget),
+                                   menu.nodes[toggled].checked);
+  }
+}
+
+FlValue* take_menu_toggles(Menu& menu) {
+  FlValue* toggles = nullptr;
+  for (const MenuToggle& toggle : menu.toggles) {
+    // Skips items removed since & items toggled back.
+    if (toggle.node >= menu.nodes.size() ||
+        menu.nodes[toggle.node].id != toggle.id ||
+        menu.nodes[toggle.node].checked == toggle.was_checked) {
+      continue;
+    }
+    if (toggles == nullptr) toggles = fl_value_new_list();
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "id", fl_value_new_int(toggle.id));
+    fl_value_set_string_take(value, "checked",
+                             fl_value_new_bool(!toggle.was_checked));
+    fl_value_append_take(toggles, value);
+  }
+  menu.toggles.clear();
+  return toggles;
+}
+
+void set_menu_keep_open(Menu& menu, bool keep_open) {
+  menu.keep_open = keep_open;
+  menu.toggles.clear();
+}
+
+// Shows the title of `node` on its widget.
+static void set_menu_item_title(Menu& menu, NodeIndex node) {
+  MenuNodeWidget& state = menu.node_widgets[node];
+  if (state.image == nullptr) {
+    gtk_menu_item_set_label(GTK_MENU_ITEM(state.widget), menu.title(node));
+    return;
+  }
+  // The label follows the image in the box of an item with an icon.
+  g_autoptr(GList) children = gtk_container_get_children(
+      GTK_CONTAINER(gtk_widget_get_parent(state.image)));
+  gtk_label_set_text(GTK_LABEL(g_list_last(children)->data),
+                     menu.title(node));
+}
+
+// Creates the `GtkMenuItem` showing `node` & inserts it at `position` among
+// the sub-items of its parent, or appends it if `position` is -1. The widgets
+// of its sub-items are only created once it is selected, an empty sub-menu is
+// attached until then.
+static void create_menu_item_widget(Menu& menu, NodeIndex node,
+                                    gint position) {
+  GtkWidget* menu_item;
+  if (menu.nodes[node].type != MenuItemType::kNormal) {
+    menu_item = create_check_menu_item(menu, node);
+  } else if (menu.icon_cache != nullptr && menu.nodes[node].icon != kNoIcon) {
+    menu_item = create_icon_menu_item(menu, node);
+  } else if (menu.pool != nullptr) {
+    menu_item = menu.pool->take(menu.title(node));
+  } else {
+    menu_item = gtk_menu_item_new_with_label(menu.title(node));
+    count_live_widget(menu_item);
+  }
+  MenuNodeWidget& state = menu.node_widgets[node];
+  bool pending = state.dynamic_items == DynamicItems::kUnloaded ||
+                 state.dynamic_items == DynamicItems::kLoading;
+  state.widget = menu_item;
+  state.sub_items_built = menu.nodes[node].child_count == 0 && !pending;
+  g_signal_connect(G_OBJECT(menu_item), "activate",
+                   G_CALLBACK(menu.callbacks->item_activated),
+                   GUINT_TO_POINTER(node));
+  g_signal_connect(G_OBJECT(menu_item), "select",
+                   G_CALLBACK(menu.callbacks->item_selected),
+                   GUINT_TO_POINTER(node));
+  g_signal_connect(G_OBJECT(menu_item), "deselect",
+                   G_CALLBACK(menu.callbacks->item_deselected),
+                   GUINT_TO_POINTER(node));
+  insert_menu_item_widget(menu, menu.nodes[node].parent, menu_item, position);
+  if (!state.sub_items_built) get_menu_shell(menu, node);
+  if (pending) add_dynamic_items_placeholder(menu, node);
+  gtk_widget_show(menu_item);
+}
+
+void build_sub_item_widgets(Menu& menu, NodeIndex parent) {
+  if (menu.node_widgets[parent].sub_items_built) return;
+  menu.node_widgets[parent].sub_items_built = true;
+  for (NodeIndex child = menu.nodes[parent].first_child; child != kNoNode;
+       child = menu.nodes[child].next_sibling) {
+    create_menu_item_widget(menu, child, -1);
+  }
+}
+
+// Destroys the widget of `node` along with the widgets of its sub-items, e.g.
+// once it is moved under an item whose sub-items are not built yet.
+static void drop_menu_item_widget(Menu& menu, NodeIndex node) {
+  // Destroying the `GtkMenuItem` also destroys its sub-menu.
+  gtk_widget_destroy(menu.node_widgets[node].widget);
+  std::vector<NodeIndex> stack = {node};
+  while (!stack.empty()) {
+    NodeIndex top = stack.back();
+    stack.pop_back();
+    if (menu.node_widgets[top].widget == nullptr) continue;
+    menu.node_widgets[top].widget = nullptr;
+    menu.node_widgets[top].image = nullptr;
+    menu.node_widgets[top].sub_items_built = false;
+    for (NodeIndex child = menu.nodes[top].first_child; child != kNoNode;
+         child = menu.nodes[child].next_sibling) {
+      stack.push_back(child);
+    }
+  }
+}
+
+// Reads the items passed through the standard method codec, see
+// `decode_menu`.
+struct FlValueMenuReader {
+  using Items = FlValue*;
+  using Item = FlValue*;
+
+  static size_t size(FlValue* items) {
+    return items == nullptr ? 0 : fl_value_get_length(items);
+  }
+
+  static FlValue* at(FlValue* items, size_t index) {
+    return fl_value_get_list_value(items, index);
+  }
+
+  // Walks the item map once, checking the type of every known field.
+  static const char* read(FlValue* value, DecodedMenuItem<FlValue*>& decoded) {
+    if (fl_value_get_type(value) != FL_VALUE_TYPE_MAP) {
+      return kMenuItemNotMapError;
+    }
+    bool has_id = false;
+    size_t length = fl_value_get_length(value);
+    for (size_t i = 0; i < length; i++) {
+      FlValue* key = fl_value_get_map_key(value, i);
+      if (fl_value_get_type(key) != FL_VALUE_TYPE_STRING) continue;
+      const gchar* name = fl_value_get_string(key);
+      FlValue* field = fl_value_get_map_value(value, i);
+      FlValueType type = fl_value_get_type(field);
+      switch (menu_item_field(name, strlen(name))) {
+        case MenuItemField::kId:
+          if (type != FL_VALUE_TYPE_INT) return kMenuItemIdError;
+          decoded.id = fl_value_get_int(field);
+          has_id = true;
+          break;
+        case MenuItemField::kTitle:
+          if (type != FL_VALUE_TYPE_STRING) return kMenuItemTitleError;
+          decoded.title = fl_value_get_string(field);
+          decoded.title_length = strlen(decoded.title);
+          break;
+        case MenuItemField::kItems:
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_LIST) return kMenuItemItemsError;
+          decoded.items = field;
+          break;
+        case MenuItemField::kDynamic:
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_BOOL) return kMenuItemDynamicError;
+          decoded.dynamic = fl_value_get_bool(field);
+          break;
+        case MenuItemField::kIcon:
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_UINT8_LIST) return kMenuItemIconError;
+          decoded.icon =
+              reinterpret_cast<const char*>(fl_value_get_uint8_list(field));
+          decoded.icon_length = fl_value_get_length(field);
+          decoded.icon_is_path = false;
+          break;
+        case MenuItemField::kIconPath:
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_STRING) return kMenuItemIconPathError;
+          decoded.icon = fl_value_get_string(field);
+          decoded.icon_length = strlen(decoded.icon);
+          decoded.icon_is_path = true;
+          break;
+        case MenuItemField::kType: {
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_STRING) return kMenuItemTypeError;
+          const gchar* item_type = fl_value_get_string(field);
+          if (!menu_item_type(item_type, strlen(item_type), &decoded.type)) {
+            return kMenuItemTypeError;
+          }
+          break;
+        }
+        case MenuItemField::kChecked:
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_BOOL) return kMenuItemCheckedError;
+          decoded.checked = fl_value_get_bool(field);
+          break;
+        case MenuItemField::kUnknown:
+          break;
+      }
+    }
+    if (!has_id) return kMenuItemIdError;
+    if (decoded.title == nullptr) return kMenuItemTitleError;
+    return nullptr;
+  }
+
+  using Patch = FlValue*;
+
+  // Walks the patch map once, as `read`.
+  static const char* read_patch(FlValue* value,
+                                DecodedMenuPatch<FlValue*>& decoded) {
+    if (fl_value_get_type(value) != FL_VALUE_TYPE_MAP) {
+      return kMenuPatchNotMapError;
+    }
+    size_t length = fl_value_get_length(value);
+    for (size_t i = 0; i < length; i++) {
+      FlValue* key = fl_value_get_map_key(value, i);
+      if (fl_value_get_type(key) != FL_VALUE_TYPE_STRING) continue;
+      const gchar* name = fl_value_get_string(key);
+      FlValue* field = fl_value_get_map_value(value, i);
+      FlValueType type = fl_value_get_type(field);
+      switch (menu_patch_field(name, strlen(name))) {
+        case MenuPatchField::kOp:
+          if (type != FL_VALUE_TYPE_STRING) return kMenuPatchOpError;
+          decoded.op = menu_patch_op(fl_value_get_string(field),
+                                     strlen(fl_value_get_string(field)));
+          break;
+        case MenuPatchField::kId:
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_INT) return kMenuPatchIdError;
+          decoded.id = fl_value_get_int(field);
+          decoded.has_id = true;
+          break;
+        case MenuPatchField::kParent:
+          if (type == FL_VALUE_TYPE_NULL) break;
+          if (type != FL_VALUE_TYPE_INT) return kMenuPatchParentError;
+          decoded.parent = fl_value_get_int(field);
+          decoded.has_parent = true;
+          break;
+        case MenuPatchField::kIndex:
+          if (type != FL_VALUE_TYPE_INT) break;
+          decoded.index = fl_value_get_int(field);
+          break;
+        case MenuPatchField::kTitle:
+          if (type != FL_VALUE_TYPE_STRING) break;
+          decoded.title = fl_value_get_string(field);
+          decoded.title_length = strlen(decoded.title);
+          break;
+        case MenuPatchField::kItem:
+          decoded.item = field;
+          decoded.has_item = true;
+          break;
+        case MenuPatchField::kUnknown:
+          break;
+      }
+    }
+    return nullptr;
+  }
+};
+
+bool add_dynamic_items(Menu& menu, NodeIndex node, FlValue* items,
+                       MenuDecodeError* error) {
+  menu.node_widgets[node].dynamic_items = DynamicItems::kLoaded;
+  bool valid = true;
+  if (items != nullptr && fl_value_get_type(items) != FL_VALUE_TYPE_LIST) {
+    if (error != nullptr) *error = {kMenuItemsNotListError, -1};
+    valid = false;
+  } else if (items != nullptr) {
+    for (size_t i = 0; i < fl_value_get_length(items) && valid; i++) {
+      valid = decode_menu_item<FlValueMenuReader>(
+                  fl_value_get_list_value(items, i), node, kNoNode, menu,
+                  error) != kNoNode;
+    }
+  }
+  if (menu.node_widgets[node].widget == nullptr) return valid;
+  GtkMenuItem* menu_item = GTK_MENU_ITEM(menu.node_widgets[node].widget);
+  g_autoptr(GList) placeholders = gtk_container_get_children(
+      GTK_CONTAINER(gtk_menu_item_get_submenu(menu_item)));
+  for (GList* it = placeholders; it != nullptr; it = it->next) {
+    gtk_widget_destroy(GTK_WIDGET(it->data));
+  }
+  if (menu.nodes[node].child_count == 0) {
+    gtk_menu_item_set_submenu(menu_item, nullptr);
+  } else if (menu.node_widgets[node].sub_items_built) {
+    for (NodeIndex child = menu.nodes[node].first_child; child != kNoNode;
+         child = menu.nodes[child].next_sibling) {
+      create_menu_item_widget(menu, child, -1);
+    }
+  }
+  return valid;
+}
+
+// Creates the top-level `GtkMenu` of `menu` along with the widgets of the
+// top-level items.
+static void create_menu_widget(Menu& menu) {
+  menu.widget = GTK_WIDGET(g_object_ref_sink(gtk_menu_new()));
+  count_live_widget(menu.widget);
+  g_object_set_qdata(G_OBJECT(menu.widget), menu_quark(), &menu);
+  g_signal_connect(G_OBJECT(menu.widget), "deactivate",
+                   G_CALLBACK(menu.callbacks->menu_deactivated),
+                   menu.callbacks->data);
+  g_signal_connect(G_OBJECT(menu.widget), "selection-done",
+                   G_CALLBACK(menu.callbacks->menu_selection_done),
+                   menu.callbacks->data);
+  g_signal_connect(G_OBJECT(menu.widget), "key-press-event",
+                   G_CALLBACK(on_menu_shell_key_pressed), &menu);
+  build_sub_item_widgets(menu, kRootNode);
+}
+
+// Creates the widgets of `menu` once its nodes are read, which took since
+// `start`, recording both phases in `times`.
+static void finish_menu(Menu& menu, gint64 start, MenuBuildTimes* times) {
+  gint64 decoded = g_get_monotonic_time();
+  create_menu_widget(menu);
+  if (times != nullptr) {
+    times->decode = decoded - start;
+    times->build = g_get_monotonic_time() - decoded;
+  }
+}
+
+bool read_menu_items(FlValue* items, MenuModel& model,
+                     MenuDecodeError* error) {
+  if (items == nullptr || fl_value_get_type(items) != FL_VALUE_TYPE_LIST) {
+    if (error != nullptr) *error = {kMenuItemsNotListError, -1};
+    return false;
+  }
+  return decode_menu<FlValueMenuReader>(items, model, error);
+}
+
+FlValue* menu_items_to_value(const MenuModel& model, NodeIndex parent) {
+  FlValue* items = fl_value_new_list();
+  for (NodeIndex node = model.nodes[parent].first_child; node != kNoNode;
+       node = model.nodes[node].next_sibling) {
+    const MenuNode& item = model.nodes[node];
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "id", fl_value_new_int(item.id));
+    fl_value_set_string_take(value, "title",
+                             fl_value_new_string(model.title(node)));
+    if (item.dynamic) {
+      fl_value_set_string_take(value, "dynamic", fl_value_new_bool(true));
+    } else if (item.child_count > 0) {
+      fl_value_set_string_take(value, "items",
+                               menu_items_to_value(model, node));
+    }
+    if (item.type != MenuItemType::kNormal) {
+      fl_value_set_string_take(
+          value, "type",
+          fl_value_new_string(item.type == MenuItemType::kCheck ? "check"
+                                                                : "radio"));
+      fl_value_set_string_take(value, "checked",
+                               fl_value_new_bool(item.checked));
+    }
+    if (item.icon != kNoIcon) {
+      const MenuIcon& icon = model.icons[item.icon];
+      fl_value_set_string_take(
+          value, icon.is_path ? "iconPath" : "icon",
+          icon.is_path ? fl_value_new_string(icon.source.c_str())
+                       : fl_value_new_uint8_list(
+                             reinterpret_cast<const uint8_t*>(
+                                 icon.source.data()),
+                             icon.source.size()));
+    }
+    fl_value_append_take(items, value);
+  }
+  return items;
+}
+
+std::unique_ptr<Menu> build_menu(FlValue* items,
+                                 const MenuCallbacks* callbacks,
+                                 WidgetPool* pool, IconCache* icon_cache,
+                                 MenuBuildTimes* times,
+                                 MenuDecodeError* error) {
+  gint64 start = g_get_monotonic_time();
+  auto menu = std::make_unique<Menu>(callbacks, pool, icon_cache);
+  if (!read_menu_items(items, *menu, error)) return nullptr;
+  finish_menu(*menu, start, times);
+  return menu;
+}
+
+std::unique_ptr<Menu> build_packed_menu(const uint8_t* data, size_t size,
+                                        const MenuCallbacks* callbacks,
+                                        WidgetPool* pool,
+                                        MenuBuildTimes* times) {
+  gint64 start = g_get_monotonic_time();
+  auto menu = std::make_unique<Menu>(callbacks, pool, nullptr);
+  if (!read_packed_menu(data, size, *menu)) return nullptr;
+  finish_menu(*menu, start, times);
+  return menu;
+}
+
+// Removes the sub-menu of `parent` once it has no sub-items left.
+static void trim_menu_shell(Menu& menu, NodeIndex parent) {
+  if (parent == kRootNode || menu.nodes[parent].child_count > 0) return;
+  MenuNodeWidget& state = menu.node_widgets[parent];
+  state.sub_items_built = state.widget != nullptr;
+  if (state.widget != nullptr) {
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(state.widget), nullptr);
+  }
+}
+
+const char* apply_menu_patch(Menu& menu, FlValue* value) {
+  if (menu.search != nullptr) menu.search->stale = true;
+  MenuPatch<FlValue*> patch;
+  const char* error = decode_menu_patch<FlValueMenuReader>(value, menu, patch);
+  if (error != nullptr) return error;
+  NodeIndex node = patch.node;
+  NodeIndex parent = patch.parent;
+  switch (patch.op) {
+    case MenuPatchOp::kInsert:
+      error = apply_menu_model_patch<FlValueMenuReader>(menu, patch);
+      if (error != nullptr) return error;
+      // Items under a parent whose sub-items are not built yet get their
+      // widget once it is selected.
+      if (menu.node_widgets[parent].sub_items_built) {
+        create_menu_item_widget(menu, patch.node,
+                                static_cast<gint>(patch.position));
+      } else if (menu.node_widgets[parent].widget != nullptr) {
+        get_menu_shell(menu, parent);
+      }
+      break;
+    case MenuPatchOp::kRemove:
+      if (menu.node_widgets[node].widget != nullptr) {
+        drop_menu_item_widget(menu, node);
+      }
+      apply_menu_model_patch<FlValueMenuReader>(menu, patch);
+      trim_menu_shell(menu, patch.old_parent);
+      break;
+    case MenuPatchOp::kSetTitle:
+      apply_menu_model_patch<FlValueMenuReader>(menu, patch);
+      if (menu.node_widgets[node].widget != nullptr) {
+        set_menu_item_title(menu, node);
+      }
+      break;
+    case MenuPatchOp::kMove: {
+      // The widget is kept if the new parent has its sub-items built, dropped
+      // otherwise & created when the item is shown again.
+      GtkWidget* widget = menu.node_widgets[node].widget;
+      if (widget != nullptr && menu.node_widgets[parent].sub_items_built) {
+        g_object_ref(widget);
+        gtk_container_remove(GTK_CONTAINER(gtk_widget_get_parent(widget)),
+                             widget);
+      } else if (widget != nullptr) {
+        drop_menu_item_widget(menu, node);
+        widget = nullptr;
+      }
+      apply_menu_model_patch<FlValueMenuReader>(menu, patch);
+      trim_menu_shell(menu, patch.old_parent);
+      auto position = static_cast<gint>(patch.position);
+      if (widget != nullptr) {
+        insert_menu_item_widget(menu, parent, widget, position);
+        g_object_unref(widget);
+      } else if (menu.node_widgets[parent].sub_items_built) {
+        create_menu_item_widget(menu, node, position);
+      } else if (menu.node_widgets[parent].widget != nullptr) {
+        get_menu_shell(menu, parent);
+      }
+      break;
+    }
+    case MenuPatchOp::kUnknown:
+      return kMenuPatchOpError;
+  }
+  return nullptr;
+}
+
+void reset_dynamic_items(Menu& menu) {
+  for (NodeIndex node : menu.requested_nodes) {
+    // The node may have been removed, or its slot reused, by a patch.
+    if (node >= menu.nodes.size() ||
+        (menu.node_widgets[node].dynamic_items != DynamicItems::kLoading &&
+         menu.node_widgets[node].dynamic_items != DynamicItems::kLoaded)) {
+      continue;
+    }
+    while (menu.nodes[node].first_child != kNoNode) {
+      NodeIndex child = menu.nodes[node].first_child;
+      if (menu.node_widgets[child].widget != nullptr) {
+        drop_menu_item_widget(menu, child);
+      }
+      menu.remove(child);
+    }
+    // The placeholder of a node still loading is in place already.
+    bool loaded =
+        menu.node_widgets[node].dynamic_items == DynamicItems::kLoaded;
+    menu.node_widgets[node].dynamic_items = DynamicItems::kUnloaded;
+    menu.node_widgets[node].sub_items_built = false;
+    if (loaded && menu.node_widgets[node].widget != nullptr) {
+      add_dynamic_items_placeholder(menu, node);
+    }
+  }
+  menu.requested_nodes.clear();
+}
+
+// Shows the top-level items of `menu` whose title starts with `query` & the
+// query itself in the header. Only the items entering or leaving the matching
+// range of the index are shown or hidden.
+static void filter_menu(Menu& menu, std::string query) {
+  MenuSearch& search = *menu.search;
+  auto set_visible = [&](NodeIndex node, bool visible) {
+    GtkWidget* widget = menu.node_widgets[node].widget;
+    if (widget != nullptr) gtk_widget_set_visible(widget, visible);
+  };
+  if (search.stale) {
+    search.index.build(menu, kRootNode);
+    search.range = search.index.all();
+    search.stale = false;
+    for (NodeIndex child = menu.nodes[kRootNode].first_child; child != kNoNode;
+         child = menu.nodes[child].next_sibling) {
+      set_visible(child, true);
+    }
+  }
+  std::string key;
+  fold_menu_title(query.data(), query.size(), key);
+  MenuSearchIndex::Range range = search.index.find(key.data(), key.size());
+  search.index.diff(search.range, range, set_visible);
+  search.range = range;
+  search.query = std::move(query);
+  gtk_menu_item_set_label(GTK_MENU_ITEM(search.header), search.query.c_str());
+  gtk_widget_set_visible(search.header, !search.query.empty());
+  if (!search.query.empty() && range.begin < range.end) {
+    GtkWidget* first = menu.node_widgets[search.index.entries[range.begin].node]
+                           .widget;
+    if (first != nullptr) {
+      gtk_menu_shell_select_item(GTK_MENU_SHELL(menu.widget), first);
+    }
+  }
+}
+
+// Updates the search query of the menu `data` from a key press on its
+// top-level `GtkMenu`. Keys which do not edit the query, e.g. arrows & Enter,
+// are left to the menu.
+static gboolean on_menu_key_pressed(GtkWidget* widget, GdkEventKey* event,
+                                    gpointer data) {
+  Menu& menu = *static_cast<Menu*>(data);
+  if (!menu.search->enabled) return FALSE;
+  std::string query = menu.search->query;
+  if (event->keyval == GDK_KEY_BackSpace) {
+    if (query.empty()) return FALSE;
+    const gchar* end = query.c_str() + query.size();
+    query.resize(g_utf8_find_prev_char(query.c_str(), end) - query.c_str());
+  } else if (event->keyval == GDK_KEY_Escape) {
+    // Escape clears the query first & closes the menu once it is empty.
+    if (query.empty()) return FALSE;
+    query.clear();
+  } else {
+    gunichar character = gdk_keyval_to_unicode(event->keyval);
+    // Space activates the selected item unless a query is being typed.
+    if (character == 0 || g_unichar_iscntrl(character) ||
+        (event->state & (GDK_CONTROL_MASK | GDK_MOD1_MASK)) != 0 ||
+        (character == ' ' && query.empty())) {
+      return FALSE;
+    }
+    gchar utf8[6];
+    query.append(utf8, g_unichar_to_utf8(character, utf8));
+  }
+  filter_menu(menu, std::move(query));
+  return TRUE;
+}
+
+void refresh_menu_search(Menu& menu) {
+  if (menu.search == nullptr || menu.search->query.empty()) return;
+  filter_menu(menu, menu.search->query);
+}
+
+void set_menu_search(Menu& menu, bool enabled) {
+  if (menu.search == nullptr) {
+    if (!enabled) return;
+    menu.search = std::make_unique<MenuSearch>();
+    menu.search->header = gtk_menu_item_new_with_label("");
+    count_live_widget(menu.search->header);
+    gtk_widget_set_sensitive(menu.search->header, FALSE);
+    gtk_menu_shell_prepend(GTK_MENU_SHELL(menu.widget), menu.search->header);
+    g_signal_connect(G_OBJECT(menu.widget), "key-press-event",
+                     G_CALLBACK(on_menu_key_pressed), &menu);
+  }
+  menu.search->enabled = enabled;
+  // The index is built while the menu pops up rather than on the first
+  // keystroke, which must fit within a frame.
+  if ((enabled && menu.search->stale) || !menu.search->query.empty()) {
+    filter_menu(menu, std::string());
+  }
+}
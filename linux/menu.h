@@ -0,0 +1,298 @@
+#ifndef NATIVE_CONTEXT_MENU_MENU_H_
+#define NATIVE_CONTEXT_MENU_MENU_H_
+
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "icon_cache.h"
+#include "menu_decoder.h"
+#include "menu_model.h"
+#include "menu_patch.h"
+#include "menu_search.h"
+#include "packed_menu.h"
+
+// Menus, widgets & nodes currently alive in the process, counted in debug
+// builds only & reported by `getStats`, so that a menu which is never released
+// shows up as a growing count.
+struct LiveObjects {
+  int64_t menus = 0;
+  // `GtkMenu`s & `GtkMenuItem`s of the menus, including pooled ones.
+  int64_t widgets = 0;
+  int64_t nodes = 0;
+};
+
+#ifndef NDEBUG
+extern LiveObjects live_objects;
+#endif
+
+// Counts `widget` in `live_objects` until it is finalized, in debug builds.
+void count_live_widget(GtkWidget* widget);
+
+// Default number of `GtkMenuItem`s kept by the `WidgetPool`.
+constexpr static size_t kDefaultWidgetPoolSize = 256;
+
+// Keeps the `GtkMenuItem`s of destroyed menus, so that later menus can reuse
+// them by changing their label instead of creating, realizing & styling new
+// widgets. Holds at most `limit` widgets, the rest are destroyed.
+struct WidgetPool {
+  std::vector<GtkWidget*> widgets = {};
+  size_t limit = kDefaultWidgetPoolSize;
+  // Number of widgets taken from the pool & created because it was empty.
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  WidgetPool() = default;
+  WidgetPool(const WidgetPool&) = delete;
+  WidgetPool& operator=(const WidgetPool&) = delete;
+  ~WidgetPool() { set_limit(0); }
+
+  // Returns a floating `GtkMenuItem` showing `label`.
+  GtkWidget* take(const char* label) {
+    if (widgets.empty()) {
+      misses++;
+      GtkWidget* widget = gtk_menu_item_new_with_label(label);
+      count_live_widget(widget);
+      return widget;
+    }
+    hits++;
+    GtkWidget* widget = widgets.back();
+    widgets.pop_back();
+    gtk_menu_item_set_label(GTK_MENU_ITEM(widget), label);
+    // Handing back the pool's reference as a floating one, like a new widget.
+    g_object_force_floating(G_OBJECT(widget));
+    return widget;
+  }
+
+  // Resets & keeps an unparented `widget`, taking over the caller's reference.
+  // Check items & items showing an icon next to their label are not kept.
+  void put(GtkWidget* widget) {
+    if (widgets.size() >= limit ||
+        G_OBJECT_TYPE(widget) != GTK_TYPE_MENU_ITEM ||
+        !GTK_IS_LABEL(gtk_bin_get_child(GTK_BIN(widget)))) {
+      gtk_widget_destroy(widget);
+      g_object_unref(widget);
+      return;
+    }
+    for (auto signal : {"activate", "select", "deselect"}) {
+      g_signal_handlers_disconnect_matched(
+          widget, G_SIGNAL_MATCH_ID,
+          g_signal_lookup(signal, GTK_TYPE_MENU_ITEM), 0, nullptr, nullptr,
+          nullptr);
+    }
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(widget), nullptr);
+    gtk_widget_unset_state_flags(widget, GTK_STATE_FLAG_PRELIGHT);
+    widgets.push_back(widget);
+  }
+
+  void set_limit(size_t value) {
+    limit = value;
+    while (widgets.size() > limit) {
+      GtkWidget* widget = widgets.back();
+      widgets.pop_back();
+      gtk_widget_destroy(widget);
+      g_object_unref(widget);
+    }
+  }
+};
+
+// Handlers connected to the widgets of every `Menu`, implemented by the plugin.
+// Each plugin instance has its own callbacks, so that the handlers reach the
+// instance which built the menu through `data`.
+struct MenuCallbacks {
+  // Connected to "activate", "select" & "deselect" of every `GtkMenuItem`,
+  // `data` is the index of its node. The menu is found with
+  // `get_menu_item_menu`.
+  void (*item_activated)(GtkWidget* widget, gpointer data);
+  void (*item_selected)(GtkWidget* widget, gpointer data);
+  void (*item_deselected)(GtkWidget* widget, gpointer data);
+  // Connected to "deactivate" & "selection-done" of the top-level `GtkMenu`,
+  // with `data` below.
+  void (*menu_deactivated)(GtkWidget* widget, gpointer data);
+  void (*menu_selection_done)(GtkWidget* widget, gpointer data);
+  gpointer data;
+};
+
+// State of the sub-items of an item marked `dynamic`, which are requested from
+// Dart when it is opened & kept until the menu is shown again.
+enum class DynamicItems : uint8_t { kNone, kUnloaded, kLoading, kLoaded };
+
+// State of the widget showing a menu item, kept by its `Menu` alongside the
+// node of the item.
+struct MenuNodeWidget {
+  // The `GtkMenuItem` showing this node, `nullptr` until its parent is opened.
+  GtkWidget* widget = nullptr;
+  // Whether the widgets of the sub-items are created. Sub-menus are built the
+  // first time they are opened rather than before the menu pops up.
+  bool sub_items_built = false;
+  DynamicItems dynamic_items = DynamicItems::kNone;
+  // The `GtkImage` inside `widget` if the node has an icon, which is empty
+  // until the icon is decoded.
+  GtkWidget* image = nullptr;
+};
+
+// Type-to-filter state of a `Menu` shown with search enabled. Typed characters
+// hide the top-level items whose title does not start with them.
+struct MenuSearch {
+  // Index over the titles of the top-level items, rebuilt once `stale`.
+  MenuSearchIndex index = {};
+  bool stale = true;
+  // Entries of `index` currently shown.
+  MenuSearchIndex::Range range = {};
+  // Typed text, shown by the insensitive `header` item at the top.
+  std::string query = {};
+  GtkWidget* header = nullptr;
+  // Whether typing filters the items, set each time the menu is shown.
+  bool enabled = false;
+};
+
+// A check or radio item toggled while its menu is shown, see
+// `take_menu_toggles`.
+struct MenuToggle {
+  NodeIndex node;
+  int32_t id;
+  // The state of the item when the menu was shown.
+  bool was_checked;
+};
+
+// A built `GtkMenu` along with its items, whose model is shared with the other
+// platforms. The widget state of each node is stored at the same index in
+// `node_widgets`.
+struct Menu : MenuModel {
+  GtkWidget* widget = nullptr;
+  const MenuCallbacks* callbacks = nullptr;
+  // Pool providing the item widgets, which they are returned to once the menu
+  // is destroyed. `nullptr` if the widgets are not pooled.
+  WidgetPool* pool = nullptr;
+  // Cache providing the decoded icons of the items, `nullptr` if icons are
+  // not shown.
+  IconCache* icon_cache = nullptr;
+  std::vector<MenuNodeWidget> node_widgets = {};
+  // Nodes whose dynamic sub-items were requested while the menu was shown.
+  std::vector<NodeIndex> requested_nodes = {};
+  // Created the first time the menu is shown with search enabled.
+  std::unique_ptr<MenuSearch> search = nullptr;
+  // Whether clicking a check or radio item toggles it without closing the
+  // menu, set each time the menu is shown.
+  bool keep_open = false;
+  // Items toggled since the menu was shown, each listed once.
+  std::vector<MenuToggle> toggles = {};
+
+  Menu(const MenuCallbacks* callbacks, WidgetPool* pool,
+       IconCache* icon_cache)
+      : callbacks(callbacks), pool(pool), icon_cache(icon_cache) {
+    node_widgets.emplace_back();
+    node_widgets[kRootNode].sub_items_built = true;
+#ifndef NDEBUG
+    live_objects.menus++;
+    live_objects.nodes++;
+#endif
+  }
+  Menu(const Menu&) = delete;
+  Menu& operator=(const Menu&) = delete;
+  ~Menu() override;
+
+ protected:
+  void node_added(NodeIndex node) override;
+  void node_removed(NodeIndex node) override;
+};
+
+// Time spent building a menu, in microseconds.
+struct MenuBuildTimes {
+  // Reading the items into the node table, including validation.
+  int64_t decode = 0;
+  // Creating the `GtkMenu` & the widgets of the top-level items.
+  int64_t build = 0;
+};
+
+// Returns the `Menu` showing `menu_item`, or `nullptr` if it is not the widget
+// of a menu item, e.g. from the signal handlers of `MenuCallbacks`.
+Menu* get_menu_item_menu(GtkWidget* menu_item);
+
+// Creates the widgets of the sub-items of `parent`, if not created yet. Called
+// when `parent` is selected, sub-menus are not built before they are opened.
+void build_sub_item_widgets(Menu& menu, NodeIndex parent);
+
+// Adds the dynamic sub-items received for `node`, replacing its placeholder.
+// `items` is the reply to `onItemsRequested`, or `nullptr` if it failed.
+// Returns `false` & fills `error` if passed if an item is malformed or its id
+// cannot be added, in which case only the items before it are added.
+bool add_dynamic_items(Menu& menu, NodeIndex node, FlValue* items,
+                       MenuDecodeError* error = nullptr);
+
+// Shows the decoded icon `pixbuf` of hash `icon_hash` on the item `id` at
+// `node`, unless the item was removed, its widget destroyed or its icon
+// changed since the icon was requested, e.g. by a patch reusing the slot.
+void set_menu_item_icon(Menu& menu, NodeIndex node, int32_t id,
+                        uint64_t icon_hash, GdkPixbuf* pixbuf);
+
+// Drops the dynamic sub-items requested while `menu` was last shown, so that
+// they are requested again once opened.
+void reset_dynamic_items(Menu& menu);
+
+// Reads the `items` list of a method call into the empty `model`. Each item
+// map is walked once & every field is type checked. Returns `false` & fills
+// `error` if passed if the items are malformed.
+bool read_menu_items(FlValue* items, MenuModel& model,
+                     MenuDecodeError* error = nullptr);
+
+// Returns the sub-items of `parent` in `model` as an `items` list read back by
+// `read_menu_items`, e.g. to record a menu built before a trace was opened.
+// The sub-items of `dynamic` items are left out, as they are requested again.
+FlValue* menu_items_to_value(const MenuModel& model,
+                             NodeIndex parent = kRootNode);
+
+// Builds a `GtkMenu` from the `items` list of a method call, see
+// `read_menu_items`. Only the widgets of the top-level items are created,
+// taken from `pool`. Icons are shown as they are decoded by `icon_cache`, if
+// passed. Returns `nullptr` & fills `error` if passed if any item is invalid.
+// Timings are stored in `times`, if passed.
+std::unique_ptr<Menu> build_menu(FlValue* items,
+                                 const MenuCallbacks* callbacks,
+                                 WidgetPool* pool, IconCache* icon_cache,
+                                 MenuBuildTimes* times = nullptr,
+                                 MenuDecodeError* error = nullptr);
+
+// Builds a `GtkMenu` from a menu in the packed binary format. Nodes are read
+// in place, no intermediate `FlValue`s are created. Only the widgets of the
+// top-level items are created, taken from `pool`. The packed format has no
+// icons. Returns `nullptr` if the payload is malformed. Timings are stored in
+// `times`, if passed.
+std::unique_ptr<Menu> build_packed_menu(const uint8_t* data, size_t size,
+                                        const MenuCallbacks* callbacks,
+                                        WidgetPool* pool,
+                                        MenuBuildTimes* times = nullptr);
+
+// Toggles the check or radio item at `node` as if it was clicked, in the model
+// & on the widgets of the items whose state changed. The changes are kept for
+// `take_menu_toggles`.
+void toggle_menu_item(Menu& menu, NodeIndex node);
+
+// Returns the `{id, checked}` of the items whose state differs from when
+// `menu` was shown, or `nullptr` if there are none, & forgets the toggles.
+FlValue* take_menu_toggles(Menu& menu);
+
+// Sets whether clicking a check or radio item keeps `menu` open the next time
+// it is shown, & forgets the toggles of the previous time.
+void set_menu_keep_open(Menu& menu, bool keep_open);
+
+// Enables or disables type-to-filter search for the next time `menu` is shown,
+// clearing the previous query. The index over the titles is built when search
+// is first enabled & after the items are patched.
+void set_menu_search(Menu& menu, bool enabled);
+
+// Applies a single `updateMenu` patch to `menu`, see `decode_menu_patch`, &
+// syncs the widgets of the patched items only. Returns an error message if the
+// patch is invalid.
+const char* apply_menu_patch(Menu& menu, FlValue* value);
+
+// Filters the top-level items of `menu` again with the query being typed, if
+// any, once patches are applied, so that inserted & renamed items are shown
+// or hidden as the query matches them.
+void refresh_menu_search(Menu& menu);
+
+#endif  // NATIVE_CONTEXT_MENU_MENU_H_
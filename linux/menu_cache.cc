@@ -0,0 +1,100 @@
+#include "menu_cache.h"
+
+#include <algorithm>
+#include <utility>
+
+// Approximate bytes taken by a realized `GtkMenuItem` & its label.
+constexpr static size_t kMenuItemWidgetSize = 2048;
+
+uint64_t get_menu_cache_check(const MenuModel& model) {
+  uint64_t item_count = 0;
+  uint32_t title_length = 0;
+  // Nodes freed by patches have no id, the root has none either.
+  for (const auto& node : model.nodes) {
+    if (node.id < 0) continue;
+    item_count++;
+    title_length += node.title_length;
+  }
+  return item_count << 32 | title_length;
+}
+
+void MenuCache::measure(Entry& entry) {
+  const Menu& menu = *entry.menu;
+  size_t widget_count = 0;
+  for (const auto& node_widget : menu.node_widgets) {
+    if (node_widget.widget != nullptr) widget_count++;
+  }
+  size_t menu_size =
+      sizeof(Menu) + menu.nodes.capacity() * sizeof(MenuNode) +
+      menu.node_widgets.capacity() * sizeof(MenuNodeWidget) +
+      menu.node_by_id.capacity() * sizeof(NodeIndex) +
+      menu.titles.capacity() + widget_count * kMenuItemWidgetSize;
+  size = size - entry.size + menu_size;
+  widgets = widgets - entry.widgets + widget_count;
+  entry.size = menu_size;
+  entry.widgets = widget_count;
+}
+
+Menu* MenuCache::lookup(uint64_t hash) {
+  auto it = index.find(hash);
+  if (it == index.end()) {
+    misses++;
+    return nullptr;
+  }
+  hits++;
+  entries.splice(entries.begin(), entries, it->second);
+  measure(entries.front());
+  Menu* cached = entries.front().menu.get();
+  trim(cached);
+  return cached;
+}
+
+Menu* MenuCache::insert(uint64_t hash, std::unique_ptr<Menu> menu) {
+  auto it = index.find(hash);
+  if (it != index.end()) {
+    size -= it->second->size;
+    widgets -= it->second->widgets;
+    entries.erase(it->second);
+  }
+  if (pressure > 0 &&
+      g_get_monotonic_time() - pressure_time >= kMenuCachePressureTimeout) {
+    pressure = 0;
+  } else if (pressure > 0) {
+    pressure--;
+  }
+  uint64_t check = get_menu_cache_check(*menu);
+  entries.push_front({hash, check, std::move(menu), 0, 0});
+  index[hash] = entries.begin();
+  measure(entries.front());
+  Menu* cached = entries.front().menu.get();
+  trim(cached);
+  return cached;
+}
+
+void MenuCache::set_budget(size_t bytes, size_t widget_count,
+                           const Menu* pinned) {
+  budget = bytes;
+  widget_budget = widget_count;
+  pressure = 0;
+  trim(pinned);
+}
+
+void MenuCache::add_pressure(uint32_t levels, const Menu* pinned) {
+  pressure = std::min<uint32_t>(pressure + levels, 64);
+  pressure_time = g_get_monotonic_time();
+  trim(pinned);
+}
+
+void MenuCache::trim(const Menu* pinned) {
+  size_t bytes = pressure < 64 ? budget >> pressure : 0;
+  size_t widget_count = pressure < 64 ? widget_budget >> pressure : 0;
+  auto it = entries.end();
+  while (it != entries.begin() && (size > bytes || widgets > widget_count)) {
+    --it;
+    if (it->menu.get() == pinned) continue;
+    size -= it->size;
+    widgets -= it->widgets;
+    index.erase(it->hash);
+    it = entries.erase(it);
+  }
+}
@@ -0,0 +1,98 @@
+#ifndef NATIVE_CONTEXT_MENU_MENU_CACHE_H_
+#define NATIVE_CONTEXT_MENU_MENU_CACHE_H_
+
+#include <gtk/gtk.h>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+#include "menu.h"
+
+// Default number of bytes & of item widgets of the menus kept by the
+// `MenuCache`.
+constexpr static size_t kDefaultMenuCacheBudget = 4 << 20;
+constexpr static size_t kDefaultMenuCacheWidgetBudget = 1024;
+// Time without low memory warnings after which the budgets are restored.
+constexpr static gint64 kMenuCachePressureTimeout = 30 * G_USEC_PER_SEC;
+
+// Returns the check value kept with a menu built from `model`: its item count
+// in the upper 32 bits & the bytes of their titles in the lower ones, as
+// computed by Dart along with the hash of the items.
+uint64_t get_menu_cache_check(const MenuModel& model);
+
+// Keeps built menus by the structural hash of their items computed by Dart,
+// so that showing a menu identical to an earlier one, e.g. from every row of
+// a list, neither sends nor builds its items again. The least recently used
+// menus are destroyed once the cached ones take more than `budget` bytes or
+// `widget_budget` item widgets. Both budgets are scaled down by low memory
+// warnings, & recover a level per inserted menu & fully once warnings stop.
+struct MenuCache {
+  struct Entry {
+    uint64_t hash;
+    // See `get_menu_cache_check`.
+    uint64_t check;
+    std::unique_ptr<Menu> menu;
+    // Size & widgets of `menu` when it was last measured. Sub-menus are built
+    // while a menu is shown, so both are measured again once it is used.
+    size_t size;
+    size_t widgets;
+  };
+
+  // Cached menus, most recently used first.
+  std::list<Entry> entries = {};
+  std::unordered_map<uint64_t, std::list<Entry>::iterator> index = {};
+  size_t budget = kDefaultMenuCacheBudget;
+  size_t widget_budget = kDefaultMenuCacheWidgetBudget;
+  // Number of halvings of both budgets asked by low memory warnings since the
+  // budgets were set, up to 64 which evicts every menu, & when the last
+  // warning was received.
+  uint32_t pressure = 0;
+  gint64 pressure_time = 0;
+  // Totals of `entries`.
+  size_t size = 0;
+  size_t widgets = 0;
+  // Number of shows found in the cache & whose items had to be sent.
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+
+  MenuCache() = default;
+  MenuCache(const MenuCache&) = delete;
+  MenuCache& operator=(const MenuCache&) = delete;
+
+  // Returns whether a menu is cached for `hash` whose check value is `check`,
+  // without using it. A menu of another shape whose hash collides is left
+  // out by the check.
+  bool contains(uint64_t hash, uint64_t check) const {
+    auto it = index.find(hash);
+    return it != index.end() && it->second->check == check;
+  }
+
+  // Returns the menu cached for `hash`, or `nullptr` if there is none, &
+  // evicts older menus over the budgets once it is measured again.
+  Menu* lookup(uint64_t hash);
+
+  // Keeps `menu` for `hash`, replacing the menu cached for it if any, & evicts
+  // older menus over the budgets. `menu` is about to be shown, so it is kept
+  // even over the budgets. Relieves the pressure by a level, or entirely if
+  // no warning was received for `kMenuCachePressureTimeout`. Returns the
+  // cached menu.
+  Menu* insert(uint64_t hash, std::unique_ptr<Menu> menu);
+
+  // Sets both budgets & resets the pressure, evicting menus over them except
+  // `pinned`.
+  void set_budget(size_t bytes, size_t widget_count, const Menu* pinned);
+
+  // Halves the budgets `levels` times more, evicting menus over them except
+  // `pinned`.
+  void add_pressure(uint32_t levels, const Menu* pinned);
+
+ private:
+  // Measures the menu of `entry` again & updates the totals.
+  void measure(Entry& entry);
+  // Evicts the least recently used menus until the totals fit the budgets.
+  void trim(const Menu* pinned);
+};
+
+#endif  // NATIVE_CONTEXT_MENU_MENU_CACHE_H_
@@ -0,0 +1,137 @@
+#include "menu_trace.h"
+
+#include <cstring>
+#include <vector>
+
+// Returns `arguments` as recorded: the `buffer_size` bytes of the packed menu
+// `buffer`, if any, are copied as `bufferData` in place of its address & the
+// Dart native `port` is dropped. Returns a new reference.
+static FlValue* get_recorded_arguments(FlValue* arguments,
+                                       const uint8_t* buffer,
+                                       size_t buffer_size) {
+  if (arguments == nullptr ||
+      fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
+    return arguments != nullptr ? fl_value_ref(arguments)
+                                : fl_value_new_null();
+  }
+  FlValue* recorded = fl_value_new_map();
+  for (size_t i = 0; i < fl_value_get_length(arguments); i++) {
+    FlValue* key = fl_value_get_map_key(arguments, i);
+    if (fl_value_get_type(key) == FL_VALUE_TYPE_STRING &&
+        (strcmp(fl_value_get_string(key), "buffer") == 0 ||
+         strcmp(fl_value_get_string(key), "bufferSize") == 0 ||
+         strcmp(fl_value_get_string(key), "port") == 0)) {
+      continue;
+    }
+    fl_value_set(recorded, key, fl_value_get_map_value(arguments, i));
+  }
+  if (buffer != nullptr) {
+    fl_value_set_string_take(recorded, "bufferData",
+                             fl_value_new_uint8_list(buffer, buffer_size));
+  }
+  return recorded;
+}
+
+bool MenuTraceWriter::open(const char* path) {
+  close();
+  file = fopen(path, "wb");
+  if (file == nullptr) return false;
+  start = g_get_monotonic_time();
+  menu_hashes.clear();
+  uint32_t version = GUINT32_TO_LE(kMenuTraceVersion);
+  fwrite(kMenuTraceMagic, sizeof(kMenuTraceMagic), 1, file);
+  fwrite(&version, sizeof(version), 1, file);
+  return true;
+}
+
+void MenuTraceWriter::close() {
+  if (file == nullptr) return;
+  fclose(file);
+  file = nullptr;
+}
+
+void MenuTraceWriter::write_call(const gchar* method, FlValue* arguments,
+                                 const uint8_t* buffer, size_t buffer_size,
+                                 FlMethodResponse* response, gint64 time,
+                                 gint64 duration) {
+  if (file == nullptr || strcmp(method, "configure") == 0 ||
+      strcmp(method, "getStats") == 0) {
+    return;
+  }
+  FlValue* result = FL_IS_METHOD_SUCCESS_RESPONSE(response)
+                        ? fl_method_success_response_get_result(
+                              FL_METHOD_SUCCESS_RESPONSE(response))
+                        : nullptr;
+  g_autoptr(FlValue) record = fl_value_new_list();
+  fl_value_append_take(record, fl_value_new_int(kMenuTraceCall));
+  fl_value_append_take(record, fl_value_new_int(time - start));
+  fl_value_append_take(record, fl_value_new_int(duration));
+  fl_value_append_take(record, fl_value_new_string(method));
+  fl_value_append_take(record,
+                       get_recorded_arguments(arguments, buffer, buffer_size));
+  fl_value_append_take(record, result != nullptr ? fl_value_ref(result)
+                                                 : fl_value_new_null());
+  write(record);
+}
+
+void MenuTraceWriter::write_outcome(FlValue* outcome, gint64 time) {
+  if (file == nullptr) return;
+  g_autoptr(FlValue) record = fl_value_new_list();
+  fl_value_append_take(record, fl_value_new_int(kMenuTraceOutcome));
+  fl_value_append_take(record, fl_value_new_int(time - start));
+  fl_value_append(record, outcome);
+  write(record);
+}
+
+void MenuTraceWriter::write(FlValue* record) {
+  g_autoptr(FlStandardMessageCodec) codec = fl_standard_message_codec_new();
+  g_autoptr(GBytes) bytes = fl_message_codec_encode_message(
+      FL_MESSAGE_CODEC(codec), record, nullptr);
+  if (bytes == nullptr) return;
+  gsize size = 0;
+  gconstpointer data = g_bytes_get_data(bytes, &size);
+  uint32_t record_size = GUINT32_TO_LE(static_cast<uint32_t>(size));
+  fwrite(&record_size, sizeof(record_size), 1, file);
+  fwrite(data, size, 1, file);
+}
+
+MenuTraceReader::~MenuTraceReader() {
+  if (file != nullptr) fclose(file);
+}
+
+bool MenuTraceReader::open(const char* path) {
+  file = fopen(path, "rb");
+  if (file == nullptr) return false;
+  char magic[sizeof(kMenuTraceMagic)];
+  uint32_t version = 0;
+  return fread(magic, sizeof(magic), 1, file) == 1 &&
+         memcmp(magic, kMenuTraceMagic, sizeof(magic)) == 0 &&
+         fread(&version, sizeof(version), 1, file) == 1 &&
+         GUINT32_FROM_LE(version) == kMenuTraceVersion;
+}
+
+FlValue* MenuTraceReader::read() {
+  uint32_t size = 0;
+  if (file == nullptr || fread(&size, sizeof(size), 1, file) != 1) {
+    return nullptr;
+  }
+  std::vector<uint8_t> data(GUINT32_FROM_LE(size));
+  if (!data.empty() && fread(data.data(), data.size(), 1, file) != 1) {
+    return nullptr;
+  }
+  g_autoptr(FlStandardMessageCodec) codec = fl_standard_message_codec_new();
+  g_autoptr(GBytes) bytes = g_bytes_new(data.data(), data.size());
+  FlValue* record = fl_message_codec_decode_message(FL_MESSAGE_CODEC(codec),
+                                                    bytes, nullptr);
+  if (record == nullptr) return nullptr;
+  if (fl_value_get_type(record) != FL_VALUE_TYPE_LIST ||
+      fl_value_get_length(record) < 3 ||
+      fl_value_get_type(fl_value_get_list_value(record, 0)) !=
+          FL_VALUE_TYPE_INT ||
+      fl_value_get_type(fl_value_get_list_value(record, 1)) !=
+          FL_VALUE_TYPE_INT) {
+    fl_value_unref(record);
+    return nullptr;
+  }
+  return record;
+}
@@ -0,0 +1,98 @@
+#ifndef NATIVE_CONTEXT_MENU_MENU_TRACE_H_
+#define NATIVE_CONTEXT_MENU_MENU_TRACE_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_set>
+
+// Trace of the method calls handled by a plugin instance & of the outcomes of
+// its menus, written by `MenuTraceWriter` & replayed by the
+// `native_context_menu_replay` tool.
+//
+// The file starts with `kMenuTraceMagic` & `kMenuTraceVersion`, followed by
+// records. Each record is a little-endian 32-bit size & a list encoded by the
+// standard message codec, whose first element is its type:
+//
+//   [kMenuTraceCall, time, duration, method, arguments, result]
+//   [kMenuTraceOutcome, time, outcome]
+//
+// `time` is in microseconds since the trace was opened & `duration` is how
+// long the call was handled for. `result` is the result of the call, or
+// `null` if it failed. `outcome` is the map reported to Dart.
+constexpr static char kMenuTraceMagic[4] = {'N', 'C', 'M', 'T'};
+constexpr static uint32_t kMenuTraceVersion = 1;
+constexpr static int64_t kMenuTraceCall = 0;
+constexpr static int64_t kMenuTraceOutcome = 1;
+
+// Records written by a plugin instance while a trace file is set with the
+// `traceFile` option. Packed menus passed by the address of a native buffer
+// are recorded as their bytes, `bufferData`, as are menus registered on the
+// packed channel, recorded as `registerMenu` calls. The Dart native `port` is
+// left out, so that a trace can be replayed in another process.
+//
+// Menus built before the trace was opened are recorded too: registered menus
+// as `registerMenu` calls at its start, & cached menus along with the first
+// `showMenu` call of their `hash`, as `items`.
+struct MenuTraceWriter {
+  FILE* file = nullptr;
+  // When the trace was opened, which record times are relative to.
+  gint64 start = 0;
+  // Hashes of the cached menus whose items are in the trace.
+  std::unordered_set<int64_t> menu_hashes = {};
+
+  MenuTraceWriter() = default;
+  MenuTraceWriter(const MenuTraceWriter&) = delete;
+  MenuTraceWriter& operator=(const MenuTraceWriter&) = delete;
+  ~MenuTraceWriter() { close(); }
+
+  bool is_open() const { return file != nullptr; }
+
+  // Starts writing a trace to `path`, replacing the file & closing the
+  // previous trace. Returns `false` if the file cannot be created.
+  bool open(const char* path);
+
+  // Flushes & closes the trace, if open.
+  void close();
+
+  // Records the call of `method` with `arguments` & the `buffer_size` bytes
+  // of its packed menu `buffer`, if any, received at `time` & handled in
+  // `duration` microseconds, & its `response`. Configuration & stats calls
+  // are not recorded.
+  void write_call(const gchar* method, FlValue* arguments,
+                  const uint8_t* buffer, size_t buffer_size,
+                  FlMethodResponse* response, gint64 time, gint64 duration);
+
+  // Returns whether the items of the menu cached with `hash` are not in the
+  // trace yet, & from now on assumes they are.
+  bool add_menu_hash(int64_t hash) {
+    return menu_hashes.insert(hash).second;
+  }
+
+  // Records the `outcome` of a shown menu, reported at `time`.
+  void write_outcome(FlValue* outcome, gint64 time);
+
+ private:
+  void write(FlValue* record);
+};
+
+// Reads the records of a trace written by `MenuTraceWriter`.
+struct MenuTraceReader {
+  FILE* file = nullptr;
+
+  MenuTraceReader() = default;
+  MenuTraceReader(const MenuTraceReader&) = delete;
+  MenuTraceReader& operator=(const MenuTraceReader&) = delete;
+  ~MenuTraceReader();
+
+  // Opens the trace at `path`. Returns `false` if it cannot be read or is not
+  // a trace of this version.
+  bool open(const char* path);
+
+  // Returns the next record, whose type & time are checked, which the caller
+  // owns, or `nullptr` at the end of the trace or if the record is malformed.
+  FlValue* read();
+};
+
+#endif  // NATIVE_CONTEXT_MENU_MENU_TRACE_H_
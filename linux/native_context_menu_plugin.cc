@@ -3,14 +3,26 @@
 #include <flutter_linux/flutter_linux.h>
 #include <gtk/gtk.h>
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <new>
 #include <optional>
 #include <string>
-#include <thread>
+#include <utility>
 #include <vector>
 
+#include "dart_port.h"
+#include "latency_histogram.h"
+#include "menu.h"
+#include "menu_cache.h"
+#include "menu_trace.h"
+#include "native_context_menu_plugin_private.h"
+
 #define NATIVE_CONTEXT_MENU_PLUGIN(obj)                                     \
   (G_TYPE_CHECK_INSTANCE_CAST((obj), native_context_menu_plugin_get_type(), \
                               NativeContextMenuPlugin))
@@ -22,210 +34,1138 @@ constexpr static auto kChannelName = "native_context_menu";
 // Pass `devicePixelRatio` and `position` from Dart to show menu at specified
 // coordinates. If it is not defined, WIN32 will use `GetCursorPos` to show the
 // context menu at the cursor's position.
+// Pass `handle` instead of `items` to show a menu created by `registerMenu`.
+// Pass `buffer` & `bufferSize` instead of `items` to show a packed menu written
+// by Dart into a buffer from `native_context_menu_buffer_new`, see
+// `kPackedChannelName`. The buffer is read in place during the call.
+// Pass the structural `hash` of the items computed by Dart to show the menu
+// cached for it, without `items`, along with the `check` value of the items,
+// see `get_menu_cache_check`. If none is cached or its check value differs,
+// `cache_miss` is returned & nothing is shown, Dart then passes the `items`
+// along with the `hash`, which are built & cached for it.
+// Pass `searchable` to filter the top-level items by typing while it is shown.
+// Pass `request` to identify the show in its outcome. A menu still open when
+// another is shown is closed & reported as `superseded`.
+// Pass `keepOpen` so that clicking a check or radio item toggles it without
+// closing the menu.
+// Pass the native `port` of a Dart `SendPort` to receive the outcome there,
+// see `post_to_dart_port`, instead of through `onItemSelected` or
+// `onMenuDismissed`. The method channel is used if posting fails.
 constexpr static auto kShowMenu = "showMenu";
+// Register menu call.
+// Builds a menu from passed `items`, or from a packed `buffer` as `showMenu`,
+// & keeps it alive until `disposeMenu` is called. Returns an integer handle
+// which can be passed to `showMenu`.
+constexpr static auto kRegisterMenu = "registerMenu";
+// Dispose menu call.
+// Destroys a menu previously created by `registerMenu`.
+constexpr static auto kDisposeMenu = "disposeMenu";
+// Update menu call.
+// Applies a list of `patches` to a menu created by `registerMenu` in place.
+// Each patch has an `op` of `insert`, `remove`, `setTitle` or `move`. Patches
+// are applied in order & an error is returned for the first invalid one,
+// leaving the previous ones applied.
+constexpr static auto kUpdateMenu = "updateMenu";
+// Configure call.
+// Sets plugin options: `widgetPoolSize`, the number of menu item widgets kept
+// for reuse by later menus, `iconCacheSize`, the number of bytes of decoded
+// icons kept for later menus, & `menuCacheSize` & `menuCacheWidgets`, the
+// budgets of the menus cached by their hash. Absent options are left
+// unchanged. `traceFile` starts recording the calls & outcomes of this
+// instance to a trace file, see `menu_trace.h`, or stops if it is empty.
+constexpr static auto kConfigure = "configure";
+// Get stats call.
+// Returns the latency of each phase of recent menu shows in microseconds, as a
+// map of phase to its `count`, `p50`, `p95`, `p99` & `max`, along with the
+// `widgetPool`, `iconCache` & `menuCache` counters.
+constexpr static auto kGetStats = "getStats";
 
-// Called when an item is selected from the context menu.
-constexpr static auto kOnItemSelected = "onItemSelected";
-// Called when menu is dismissed without clicking any item.
-constexpr static auto kOnMenuDismissed = "onMenuDismissed";
-
-NativeContextMenuPlugin* g_plugin;
-
-// Represents a menu item, stores its id, title & possible sub-menu items.
-class MenuItem;
+// Binary channel name.
+// Registers a menu sent in the packed binary format described in `menu.h`.
+// Replies with the menu's handle as a little-endian 64-bit integer, or with an
+// empty message if the payload is malformed.
+constexpr static auto kPackedChannelName = "native_context_menu/packed";
 
-class MenuItem {
- public:
-  auto id_ptr() const { return &id_; }
-  int32_t id() const { return id_; }
-  std::string& title() { return title_; }
-  std::vector<std::unique_ptr<MenuItem>>& items() { return items_; }
+// Event channel name.
+// While listened to, streams the items highlighted & unhighlighted in the
+// shown menu, e.g. as the pointer moves over them. Changes are coalesced to at
+// most one event per frame: `{request, highlights}`, where `highlights` is the
+// list of `{id, highlighted}` changes since the last event, in order. An item
+// highlighted & unhighlighted within a frame is left out.
+constexpr static auto kHighlightsChannelName = "native_context_menu/highlights";
 
-  MenuItem(int32_t id, const char* title) : id_(id), title_(title) {}
+// Called when an item is selected from the context menu, with the `request` of
+// its show & the `id` of the item. Both outcomes carry the check & radio items
+// toggled while the menu was shown as `toggled`, a list of `{id, checked}`, if
+// any.
+constexpr static auto kOnItemSelected = "onItemSelected";
+// Called when menu is dismissed without clicking any item, with the `request`
+// of its show & one of the `reason`s below.
+constexpr static auto kOnMenuDismissed = "onMenuDismissed";
+constexpr static auto kDismissedReason = "dismissed";
+constexpr static auto kSupersededReason = "superseded";
+// Called when an item with `dynamic` sub-items is opened, with the item's id.
+// Dart replies with the list of its sub-items.
+constexpr static auto kOnItemsRequested = "onItemsRequested";
 
- private:
-  int32_t id_ = -1;
-  std::string title_ = "";
-  std::vector<std::unique_ptr<MenuItem>> items_ = {};
+// Latency of each phase of showing menus, reported by `getStats`.
+struct ShowStats {
+  // Reading passed items into a menu's node table.
+  LatencyHistogram decode;
+  // Creating the widgets of a menu.
+  LatencyHistogram build;
+  // The `gtk_menu_popup_at_rect` call.
+  LatencyHistogram popup;
+  // From receiving `showMenu` until the menu is first painted, for the first
+  // menu shown by the instance & for the later ones.
+  LatencyHistogram first_show;
+  LatencyHistogram first_paint;
+  // Building & realizing the hidden menu which warms up GTK, see
+  // `schedule_warm_up`.
+  LatencyHistogram warm_up;
+  // From receiving `showMenu` until an item is selected or it is dismissed.
+  LatencyHistogram outcome;
 };
 
 struct _NativeContextMenuPlugin {
   GObject parent_instance;
   FlPluginRegistrar* registrar;
   FlMethodChannel* channel;
-  // Saving `MenuItem` objects in `std::vector` so that they do not get
-  // deallocated from memory once the method call is finished (to avoid
-  // SEGFAULT).
-  // Previously created `MenuItem`s are automatically freed upon each call by
-  // calling `std::vector::clear` before each call. Thanks to smart pointers.
-  std::vector<std::unique_ptr<MenuItem>> last_menu_items = {};
-  bool last_menu_item_selected = false;
-  // A separated thread to send "deactivate" signal with `id` as -1 since it is
-  // called before "active" on any of menu items. Freed before each subsequent
-  // call.
-  std::unique_ptr<std::thread> last_menu_thread = nullptr;
+  FlBasicMessageChannel* packed_channel;
+  FlEventChannel* highlights_channel;
+  // Whether Dart listens to `highlights_channel`, nothing is collected before.
+  bool highlights_listened;
+  // The last menu shown with `items`, kept alive while it is shown. Released
+  // along with all of its widgets once its outcome is reported, or replaced
+  // by the next such menu.
+  std::unique_ptr<Menu> last_menu = nullptr;
+  // Menus created by `registerMenu`, keyed by their handle. These are built
+  // once & shown any number of times.
+  std::map<int64_t, std::unique_ptr<Menu>> menus = {};
+  int64_t next_menu_handle = 1;
+  // The menu currently popped up, whose outcome is not yet reported to Dart.
+  // Reset to `nullptr` as soon as an item is selected or the menu is
+  // dismissed, so that each `showMenu` call reports exactly once.
+  Menu* shown_menu = nullptr;
+  // The `request` passed to the `showMenu` call of `shown_menu`, echoed in its
+  // outcome so that Dart completes the right show.
+  int64_t shown_request = 0;
+  // The Dart native `port` passed to the `showMenu` call of `shown_menu`, which
+  // its outcome is posted to, or 0 to report it through the method channel.
+  int64_t shown_port = 0;
+  // Item widgets of destroyed menus, reused by the menus built after them.
+  WidgetPool widget_pool = {};
+  // Handlers of the menus built by this instance, which pass it as their data.
+  MenuCallbacks menu_callbacks;
+  // Icons of the items of every menu, decoded once & shared by the menus.
+  IconCache icon_cache;
+  // Menus shown with a `hash`, kept to be shown again by it.
+  MenuCache menu_cache;
+  // Records the calls & outcomes while a `traceFile` is set.
+  MenuTraceWriter trace;
+  // Shrinks `menu_cache` on low memory warnings, if supported by GLib.
+  GObject* memory_monitor;
+  gulong low_memory_handler_id;
+  // Incremented each time a menu pops up, so that replies to `onItemsRequested`
+  // arriving after their menu is closed are dropped.
+  uint64_t show_count = 0;
+  // Highlight changes of `shown_menu` not yet sent to Dart, as `id` & whether
+  // it is highlighted, & the tick callback of `highlights_widget` sending them
+  // on the next frame.
+  std::vector<std::pair<int32_t, bool>> highlights = {};
+  GtkWidget* highlights_widget = nullptr;
+  guint highlights_tick_id = 0;
+  // Idle source reporting the dismissal of `shown_menu` after "deactivate", in
+  // case "selection-done" is never emitted (e.g. the grab is broken).
+  guint dismiss_source_id = 0;
+  // Idle source releasing `last_menu` once its outcome is reported, after the
+  // signal emission reporting it has returned.
+  guint release_source_id = 0;
+  // When the `showMenu` call of `shown_menu` was received.
+  gint64 show_start = 0;
+  // Frame clock of `shown_menu` & its "after-paint" handler, connected until
+  // the menu is first painted.
+  GdkFrameClock* paint_clock = nullptr;
+  gulong paint_handler_id = 0;
+  // Valid when zero-filled, not constructed in `init`.
+  ShowStats stats;
 };
 
 G_DEFINE_TYPE(NativeContextMenuPlugin, native_context_menu_plugin,
               g_object_get_type())
 
-// Called when a menu item is clicked.
+// Disconnects the "after-paint" handler of `shown_menu`, if still connected.
+static void stop_paint_timing(NativeContextMenuPlugin* self) {
+  if (self->paint_handler_id != 0) {
+    g_signal_handler_disconnect(self->paint_clock, self->paint_handler_id);
+    self->paint_handler_id = 0;
+  }
+  g_clear_object(&self->paint_clock);
+}
+
+// Called after each frame of `shown_menu` is painted, only the first one is
+// timed.
+static void on_menu_painted(GdkFrameClock* clock, gpointer data) {
+  auto self = static_cast<NativeContextMenuPlugin*>(data);
+  LatencyHistogram& histogram =
+      self->show_count == 1 ? self->stats.first_show : self->stats.first_paint;
+  histogram.record(g_get_monotonic_time() - self->show_start);
+  stop_paint_timing(self);
+}
+
+// Records the time spent building a menu.
+static void record_build_times(NativeContextMenuPlugin* self,
+                               const MenuBuildTimes& times) {
+  self->stats.decode.record(times.decode);
+  self->stats.build.record(times.build);
+}
+
+// Sends the pending highlight changes of `shown_menu` to Dart, if any, & stops
+// waiting for the next frame.
+static void flush_highlights(NativeContextMenuPlugin* self) {
+  if (self->highlights_tick_id != 0) {
+    gtk_widget_remove_tick_callback(self->highlights_widget,
+                                    self->highlights_tick_id);
+    self->highlights_tick_id = 0;
+  }
+  g_clear_object(&self->highlights_widget);
+  if (self->highlights.empty()) return;
+  g_autoptr(FlValue) highlights = fl_value_new_list();
+  for (auto [id, highlighted] : self->highlights) {
+    FlValue* highlight = fl_value_new_map();
+    fl_value_set_string_take(highlight, "id", fl_value_new_int(id));
+    fl_value_set_string_take(highlight, "highlighted",
+                             fl_value_new_bool(highlighted));
+    fl_value_append_take(highlights, highlight);
+  }
+  self->highlights.clear();
+  g_autoptr(FlValue) event = fl_value_new_map();
+  fl_value_set_string_take(event, "request",
+                           fl_value_new_int(self->shown_request));
+  fl_value_set_string(event, "highlights", highlights);
+  fl_event_channel_send(self->highlights_channel, event, nullptr, nullptr);
+}
+
+// Called on the frame after highlight changes, which are sent together.
+static gboolean on_highlights_tick(GtkWidget* widget, GdkFrameClock* clock,
+                                   gpointer data) {
+  auto self = NATIVE_CONTEXT_MENU_PLUGIN(data);
+  // Removed by GTK once this returns.
+  self->highlights_tick_id = 0;
+  flush_highlights(self);
+  return G_SOURCE_REMOVE;
+}
+
+// Collects the change of the highlighted state of the item at `node` of
+// `shown_menu`, sent to Dart on the next frame if Dart listens. A change
+// undoing the pending one of the same item cancels it.
+static void queue_highlight(NativeContextMenuPlugin* self, NodeIndex node,
+                            bool highlighted) {
+  if (!self->highlights_listened) return;
+  int32_t id = self->shown_menu->nodes[node].id;
+  auto& highlights = self->highlights;
+  auto pending =
+      std::find_if(highlights.begin(), highlights.end(),
+                   [id](const auto& change) { return change.first == id; });
+  if (pending != highlights.end() && pending->second != highlighted) {
+    highlights.erase(pending);
+  } else if (pending == highlights.end()) {
+    highlights.push_back({id, highlighted});
+  }
+  if (self->highlights_tick_id == 0) {
+    // The top-level menu is mapped as long as any of its sub-menus is.
+    self->highlights_widget =
+        GTK_WIDGET(g_object_ref(self->shown_menu->widget));
+    self->highlights_tick_id = gtk_widget_add_tick_callback(
+        self->highlights_widget, on_highlights_tick, self, nullptr);
+  }
+}
+
+// Releases `last_menu` after its outcome is reported, unless it was replaced
+// by a menu shown since.
+static gboolean release_last_menu(gpointer data) {
+  auto self = NATIVE_CONTEXT_MENU_PLUGIN(data);
+  self->release_source_id = 0;
+  if (self->last_menu.get() != self->shown_menu) self->last_menu.reset();
+  return G_SOURCE_REMOVE;
+}
+
+// Reports the outcome of `shown_menu` to Dart, unless it is already reported.
+// `node` is the selected item, or `kNoNode` if the menu was dismissed for
+// `reason`.
+static void complete_shown_menu(NativeContextMenuPlugin* self, NodeIndex node,
+                                const gchar* reason = kDismissedReason) {
+  Menu* menu = self->shown_menu;
+  if (menu == nullptr) return;
+  // Highlights of the menu arrive before its outcome.
+  flush_highlights(self);
+  self->shown_menu = nullptr;
+  if (menu == self->last_menu.get() && self->release_source_id == 0) {
+    self->release_source_id = g_idle_add(release_last_menu, self);
+  }
+  self->stats.outcome.record(g_get_monotonic_time() - self->show_start);
+  stop_paint_timing(self);
+  g_clear_handle_id(&self->dismiss_source_id, g_source_remove);
+  g_autoptr(FlValue) outcome = fl_value_new_map();
+  fl_value_set_string_take(outcome, "request",
+                           fl_value_new_int(self->shown_request));
+  if (node != kNoNode) {
+    fl_value_set_string_take(outcome, "id",
+                             fl_value_new_int(menu->nodes[node].id));
+  } else {
+    fl_value_set_string_take(outcome, "reason", fl_value_new_string(reason));
+  }
+  FlValue* toggled = take_menu_toggles(*menu);
+  if (toggled != nullptr) {
+    fl_value_set_string_take(outcome, "toggled", toggled);
+  }
+  self->trace.write_outcome(outcome, g_get_monotonic_time());
+  if (post_to_dart_port(self->shown_port, outcome)) return;
+  fl_method_channel_invoke_method(self->channel,
+                                  node != kNoNode ? kOnItemSelected
+                                                  : kOnMenuDismissed,
+                                  outcome, nullptr, nullptr, nullptr);
+}
+
+// Returns the plugin instance which built `menu`.
+static NativeContextMenuPlugin* get_menu_plugin(Menu* menu) {
+  return NATIVE_CONTEXT_MENU_PLUGIN(menu->callbacks->data);
+}
+
+// Called when a menu item is clicked. `data` is the index of its node.
 static inline void on_menu_item_clicked(GtkWidget* widget, gpointer data) {
-  // Pressed menu item.
-  g_plugin->last_menu_item_selected = true;
-  auto menu_item = static_cast<MenuItem*>(data);
-  fl_method_channel_invoke_method(g_plugin->channel, kOnItemSelected,
-                                  fl_value_new_int(menu_item->id()), nullptr,
-                                  nullptr, nullptr);
+  Menu* menu = get_menu_item_menu(widget);
+  NodeIndex node = GPOINTER_TO_UINT(data);
+  if (menu == nullptr || menu != get_menu_plugin(menu)->shown_menu ||
+      node >= menu->nodes.size() ||
+      menu->node_widgets[node].widget != widget) {
+    return;
+  }
+  // Avoid "activate" event for the menu item containing a sub-menu.
+  if (menu->nodes[node].child_count > 0 ||
+      menu->nodes[node].dynamic) {
+    return;
+  }
+  // Pressed menu item, which GTK has already toggled if it is a check item.
+  toggle_menu_item(*menu, node);
+  complete_shown_menu(get_menu_plugin(menu), node);
+}
+
+// Called from the main loop after a menu of the plugin `data` is deactivated
+// without any item being activated.
+static gboolean on_menu_dismissed(gpointer data) {
+  auto self = NATIVE_CONTEXT_MENU_PLUGIN(data);
+  self->dismiss_source_id = 0;
+  complete_shown_menu(self, kNoNode);
+  return G_SOURCE_REMOVE;
 }
 
 // Called when a menu is deactivated.
-static inline void on_menu_deactivated(GtkWidget* widget, gpointer) {
-  // TODO: Currently using "deactivate" signal to detect menu being dismissed by
-  // user.
-  // Problem: "deactivate" signal is sent regardless whether menu item was
-  // clicked or not (and leads the "activate" event). To notify about "activate"
-  // signal first, this thread is put to sleep (so that "activate" event is
-  // notified first). A better signal in GTK might be present which can be used
-  // to avoid this scenario.
-  g_plugin->last_menu_thread.reset(new std::thread([=]() {
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    if (!g_plugin->last_menu_item_selected)
-      fl_method_channel_invoke_method(g_plugin->channel, kOnMenuDismissed,
-                                      fl_value_new_null(), nullptr, nullptr,
-                                      nullptr);
-  }));
-}
-
-// Gets the parent `GdkWindow` to show the context menu in it.
+// GTK emits "deactivate" before "activate" on the clicked menu item, but
+// within the same main loop dispatch. A high priority idle source therefore
+// runs after the "activate" handler, which has already completed the menu.
+static inline void on_menu_deactivated(GtkWidget* widget, gpointer data) {
+  auto self = NATIVE_CONTEXT_MENU_PLUGIN(data);
+  if (self->shown_menu == nullptr || widget != self->shown_menu->widget ||
+      self->dismiss_source_id != 0) {
+    return;
+  }
+  self->dismiss_source_id =
+      g_idle_add_full(G_PRIORITY_HIGH, on_menu_dismissed, self, nullptr);
+}
+
+// Called once the user is done with a menu, after "activate" on the clicked
+// menu item (if any). Reports a dismissal without waiting for the idle source.
+static inline void on_menu_selection_done(GtkWidget* widget, gpointer data) {
+  auto self = NATIVE_CONTEXT_MENU_PLUGIN(data);
+  if (self->shown_menu == nullptr || widget != self->shown_menu->widget) {
+    return;
+  }
+  complete_shown_menu(self, kNoNode);
+}
+
+// Gets the parent `GdkWindow` to show the context menu in it. Menus of an
+// engine without a view, e.g. a headless one, are shown on the root window.
 static inline GdkWindow* get_window(NativeContextMenuPlugin* self) {
   FlView* view = fl_plugin_registrar_get_view(self->registrar);
-  if (view == nullptr) return nullptr;
+  if (view == nullptr) return gdk_get_default_root_window();
 
   return gtk_widget_get_window(gtk_widget_get_toplevel(GTK_WIDGET(view)));
 }
 
-static void native_context_menu_plugin_handle_method_call(
-    NativeContextMenuPlugin* self, FlMethodCall* method_call) {
-  g_autoptr(FlMethodResponse) response = nullptr;
-  const gchar* method = fl_method_call_get_name(method_call);
+// An `onItemsRequested` call waiting for its reply.
+struct ItemsRequest {
+  NativeContextMenuPlugin* self;
+  Menu* menu;
+  uint64_t show_count;
+  NodeIndex node;
+  int32_t id;
+};
+
+// Called with the reply to `onItemsRequested`. Adds the sub-items to the
+// requesting node, replacing its placeholder, if its menu is still shown.
+static void on_items_received(GObject* object, GAsyncResult* result,
+                              gpointer user_data) {
+  std::unique_ptr<ItemsRequest> request(static_cast<ItemsRequest*>(user_data));
+  NativeContextMenuPlugin* self = request->self;
+  g_autoptr(FlMethodResponse) response = fl_method_channel_invoke_method_finish(
+      FL_METHOD_CHANNEL(object), result, nullptr);
+  Menu* menu = self->shown_menu;
+  NodeIndex node = request->node;
+  // `menu` is only dereferenced once it is known to be the requesting menu.
+  if (menu != request->menu || self->show_count != request->show_count ||
+      node >= menu->nodes.size() || menu->nodes[node].id != request->id ||
+      menu->node_widgets[node].dynamic_items != DynamicItems::kLoading) {
+    g_object_unref(self);
+    return;
+  }
+  MenuDecodeError error;
+  if (!add_dynamic_items(*menu, node,
+                         response != nullptr
+                             ? fl_method_response_get_result(response, nullptr)
+                             : nullptr,
+                         &error)) {
+    // The reply has no caller to fail, so the rejected items are logged.
+    g_warning("Invalid sub-items of menu item %d, at item %" G_GINT64_FORMAT
+              ": %s",
+              request->id, error.id, error.message);
+  }
+  g_object_unref(self);
+}
+
+// Called when a menu item is selected (hovered or reached with the keyboard),
+// before its sub-menu is shown. `data` is the index of its node.
+static void on_menu_item_selected(GtkWidget* widget, gpointer data) {
+  Menu* menu = get_menu_item_menu(widget);
+  NodeIndex node = GPOINTER_TO_UINT(data);
+  if (menu == nullptr || menu != get_menu_plugin(menu)->shown_menu ||
+      node >= menu->nodes.size() ||
+      menu->node_widgets[node].widget != widget) {
+    return;
+  }
+  NativeContextMenuPlugin* self = get_menu_plugin(menu);
+  queue_highlight(self, node, true);
+  build_sub_item_widgets(*menu, node);
+  if (menu->node_widgets[node].dynamic_items == DynamicItems::kUnloaded) {
+    menu->node_widgets[node].dynamic_items = DynamicItems::kLoading;
+    menu->requested_nodes.push_back(node);
+    auto request = new ItemsRequest{
+        NATIVE_CONTEXT_MENU_PLUGIN(g_object_ref(self)), menu,
+        self->show_count, node, menu->nodes[node].id};
+    fl_method_channel_invoke_method(self->channel, kOnItemsRequested,
+                                    fl_value_new_int(menu->nodes[node].id),
+                                    nullptr, on_items_received, request);
+  }
+}
+
+// Called when a menu item is no longer highlighted. `data` is the index of its
+// node.
+static void on_menu_item_deselected(GtkWidget* widget, gpointer data) {
+  Menu* menu = get_menu_item_menu(widget);
+  NodeIndex node = GPOINTER_TO_UINT(data);
+  if (menu == nullptr || menu != get_menu_plugin(menu)->shown_menu ||
+      node >= menu->nodes.size() ||
+      menu->node_widgets[node].widget != widget) {
+    return;
+  }
+  queue_highlight(get_menu_plugin(menu), node, false);
+}
+
+// Handlers connected to the widgets of every menu built by the plugin, each
+// instance passes itself as their `data`.
+static const MenuCallbacks kMenuCallbacks = {
+    on_menu_item_clicked, on_menu_item_selected,  on_menu_item_deselected,
+    on_menu_deactivated,  on_menu_selection_done, nullptr,
+};
+
+// Keeps a built `menu` alive until `disposeMenu` & returns its handle.
+static int64_t register_menu(NativeContextMenuPlugin* self,
+                             std::unique_ptr<Menu> menu) {
+  int64_t handle = self->next_menu_handle++;
+  self->menus.emplace(handle, std::move(menu));
+  return handle;
+}
+
+// Pops up `menu` at the `position` passed in the method call `arguments`, or
+// at the cursor's position if none was passed.
+// Reads the `position` argument scaled by `devicePixelRatio` into the origin of
+// `rectangle`. Returns `false` if either is missing or malformed.
+static bool lookup_position(FlValue* arguments, GdkRectangle* rectangle) {
+  auto device_pixel_ratio =
+      fl_value_lookup_string(arguments, "devicePixelRatio");
+  auto position = fl_value_lookup_string(arguments, "position");
+  if (device_pixel_ratio == nullptr || position == nullptr ||
+      fl_value_get_type(device_pixel_ratio) != FL_VALUE_TYPE_FLOAT ||
+      fl_value_get_type(position) != FL_VALUE_TYPE_LIST ||
+      fl_value_get_length(position) < 2) {
+    return false;
+  }
+  FlValue* x = fl_value_get_list_value(position, 0);
+  FlValue* y = fl_value_get_list_value(position, 1);
+  if (fl_value_get_type(x) != FL_VALUE_TYPE_FLOAT ||
+      fl_value_get_type(y) != FL_VALUE_TYPE_FLOAT) {
+    return false;
+  }
+  rectangle->x = fl_value_get_float(x) * fl_value_get_float(device_pixel_ratio);
+  rectangle->y = fl_value_get_float(y) * fl_value_get_float(device_pixel_ratio);
+  return true;
+}
+
+static void popup_menu(NativeContextMenuPlugin* self, Menu* menu,
+                       FlValue* arguments) {
+  reset_dynamic_items(*menu);
+  auto searchable = fl_value_lookup_string(arguments, "searchable");
+  set_menu_search(*menu, searchable != nullptr &&
+                             fl_value_get_type(searchable) ==
+                                 FL_VALUE_TYPE_BOOL &&
+                             fl_value_get_bool(searchable));
+  auto keep_open = fl_value_lookup_string(arguments, "keepOpen");
+  set_menu_keep_open(*menu, keep_open != nullptr &&
+                                fl_value_get_type(keep_open) ==
+                                    FL_VALUE_TYPE_BOOL &&
+                                fl_value_get_bool(keep_open));
+  auto request = fl_value_lookup_string(arguments, "request");
+  self->shown_menu = menu;
+  self->shown_request =
+      request != nullptr && fl_value_get_type(request) == FL_VALUE_TYPE_INT
+          ? fl_value_get_int(request)
+          : 0;
+  auto port = fl_value_lookup_string(arguments, "port");
+  self->shown_port =
+      port != nullptr && fl_value_get_type(port) == FL_VALUE_TYPE_INT
+          ? fl_value_get_int(port)
+          : 0;
+  self->show_count++;
+  GdkWindow* window = get_window(self);
+  GdkRectangle rectangle;
+  // Pass `devicePixelRatio` and `position` from Dart to show menu at
+  // specified coordinates. If it is not defined, WIN32 will use
+  // `GetCursorPos` to show the context menu at the cursor's position.
+  if (!lookup_position(arguments, &rectangle)) {
+    GdkDevice* mouse_device;
+    int x, y;
+    // Legacy support.
+#if GTK_CHECK_VERSION(3, 20, 0)
+    GdkSeat* seat = gdk_display_get_default_seat(gdk_display_get_default());
+    mouse_device = gdk_seat_get_pointer(seat);
+#else
+    GdkDeviceManager* devman =
+        gdk_display_get_device_manager(gdk_display_get_default());
+    mouse_device = gdk_device_manager_get_client_pointer(devman);
+#endif
+    gdk_window_get_device_position(window, mouse_device, &x, &y, NULL);
+    rectangle.x = x;
+    rectangle.y = y;
+  }
+  // `gtk_menu_popup_at_rect` is used since `gtk_menu_popup_at_pointer` will
+  // require event box creation & another callback will be involved. This way
+  // is straight forward & easy to work with.
+  // NOTE: GDK_GRAVITY_NORTH_WEST is hard-coded by default since no analog is
+  // present for it inside the Dart platform channel code (as of now). In
+  // summary, this will create a menu whose body is in bottom-right to the
+  // position of the mouse pointer.
+  gint64 popup_start = g_get_monotonic_time();
+  gtk_menu_popup_at_rect(GTK_MENU(menu->widget), window, &rectangle,
+                         GDK_GRAVITY_NORTH_WEST, GDK_GRAVITY_NORTH_WEST, NULL);
+  self->stats.popup.record(g_get_monotonic_time() - popup_start);
+  // The menu is realized by now, its window has a frame clock of its own.
+  GdkFrameClock* clock = gtk_widget_get_frame_clock(menu->widget);
+  if (clock != nullptr) {
+    self->paint_clock = GDK_FRAME_CLOCK(g_object_ref(clock));
+    self->paint_handler_id = g_signal_connect(
+        clock, "after-paint", G_CALLBACK(on_menu_painted), self);
+  }
+}
+
+// Returns the `count`, `p50`, `p95`, `p99` & `max` of `histogram`.
+static FlValue* histogram_to_value(const LatencyHistogram& histogram) {
+  std::array<int64_t, 4> values;
+  histogram.percentiles<4>({50, 95, 99, 100}, values);
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "count", fl_value_new_int(histogram.count));
+  fl_value_set_string_take(value, "p50", fl_value_new_int(values[0]));
+  fl_value_set_string_take(value, "p95", fl_value_new_int(values[1]));
+  fl_value_set_string_take(value, "p99", fl_value_new_int(values[2]));
+  fl_value_set_string_take(value, "max", fl_value_new_int(values[3]));
+  return value;
+}
+
+// Returns whether `method` is called with a map of arguments.
+static bool takes_arguments(const gchar* method) {
+  for (auto name :
+       {kShowMenu, kRegisterMenu, kUpdateMenu, kDisposeMenu, kConfigure}) {
+    if (strcmp(method, name) == 0) return true;
+  }
+  return false;
+}
+
+// Returns the integer `handle` argument, or -1 which no menu is registered
+// with if it is missing or mistyped.
+static int64_t lookup_handle(FlValue* arguments) {
+  auto handle = fl_value_lookup_string(arguments, "handle");
+  return handle != nullptr && fl_value_get_type(handle) == FL_VALUE_TYPE_INT
+             ? fl_value_get_int(handle)
+             : -1;
+}
+
+// Returns the `invalid_menu` error for items rejected with `error`, whose
+// details are the id of the rejected item if it is known.
+static FlMethodResponse* invalid_menu_response(const MenuDecodeError& error) {
+  return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "invalid_menu", error.message,
+        error.id >= 0 ? fl_value_new_int(error.id) : nullptr));
+}
+
+// A packed menu read in place, either from a buffer passed by its address or
+// from a message of the packed channel.
+struct PackedBuffer {
+  const uint8_t* data;
+  size_t size;
+};
+
+// Buffers allocated by `native_context_menu_buffer_new` & not freed yet, by
+// address, with their size. Dart allocates & frees them on its own thread.
+static GMutex live_buffers_mutex;
+static std::map<uintptr_t, size_t>& get_live_buffers() {
+  static auto live_buffers = new std::map<uintptr_t, size_t>();
+  return *live_buffers;
+}
+
+// Reads the `buffer` & `bufferSize` arguments into `buffer`. Returns `false`
+// if they are missing, mistyped or do not lie within a live buffer from
+// `native_context_menu_buffer_new`, so that no other memory is ever read.
+static bool lookup_argument_buffer(FlValue* arguments, PackedBuffer* buffer) {
+  if (fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) return false;
+  auto address = fl_value_lookup_string(arguments, "buffer");
+  auto size = fl_value_lookup_string(arguments, "bufferSize");
+  if (address == nullptr || fl_value_get_type(address) != FL_VALUE_TYPE_INT ||
+      size == nullptr || fl_value_get_type(size) != FL_VALUE_TYPE_INT ||
+      fl_value_get_int(size) < 0) {
+    return false;
+  }
+  auto begin = static_cast<uintptr_t>(fl_value_get_int(address));
+  auto length = static_cast<uint64_t>(fl_value_get_int(size));
+  g_mutex_lock(&live_buffers_mutex);
+  std::map<uintptr_t, size_t>& live_buffers = get_live_buffers();
+  // The last buffer starting at or before `begin`.
+  auto it = live_buffers.upper_bound(begin);
+  bool live = it != live_buffers.begin();
+  if (live) {
+    --it;
+    uint64_t offset = begin - it->first;
+    live = offset <= it->second && length <= it->second - offset;
+  }
+  g_mutex_unlock(&live_buffers_mutex);
+  if (!live) return false;
+  *buffer = {reinterpret_cast<const uint8_t*>(begin),
+             static_cast<size_t>(length)};
+  return true;
+}
+
+// Builds the menu passed to `showMenu` or `registerMenu`, either as `items` or
+// as the `packed` menu of a `buffer`, if any. Returns `nullptr` & fills `error`
+// if the menu is invalid.
+static std::unique_ptr<Menu> build_argument_menu(NativeContextMenuPlugin* self,
+                                                 FlValue* arguments,
+                                                 const PackedBuffer* packed,
+                                                 MenuBuildTimes* times,
+                                                 MenuDecodeError* error) {
+  if (packed == nullptr &&
+      fl_value_lookup_string(arguments, "buffer") != nullptr) {
+    error->message = "No live buffer holds this address & size.";
+    return nullptr;
+  }
+  if (packed == nullptr) {
+    return build_menu(fl_value_lookup_string(arguments, "items"),
+                      &self->menu_callbacks, &self->widget_pool,
+                      &self->icon_cache, times, error);
+  }
+  std::unique_ptr<Menu> menu =
+      build_packed_menu(packed->data, packed->size, &self->menu_callbacks,
+                        &self->widget_pool, times);
+  if (menu == nullptr) error->message = "Malformed packed menu.";
+  return menu;
+}
+
+// Records the menus registered before the trace was opened, as `registerMenu`
+// calls returning their handles, so that the replay registers them too.
+static void trace_registered_menus(NativeContextMenuPlugin* self) {
+  gint64 time = g_get_monotonic_time();
+  for (const auto& [handle, menu] : self->menus) {
+    g_autoptr(FlValue) arguments = fl_value_new_map();
+    fl_value_set_string_take(arguments, "items", menu_items_to_value(*menu));
+    g_autoptr(FlMethodResponse) response = FL_METHOD_RESPONSE(
+        fl_method_success_response_new(fl_value_new_int(handle)));
+    self->trace.write_call(kRegisterMenu, arguments, nullptr, 0, response,
+                           time, 0);
+  }
+}
+
+// Handles the call of `method`, whose packed menu, if any, is `packed`
+// rather than read from `arguments`.
+static FlMethodResponse* handle_method(NativeContextMenuPlugin* self,
+                                       const gchar* method,
+                                       FlValue* arguments,
+                                       const PackedBuffer* packed) {
+  FlMethodResponse* response = nullptr;
+  if (takes_arguments(method) &&
+      fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
+    return FL_METHOD_RESPONSE(fl_method_error_response_new(
+        "invalid_arguments", "Arguments must be a map.", nullptr));
+  }
   if (strcmp(method, kShowMenu) == 0) {
-    // Clear previously saved object instances.
-    self->last_menu_items.clear();
-    self->last_menu_item_selected = false;
-    if (self->last_menu_thread != nullptr) {
-      self->last_menu_thread->detach();
-      self->last_menu_thread.reset(nullptr);
+    gint64 show_start = g_get_monotonic_time();
+    auto handle = fl_value_lookup_string(arguments, "handle");
+    auto hash = fl_value_lookup_string(arguments, "hash");
+    if (hash != nullptr && fl_value_get_type(hash) != FL_VALUE_TYPE_INT) {
+      hash = nullptr;
     }
-    auto arguments = fl_method_call_get_args(method_call);
-    auto items = fl_value_lookup_string(arguments, "items");
-    auto device_pixel_ratio =
-        fl_value_lookup_string(arguments, "devicePixelRatio");
-    auto position = fl_value_lookup_string(arguments, "position");
-    GdkWindow* window = get_window(self);
-    GtkWidget* menu = gtk_menu_new();
-    for (int32_t i = 0; i < fl_value_get_length(items); i++) {
-      int32_t id = fl_value_get_int(
-          fl_value_lookup_string(fl_value_get_list_value(items, i), "id"));
-      const char* title = fl_value_get_string(
-          fl_value_lookup_string(fl_value_get_list_value(items, i), "title"));
-      auto sub_items =
-          fl_value_lookup_string(fl_value_get_list_value(items, i), "items");
-      self->last_menu_items.emplace_back(std::make_unique<MenuItem>(id, title));
-      GtkWidget* menu_item = gtk_menu_item_new_with_label(title);
-      // Check for sub-items & create a sub-menu.
-      if (fl_value_get_length(sub_items) > 0) {
-        GtkWidget* sub_menu = gtk_menu_new();
-        for (int32_t j = 0; j < fl_value_get_length(sub_items); j++) {
-          int32_t sub_id = fl_value_get_int(fl_value_lookup_string(
-              fl_value_get_list_value(sub_items, j), "id"));
-          const char* sub_title = fl_value_get_string(fl_value_lookup_string(
-              fl_value_get_list_value(sub_items, j), "title"));
-          GtkWidget* sub_menu_item = gtk_menu_item_new_with_label(sub_title);
-          gtk_menu_shell_append(GTK_MENU_SHELL(sub_menu), sub_menu_item);
-          gtk_widget_show(sub_menu_item);
-          self->last_menu_items.back()->items().emplace_back(
-              std::make_unique<MenuItem>(sub_id, sub_title));
-          g_signal_connect(
-              G_OBJECT(sub_menu_item), "activate",
-              G_CALLBACK(on_menu_item_clicked),
-              (gpointer)self->last_menu_items.back()->items().at(j).get());
-        }
-        gtk_menu_item_set_submenu(GTK_MENU_ITEM(menu_item), sub_menu);
-      } else {
-        // Avoid "activate" event for the menu item containing a sub-menu.
-        g_signal_connect(G_OBJECT(menu_item), "activate",
-                         G_CALLBACK(on_menu_item_clicked),
-                         (gpointer)self->last_menu_items.back().get());
+    bool has_items = fl_value_lookup_string(arguments, "items") != nullptr ||
+                     fl_value_lookup_string(arguments, "buffer") != nullptr ||
+                     packed != nullptr;
+    // The menu to show is resolved & validated first, so that a failing call
+    // leaves the open menu, if any, untouched.
+    Menu* menu = nullptr;
+    std::unique_ptr<Menu> built = nullptr;
+    if (handle != nullptr) {
+      auto it = self->menus.find(lookup_handle(arguments));
+      if (it == self->menus.end()) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new(
+            "invalid_handle", "No menu is registered with this handle.",
+            nullptr));
+      }
+      menu = it->second.get();
+    } else if (hash != nullptr && !has_items) {
+      // Only looked up below, since measuring the cached menu may evict
+      // others, including the one still open.
+      auto check = fl_value_lookup_string(arguments, "check");
+      if (check == nullptr || fl_value_get_type(check) != FL_VALUE_TYPE_INT ||
+          !self->menu_cache.contains(fl_value_get_int(hash),
+                                     fl_value_get_int(check))) {
+        self->menu_cache.misses++;
+        return FL_METHOD_RESPONSE(fl_method_error_response_new(
+            "cache_miss", "No menu is cached with this hash.", nullptr));
       }
-      gtk_widget_show(menu_item);
-      gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
-    }
-    GdkRectangle rectangle;
-    // Pass `devicePixelRatio` and `position` from Dart to show menu at
-    // specified coordinates. If it is not defined, WIN32 will use
-    // `GetCursorPos` to show the context menu at the cursor's position.
-    if (device_pixel_ratio != nullptr && position != nullptr) {
-      rectangle.x = fl_value_get_float(fl_value_get_list_value(position, 0)) *
-                    fl_value_get_float(device_pixel_ratio);
-      rectangle.y = fl_value_get_float(fl_value_get_list_value(position, 1)) *
-                    fl_value_get_float(device_pixel_ratio);
     } else {
-      GdkDevice* mouse_device;
-      int x, y;
-      // Legacy support.
-#if GTK_CHECK_VERSION(3, 20, 0)
-      GdkSeat* seat = gdk_display_get_default_seat(gdk_display_get_default());
-      mouse_device = gdk_seat_get_pointer(seat);
-#else
-      GdkDeviceManager* devman =
-          gdk_display_get_device_manager(gdk_display_get_default());
-      mouse_device = gdk_device_manager_get_client_pointer(devman);
-#endif
-      gdk_window_get_device_position(window, mouse_device, &x, &y, NULL);
-      rectangle.x = x;
-      rectangle.y = y;
+      MenuBuildTimes times;
+      MenuDecodeError error;
+      built = build_argument_menu(self, arguments, packed, &times, &error);
+      if (built == nullptr) return invalid_menu_response(error);
+      record_build_times(self, times);
+    }
+    // A menu still open is closed & reported as superseded, before it may be
+    // destroyed below.
+    Menu* superseded = self->shown_menu;
+    complete_shown_menu(self, kNoNode, kSupersededReason);
+    if (superseded != nullptr) {
+      gtk_menu_shell_deactivate(GTK_MENU_SHELL(superseded->widget));
+    }
+    if (menu == nullptr && built == nullptr) {
+      menu = self->menu_cache.lookup(fl_value_get_int(hash));
+    } else if (built != nullptr && hash != nullptr) {
+      menu = self->menu_cache.insert(fl_value_get_int(hash), std::move(built));
+    } else if (built != nullptr) {
+      // Replaces (& frees) the previously shown menu.
+      self->last_menu = std::move(built);
+      menu = self->last_menu.get();
     }
-    g_signal_connect(G_OBJECT(menu), "deactivate",
-                     G_CALLBACK(on_menu_deactivated), nullptr);
-    // `gtk_menu_popup_at_rect` is used since `gtk_menu_popup_at_pointer` will
-    // require event box creation & another callback will be involved. This way
-    // is straight forward & easy to work with.
-    // NOTE: GDK_GRAVITY_NORTH_WEST is hard-coded by default since no analog is
-    // present for it inside the Dart platform channel code (as of now). In
-    // summary, this will create a menu whose body is in bottom-right to the
-    // position of the mouse pointer.
-    gtk_menu_popup_at_rect(GTK_MENU(menu), window, &rectangle,
-                           GDK_GRAVITY_NORTH_WEST, GDK_GRAVITY_NORTH_WEST,
-                           NULL);
+    self->show_start = show_start;
+    popup_menu(self, menu, arguments);
 
     // Responding with `null`, click event & respective `id` of the `MenuItem`
     // is notified through callback. Otherwise the GUI will become unresponsive.
     // To keep the API same, a `Completer` is used in the Dart.
     response =
         FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_null()));
+  } else if (strcmp(method, kRegisterMenu) == 0) {
+    MenuBuildTimes times;
+    MenuDecodeError error;
+    auto menu = build_argument_menu(self, arguments, packed, &times, &error);
+    if (menu != nullptr) {
+      record_build_times(self, times);
+      int64_t handle = register_menu(self, std::move(menu));
+      response = FL_METHOD_RESPONSE(
+          fl_method_success_response_new(fl_value_new_int(handle)));
+    } else {
+      response = invalid_menu_response(error);
+    }
+  } else if (strcmp(method, kUpdateMenu) == 0) {
+    auto it = self->menus.find(lookup_handle(arguments));
+    if (it == self->menus.end()) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "invalid_handle", "No menu is registered with this handle.",
+          nullptr));
+    }
+    auto patches = fl_value_lookup_string(arguments, "patches");
+    if (patches == nullptr ||
+        fl_value_get_type(patches) != FL_VALUE_TYPE_LIST) {
+      return FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "invalid_arguments", "Patches must be a list.", nullptr));
+    }
+    // The dynamic sub-items of a menu closed since are dropped first, so that
+    // inserted items may reuse their ids.
+    if (it->second.get() != self->shown_menu) reset_dynamic_items(*it->second);
+    const char* error = nullptr;
+    size_t i = 0;
+    for (; i < fl_value_get_length(patches) && error == nullptr; i++) {
+      error =
+          apply_menu_patch(*it->second, fl_value_get_list_value(patches, i));
+    }
+    // Once per call, since the search index is rebuilt over every item.
+    refresh_menu_search(*it->second);
+    if (error != nullptr) {
+      // Report the index of the rejected patch, earlier ones stay applied.
+      response = FL_METHOD_RESPONSE(fl_method_error_response_new(
+          "invalid_patch", error, fl_value_new_int(i - 1)));
+    } else {
+      response = FL_METHOD_RESPONSE(
+          fl_method_success_response_new(fl_value_new_null()));
+    }
+  } else if (strcmp(method, kDisposeMenu) == 0) {
+    // Unknown handles are ignored, disposing twice is harmless.
+    auto it = self->menus.find(lookup_handle(arguments));
+    if (it != self->menus.end()) {
+      if (it->second.get() == self->shown_menu) {
+        complete_shown_menu(self, kNoNode);
+      }
+      self->menus.erase(it);
+    }
+    response =
+        FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_null()));
+  } else if (strcmp(method, kConfigure) == 0) {
+    auto widget_pool_size = fl_value_lookup_string(arguments, "widgetPoolSize");
+    if (widget_pool_size != nullptr &&
+        fl_value_get_type(widget_pool_size) == FL_VALUE_TYPE_INT) {
+      self->widget_pool.set_limit(
+          std::max<int64_t>(fl_value_get_int(widget_pool_size), 0));
+    }
+    auto icon_cache_size = fl_value_lookup_string(arguments, "iconCacheSize");
+    if (icon_cache_size != nullptr &&
+        fl_value_get_type(icon_cache_size) == FL_VALUE_TYPE_INT) {
+      self->icon_cache.set_budget(
+          std::max<int64_t>(fl_value_get_int(icon_cache_size), 0));
+    }
+    auto menu_cache_size = fl_value_lookup_string(arguments, "menuCacheSize");
+    auto menu_cache_widgets =
+        fl_value_lookup_string(arguments, "menuCacheWidgets");
+    if (menu_cache_size != nullptr || menu_cache_widgets != nullptr) {
+      size_t bytes = self->menu_cache.budget;
+      size_t widgets = self->menu_cache.widget_budget;
+      if (menu_cache_size != nullptr &&
+          fl_value_get_type(menu_cache_size) == FL_VALUE_TYPE_INT) {
+        bytes = std::max<int64_t>(fl_value_get_int(menu_cache_size), 0);
+      }
+      if (menu_cache_widgets != nullptr &&
+          fl_value_get_type(menu_cache_widgets) == FL_VALUE_TYPE_INT) {
+        widgets = std::max<int64_t>(fl_value_get_int(menu_cache_widgets), 0);
+      }
+      self->menu_cache.set_budget(bytes, widgets, self->shown_menu);
+    }
+    auto trace_file = fl_value_lookup_string(arguments, "traceFile");
+    if (trace_file != nullptr &&
+        fl_value_get_type(trace_file) == FL_VALUE_TYPE_STRING) {
+      const gchar* path = fl_value_get_string(trace_file);
+      if (path[0] == '\0') {
+        self->trace.close();
+      } else if (!self->trace.open(path)) {
+        return FL_METHOD_RESPONSE(fl_method_error_response_new(
+            "invalid_trace_file", "The trace file cannot be created.",
+            nullptr));
+      } else {
+        trace_registered_menus(self);
+      }
+    }
+    response =
+        FL_METHOD_RESPONSE(fl_method_success_response_new(fl_value_new_null()));
+  } else if (strcmp(method, kGetStats) == 0) {
+    g_autoptr(FlValue) stats = fl_value_new_map();
+    fl_value_set_string_take(stats, "decode",
+                             histogram_to_value(self->stats.decode));
+    fl_value_set_string_take(stats, "build",
+                             histogram_to_value(self->stats.build));
+    fl_value_set_string_take(stats, "popup",
+                             histogram_to_value(self->stats.popup));
+    fl_value_set_string_take(stats, "firstShow",
+                             histogram_to_value(self->stats.first_show));
+    fl_value_set_string_take(stats, "firstPaint",
+                             histogram_to_value(self->stats.first_paint));
+    fl_value_set_string_take(stats, "warmUp",
+                             histogram_to_value(self->stats.warm_up));
+    fl_value_set_string_take(stats, "outcome",
+                             histogram_to_value(self->stats.outcome));
+    FlValue* widget_pool = fl_value_new_map();
+    fl_value_set_string_take(widget_pool, "hits",
+                             fl_value_new_int(self->widget_pool.hits));
+    fl_value_set_string_take(widget_pool, "misses",
+                             fl_value_new_int(self->widget_pool.misses));
+    fl_value_set_string_take(
+        widget_pool, "size",
+        fl_value_new_int(self->widget_pool.widgets.size()));
+    fl_value_set_string_take(stats, "widgetPool", widget_pool);
+    FlValue* icon_cache = fl_value_new_map();
+    fl_value_set_string_take(icon_cache, "hits",
+                             fl_value_new_int(self->icon_cache.hits));
+    fl_value_set_string_take(icon_cache, "misses",
+                             fl_value_new_int(self->icon_cache.misses));
+    fl_value_set_string_take(icon_cache, "size",
+                             fl_value_new_int(self->icon_cache.size));
+    fl_value_set_string_take(icon_cache, "count",
+                             fl_value_new_int(self->icon_cache.entries.size()));
+    fl_value_set_string_take(stats, "iconCache", icon_cache);
+    const MenuCache& cache = self->menu_cache;
+    FlValue* menu_cache = fl_value_new_map();
+    fl_value_set_string_take(menu_cache, "hits", fl_value_new_int(cache.hits));
+    fl_value_set_string_take(menu_cache, "misses",
+                             fl_value_new_int(cache.misses));
+    // Percentage of the shows of cached menus which did not send the items.
+    uint64_t lookups = cache.hits + cache.misses;
+    fl_value_set_string_take(
+        menu_cache, "hitRate",
+        fl_value_new_int(lookups > 0 ? cache.hits * 100 / lookups : 0));
+    fl_value_set_string_take(menu_cache, "size", fl_value_new_int(cache.size));
+    fl_value_set_string_take(menu_cache, "widgets",
+                             fl_value_new_int(cache.widgets));
+    fl_value_set_string_take(menu_cache, "count",
+                             fl_value_new_int(cache.entries.size()));
+    fl_value_set_string_take(stats, "menuCache", menu_cache);
+#ifndef NDEBUG
+    FlValue* live = fl_value_new_map();
+    fl_value_set_string_take(live, "menus",
+                             fl_value_new_int(live_objects.menus));
+    fl_value_set_string_take(live, "widgets",
+                             fl_value_new_int(live_objects.widgets));
+    fl_value_set_string_take(live, "nodes",
+                             fl_value_new_int(live_objects.nodes));
+    fl_value_set_string_take(stats, "live", live);
+#endif
+    response = FL_METHOD_RESPONSE(fl_method_success_response_new(stats));
   } else {
     response = FL_METHOD_RESPONSE(fl_method_not_implemented_response_new());
   }
-  fl_method_call_respond(method_call, response, nullptr);
+  return response;
+}
+
+// Returns the `arguments` of a `showMenu` call shown from the menu cache along
+// with the `items` of the shown menu, the first time its hash is traced, so
+// that the replay caches the menu too. Returns `nullptr` if the call is traced
+// as received, else a new reference.
+static FlValue* get_traced_arguments(NativeContextMenuPlugin* self,
+                                     const gchar* method, FlValue* arguments,
+                                     const PackedBuffer* packed,
+                                     FlMethodResponse* response) {
+  if (!self->trace.is_open() || strcmp(method, kShowMenu) != 0 ||
+      !FL_IS_METHOD_SUCCESS_RESPONSE(response) ||
+      fl_value_lookup_string(arguments, "handle") != nullptr) {
+    return nullptr;
+  }
+  auto hash = fl_value_lookup_string(arguments, "hash");
+  if (hash == nullptr || fl_value_get_type(hash) != FL_VALUE_TYPE_INT ||
+      !self->trace.add_menu_hash(fl_value_get_int(hash)) ||
+      fl_value_lookup_string(arguments, "items") != nullptr ||
+      packed != nullptr || self->shown_menu == nullptr) {
+    return nullptr;
+  }
+  FlValue* traced = fl_value_new_map();
+  for (size_t i = 0; i < fl_value_get_length(arguments); i++) {
+    fl_value_set(traced, fl_value_get_map_key(arguments, i),
+                 fl_value_get_map_value(arguments, i));
+  }
+  fl_value_set_string_take(traced, "items",
+                           menu_items_to_value(*self->shown_menu));
+  return traced;
+}
+
+// Handles, times & traces the call of `method`. The packed menu is `packed`
+// if passed, as for the packed channel, & else the `buffer` argument, if it
+// lies within a live buffer.
+static FlMethodResponse* handle_method_call(NativeContextMenuPlugin* self,
+                                            const gchar* method,
+                                            FlValue* arguments,
+                                            const PackedBuffer* packed) {
+  gint64 start = g_get_monotonic_time();
+  PackedBuffer buffer;
+  if (packed == nullptr && lookup_argument_buffer(arguments, &buffer)) {
+    packed = &buffer;
+  }
+  FlMethodResponse* response = handle_method(self, method, arguments, packed);
+  g_autoptr(FlValue) traced =
+      get_traced_arguments(self, method, arguments, packed, response);
+  self->trace.write_call(method, traced != nullptr ? traced : arguments,
+                         packed != nullptr ? packed->data : nullptr,
+                         packed != nullptr ? packed->size : 0, response,
+                         start, g_get_monotonic_time() - start);
+  return response;
+}
+
+FlMethodResponse* native_context_menu_plugin_handle_method(
+    NativeContextMenuPlugin* self, const gchar* method, FlValue* arguments) {
+  return handle_method_call(self, method, arguments, nullptr);
+}
+
+GtkWidget* native_context_menu_plugin_get_shown_menu(
+    NativeContextMenuPlugin* self) {
+  return self->shown_menu != nullptr ? self->shown_menu->widget : nullptr;
+}
+
+GtkWidget* native_context_menu_plugin_get_shown_item(
+    NativeContextMenuPlugin* self, int64_t id) {
+  Menu* menu = self->shown_menu;
+  NodeIndex node = menu != nullptr ? menu->find(id) : kNoNode;
+  if (node == kNoNode) return nullptr;
+  // Sub-menus are built from the top level down.
+  std::vector<NodeIndex> parents;
+  for (NodeIndex parent = menu->nodes[node].parent; parent != kRootNode;
+       parent = menu->nodes[parent].parent) {
+    parents.push_back(parent);
+  }
+  for (auto it = parents.rbegin(); it != parents.rend(); ++it) {
+    build_sub_item_widgets(*menu, *it);
+  }
+  return menu->node_widgets[node].widget;
 }
 
 static void native_context_menu_plugin_dispose(GObject* object) {
+  NativeContextMenuPlugin* self = NATIVE_CONTEXT_MENU_PLUGIN(object);
+  g_clear_handle_id(&self->dismiss_source_id, g_source_remove);
+  g_clear_handle_id(&self->release_source_id, g_source_remove);
+  self->highlights.clear();
+  flush_highlights(self);
+  stop_paint_timing(self);
+  self->shown_menu = nullptr;
+  self->last_menu.reset();
+  self->menus.clear();
+  self->menu_cache.set_budget(0, 0, nullptr);
+  self->widget_pool.set_limit(0);
+  self->trace.close();
+  if (self->memory_monitor != nullptr) {
+    g_clear_signal_handler(&self->low_memory_handler_id,
+                           self->memory_monitor);
+    g_clear_object(&self->memory_monitor);
+  }
+  g_clear_object(&self->channel);
+  g_clear_object(&self->packed_channel);
+  g_clear_object(&self->highlights_channel);
+  g_clear_object(&self->registrar);
   G_OBJECT_CLASS(native_context_menu_plugin_parent_class)->dispose(object);
 }
 
+static void native_context_menu_plugin_finalize(GObject* object) {
+  NativeContextMenuPlugin* self = NATIVE_CONTEXT_MENU_PLUGIN(object);
+  // Non-trivial C++ members are not managed by GObject.
+  using LastMenu = decltype(self->last_menu);
+  self->last_menu.~LastMenu();
+  using Menus = decltype(self->menus);
+  self->menus.~Menus();
+  using Highlights = decltype(self->highlights);
+  self->highlights.~Highlights();
+  self->widget_pool.~WidgetPool();
+  self->icon_cache.~IconCache();
+  self->menu_cache.~MenuCache();
+  self->trace.~MenuTraceWriter();
+  G_OBJECT_CLASS(native_context_menu_plugin_parent_class)->finalize(object);
+}
+
 static void native_context_menu_plugin_class_init(
     NativeContextMenuPluginClass* klass) {
   G_OBJECT_CLASS(klass)->dispose = native_context_menu_plugin_dispose;
+  G_OBJECT_CLASS(klass)->finalize = native_context_menu_plugin_finalize;
+}
+
+static void native_context_menu_plugin_init(NativeContextMenuPlugin* self) {
+  // `g_object_new` only zero-fills the instance, construct non-trivial C++
+  // members in place.
+  new (&self->last_menu) decltype(self->last_menu)();
+  new (&self->menus) decltype(self->menus)();
+  new (&self->highlights) decltype(self->highlights)();
+  new (&self->widget_pool) WidgetPool();
+  new (&self->icon_cache) IconCache();
+  new (&self->menu_cache) MenuCache();
+  new (&self->trace) MenuTraceWriter();
+  self->menu_callbacks = kMenuCallbacks;
+  self->menu_callbacks.data = self;
+  self->next_menu_handle = 1;
 }
 
-static void native_context_menu_plugin_init(NativeContextMenuPlugin* self) {}
+// Called when Dart starts listening to the highlights.
+static FlMethodErrorResponse* highlights_listen_cb(FlEventChannel* channel,
+                                                   FlValue* arguments,
+                                                   gpointer user_data) {
+  NATIVE_CONTEXT_MENU_PLUGIN(user_data)->highlights_listened = true;
+  return nullptr;
+}
+
+// Called when Dart stops listening to the highlights, pending ones are
+// dropped.
+static FlMethodErrorResponse* highlights_cancel_cb(FlEventChannel* channel,
+                                                   FlValue* arguments,
+                                                   gpointer user_data) {
+  NativeContextMenuPlugin* self = NATIVE_CONTEXT_MENU_PLUGIN(user_data);
+  self->highlights_listened = false;
+  self->highlights.clear();
+  flush_highlights(self);
+  return nullptr;
+}
 
 static void method_call_cb(FlMethodChannel* channel, FlMethodCall* method_call,
                            gpointer user_data) {
   NativeContextMenuPlugin* plugin = NATIVE_CONTEXT_MENU_PLUGIN(user_data);
-  native_context_menu_plugin_handle_method_call(plugin, method_call);
+  g_autoptr(FlMethodResponse) response =
+      native_context_menu_plugin_handle_method(
+          plugin, fl_method_call_get_name(method_call),
+          fl_method_call_get_args(method_call));
+  fl_method_call_respond(method_call, response, nullptr);
+}
+
+FlValue* native_context_menu_plugin_handle_packed_message(
+    NativeContextMenuPlugin* self, FlValue* message) {
+  if (message == nullptr ||
+      fl_value_get_type(message) != FL_VALUE_TYPE_UINT8_LIST) {
+    return fl_value_new_uint8_list(nullptr, 0);
+  }
+  // Registered as a packed menu read in place, so that the call is timed &
+  // traced like the others, & replayed from its recorded `bufferData`.
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  PackedBuffer packed = {fl_value_get_uint8_list(message),
+                         fl_value_get_length(message)};
+  g_autoptr(FlMethodResponse) response =
+      handle_method_call(self, kRegisterMenu, arguments, &packed);
+  if (!FL_IS_METHOD_SUCCESS_RESPONSE(response)) {
+    return fl_value_new_uint8_list(nullptr, 0);
+  }
+  int64_t menu_handle = fl_value_get_int(fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response)));
+  return fl_value_new_uint8_list(
+      reinterpret_cast<const uint8_t*>(&menu_handle), sizeof(menu_handle));
 }
+
+static void packed_message_cb(FlBasicMessageChannel* channel,
+                              FlValue* message,
+                              FlBasicMessageChannelResponseHandle* handle,
+                              gpointer user_data) {
+  g_autoptr(FlValue) response =
+      native_context_menu_plugin_handle_packed_message(
+          NATIVE_CONTEXT_MENU_PLUGIN(user_data), message);
+  fl_basic_message_channel_respond(channel, handle, response, nullptr);
+}
+
+#if GLIB_CHECK_VERSION(2, 64, 0)
+// Called when the system runs low on memory. Halves the budgets of the menu
+// cache, twice for a medium warning, & evicts every cached menu but the shown
+// one for a critical warning. The budgets recover as menus are cached again.
+static void on_low_memory_warning(GMemoryMonitor* monitor,
+                                  GMemoryMonitorWarningLevel level,
+                                  gpointer user_data) {
+  NativeContextMenuPlugin* self = NATIVE_CONTEXT_MENU_PLUGIN(user_data);
+  uint32_t levels = 1;
+  if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_CRITICAL) {
+    levels = 64;
+  } else if (level >= G_MEMORY_MONITOR_WARNING_LEVEL_MEDIUM) {
+    levels = 2;
+  }
+  self->menu_cache.add_pressure(levels, self->shown_menu);
+}
+#endif
+
 NativeContextMenuPlugin* native_context_menu_plugin_new(
     FlPluginRegistrar* registrar) {
   NativeContextMenuPlugin* self = NATIVE_CONTEXT_MENU_PLUGIN(
@@ -237,11 +1177,100 @@ NativeContextMenuPlugin* native_context_menu_plugin_new(
                             kChannelName, FL_METHOD_CODEC(codec));
   fl_method_channel_set_method_call_handler(self->channel, method_call_cb,
                                             g_object_ref(self), g_object_unref);
+  g_autoptr(FlBinaryCodec) binary_codec = fl_binary_codec_new();
+  self->packed_channel = fl_basic_message_channel_new(
+      fl_plugin_registrar_get_messenger(registrar), kPackedChannelName,
+      FL_MESSAGE_CODEC(binary_codec));
+  fl_basic_message_channel_set_message_handler(
+      self->packed_channel, packed_message_cb, g_object_ref(self),
+      g_object_unref);
+  self->highlights_channel =
+      fl_event_channel_new(fl_plugin_registrar_get_messenger(registrar),
+                           kHighlightsChannelName, FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(
+      self->highlights_channel, highlights_listen_cb, highlights_cancel_cb,
+      g_object_ref(self), g_object_unref);
+#if GLIB_CHECK_VERSION(2, 64, 0)
+  self->memory_monitor = G_OBJECT(g_memory_monitor_dup_default());
+  self->low_memory_handler_id =
+      g_signal_connect(self->memory_monitor, "low-memory-warning",
+                       G_CALLBACK(on_low_memory_warning), self);
+#endif
   return self;
 }
 
+void native_context_menu_plugin_warm_up(NativeContextMenuPlugin* self) {
+  gint64 start = g_get_monotonic_time();
+  g_autoptr(FlValue) items = fl_value_new_list();
+  FlValue* item = fl_value_new_map();
+  fl_value_set_string_take(item, "id", fl_value_new_int(0));
+  fl_value_set_string_take(item, "title", fl_value_new_string("Warm-up"));
+  fl_value_append_take(items, item);
+  std::unique_ptr<Menu> menu = build_menu(items, &self->menu_callbacks,
+                                          &self->widget_pool, nullptr);
+  // Realizing the hidden menu creates its popup window & loads the theme,
+  // measuring it lays out its title with the menu font.
+  gtk_widget_realize(menu->widget);
+  GtkRequisition size;
+  gtk_widget_get_preferred_size(menu->widget, nullptr, &size);
+  // The item is pooled, the next menu reuses it.
+  menu.reset();
+  self->stats.warm_up.record(g_get_monotonic_time() - start);
+}
+
+// Warms up a plugin instance from the main loop, at low priority.
+static gboolean on_warm_up(gpointer data) {
+  native_context_menu_plugin_warm_up(NATIVE_CONTEXT_MENU_PLUGIN(data));
+  return G_SOURCE_REMOVE;
+}
+
+// Called on the first frame of the view, before it is painted.
+static gboolean on_first_frame(GtkWidget* widget, GdkFrameClock* clock,
+                               gpointer data) {
+  g_idle_add_full(G_PRIORITY_LOW, on_warm_up, g_object_ref(data),
+                  g_object_unref);
+  return G_SOURCE_REMOVE;
+}
+
+// Schedules `native_context_menu_plugin_warm_up`, so that the first menu shown
+// does not pay for loading the menu theme & fonts. It runs from a low priority
+// idle source after the first frame of the view is painted, i.e. neither
+// during registration nor before the app shows up.
+static void schedule_warm_up(NativeContextMenuPlugin* self) {
+  FlView* view = fl_plugin_registrar_get_view(self->registrar);
+  if (view == nullptr) {
+    g_idle_add_full(G_PRIORITY_LOW, on_warm_up, g_object_ref(self),
+                    g_object_unref);
+    return;
+  }
+  gtk_widget_add_tick_callback(GTK_WIDGET(view), on_first_frame,
+                               g_object_ref(self), g_object_unref);
+}
+
 void native_context_menu_plugin_register_with_registrar(
     FlPluginRegistrar* registrar) {
-  g_plugin = native_context_menu_plugin_new(registrar);
-  g_object_unref(g_plugin);
+  // Each registrar, i.e. each engine, gets its own instance, which is kept
+  // alive by the handlers of its channels.
+  NativeContextMenuPlugin* plugin = native_context_menu_plugin_new(registrar);
+  schedule_warm_up(plugin);
+  g_object_unref(plugin);
+}
+
+uint8_t* native_context_menu_buffer_new(int64_t size) {
+  if (size <= 0) return nullptr;
+  auto buffer = static_cast<uint8_t*>(g_try_malloc(static_cast<gsize>(size)));
+  if (buffer == nullptr) return nullptr;
+  g_mutex_lock(&live_buffers_mutex);
+  get_live_buffers()[reinterpret_cast<uintptr_t>(buffer)] =
+      static_cast<size_t>(size);
+  g_mutex_unlock(&live_buffers_mutex);
+  return buffer;
+}
+
+void native_context_menu_buffer_free(uint8_t* buffer) {
+  if (buffer == nullptr) return;
+  g_mutex_lock(&live_buffers_mutex);
+  get_live_buffers().erase(reinterpret_cast<uintptr_t>(buffer));
+  g_mutex_unlock(&live_buffers_mutex);
+  g_free(buffer);
 }
@@ -0,0 +1,41 @@
+#ifndef FLUTTER_PLUGIN_NATIVE_CONTEXT_MENU_PLUGIN_PRIVATE_H_
+#define FLUTTER_PLUGIN_NATIVE_CONTEXT_MENU_PLUGIN_PRIVATE_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include "include/native_context_menu/native_context_menu_plugin.h"
+
+// Plugin internals exposed to the unit tests.
+
+// Creates the plugin instance of `registrar`. Every instance has its own
+// channels, menus & caches, so that several engines in a process (e.g. one
+// per window) do not share any state.
+NativeContextMenuPlugin* native_context_menu_plugin_new(
+    FlPluginRegistrar* registrar);
+
+// Handles the method call `method` with `arguments` & returns its response,
+// which the caller owns.
+FlMethodResponse* native_context_menu_plugin_handle_method(
+    NativeContextMenuPlugin* self, const gchar* method, FlValue* arguments);
+
+// Handles the `message` received on the packed channel, registering the menu
+// as `registerMenu` does, & returns the reply, which the caller owns.
+FlValue* native_context_menu_plugin_handle_packed_message(
+    NativeContextMenuPlugin* self, FlValue* message);
+
+// Returns the `GtkMenu` shown by `self` whose outcome is not reported yet, or
+// `nullptr` if there is none.
+GtkWidget* native_context_menu_plugin_get_shown_menu(
+    NativeContextMenuPlugin* self);
+
+// Returns the `GtkMenuItem` of the item `id` of the shown menu, creating the
+// widgets of the sub-menus holding it if they were not opened, or `nullptr`
+// if no menu is shown or it has no such item.
+GtkWidget* native_context_menu_plugin_get_shown_item(
+    NativeContextMenuPlugin* self, int64_t id);
+
+// Builds & realizes a hidden menu, so that GTK loads the menu theme & fonts
+// before the first menu is shown. Scheduled once the plugin is registered.
+void native_context_menu_plugin_warm_up(NativeContextMenuPlugin* self);
+
+#endif  // FLUTTER_PLUGIN_NATIVE_CONTEXT_MENU_PLUGIN_PRIVATE_H_
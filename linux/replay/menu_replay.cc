@@ -0,0 +1,111 @@
+// Replays a trace recorded by the Linux plugin with the `traceFile` option,
+// feeding its calls back into a plugin instance, & prints the latency of each
+// phase reported by `getStats`, e.g. to compare plugin versions on the menus
+// users actually show. Needs a display, run it under Xvfb:
+//
+//   xvfb-run --auto-servernum native_context_menu_replay [--realtime] TRACE
+//
+// Calls are replayed as fast as possible, or at their recorded times with
+// `--realtime`. Each recorded selection activates the same item of the shown
+// menu & other outcomes dismiss it. Sub-items built on demand are never
+// received, since no Dart code runs.
+
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "menu_replayer.h"
+#include "menu_trace.h"
+#include "native_context_menu_plugin_private.h"
+
+namespace {
+
+// Runs the pending events, e.g. to map & paint a shown menu.
+void run_pending_events() {
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+}
+
+// Runs the events until `time`, on the monotonic clock.
+void run_events_until(gint64 time) {
+  for (gint64 now = g_get_monotonic_time(); now < time;
+       now = g_get_monotonic_time()) {
+    if (!g_main_context_iteration(nullptr, FALSE)) {
+      g_usleep(std::min<gint64>(time - now, 1000));
+    }
+  }
+}
+
+// Prints the stats groups of `plugin`, one line per group.
+void print_stats(NativeContextMenuPlugin* plugin) {
+  g_autoptr(FlMethodResponse) response =
+      native_context_menu_plugin_handle_method(plugin, "getStats", nullptr);
+  FlValue* stats = fl_method_success_response_get_result(
+      FL_METHOD_SUCCESS_RESPONSE(response));
+  for (size_t i = 0; i < fl_value_get_length(stats); i++) {
+    printf("%-12s", fl_value_get_string(fl_value_get_map_key(stats, i)));
+    FlValue* group = fl_value_get_map_value(stats, i);
+    for (size_t j = 0; j < fl_value_get_length(group); j++) {
+      printf(" %s=%" G_GINT64_FORMAT,
+             fl_value_get_string(fl_value_get_map_key(group, j)),
+             fl_value_get_int(fl_value_get_map_value(group, j)));
+    }
+    printf("\n");
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  gtk_init(&argc, &argv);
+  bool realtime = argc == 3 && strcmp(argv[1], "--realtime") == 0;
+  if (argc != 2 && !realtime) {
+    fprintf(stderr, "Usage: %s [--realtime] TRACE\n", argv[0]);
+    return 2;
+  }
+  MenuTraceReader reader;
+  if (!reader.open(argv[argc - 1])) {
+    fprintf(stderr, "%s is not a menu trace.\n", argv[argc - 1]);
+    return 1;
+  }
+
+  g_autoptr(FlDartProject) project = fl_dart_project_new();
+  g_autoptr(FlEngine) engine = fl_engine_new_headless(project);
+  g_autoptr(FlPluginRegistrar) registrar =
+      fl_plugin_registry_get_registrar_for_plugin(FL_PLUGIN_REGISTRY(engine),
+                                                  "NativeContextMenuPlugin");
+  NativeContextMenuPlugin* plugin = native_context_menu_plugin_new(registrar);
+
+  MenuReplayer replayer(plugin);
+  int64_t calls = 0;
+  int64_t outcomes = 0;
+  gint64 start = g_get_monotonic_time();
+  for (FlValue* record = reader.read(); record != nullptr;
+       record = reader.read()) {
+    int64_t type = fl_value_get_int(fl_value_get_list_value(record, 0));
+    if (realtime) {
+      run_events_until(start +
+                       fl_value_get_int(fl_value_get_list_value(record, 1)));
+    }
+    if (type == kMenuTraceCall) {
+      FlMethodResponse* response = replayer.replay_call(record);
+      if (response != nullptr) g_object_unref(response);
+      calls++;
+    } else if (type == kMenuTraceOutcome) {
+      replayer.replay_outcome(record);
+      outcomes++;
+    }
+    run_pending_events();
+    fl_value_unref(record);
+  }
+
+  printf("Replayed %" G_GINT64_FORMAT " calls & %" G_GINT64_FORMAT
+         " outcomes in %" G_GINT64_FORMAT " ms\n",
+         calls, outcomes, (g_get_monotonic_time() - start) / 1000);
+  print_stats(plugin);
+  g_object_unref(plugin);
+  return 0;
+}
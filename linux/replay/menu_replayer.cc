@@ -0,0 +1,99 @@
+#include "menu_replayer.h"
+
+#include <gtk/gtk.h>
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// Returns the recorded `arguments` of a call as replayed: the `handle` of a
+// recorded menu is mapped to the replayed one, & a recorded packed menu is
+// written into a native buffer, which is added to `buffers`.
+FlValue* get_replayed_arguments(FlValue* arguments,
+                                const std::map<int64_t, int64_t>& handles,
+                                std::vector<uint8_t*>* buffers) {
+  if (fl_value_get_type(arguments) != FL_VALUE_TYPE_MAP) {
+    return fl_value_ref(arguments);
+  }
+  FlValue* replayed = fl_value_new_map();
+  for (size_t i = 0; i < fl_value_get_length(arguments); i++) {
+    FlValue* key = fl_value_get_map_key(arguments, i);
+    FlValue* value = fl_value_get_map_value(arguments, i);
+    const gchar* name = fl_value_get_type(key) == FL_VALUE_TYPE_STRING
+                            ? fl_value_get_string(key)
+                            : "";
+    if (strcmp(name, "handle") == 0 &&
+        fl_value_get_type(value) == FL_VALUE_TYPE_INT) {
+      auto it = handles.find(fl_value_get_int(value));
+      fl_value_set_string_take(
+          replayed, "handle",
+          fl_value_new_int(it != handles.end() ? it->second : -1));
+    } else if (strcmp(name, "bufferData") == 0 &&
+               fl_value_get_type(value) == FL_VALUE_TYPE_UINT8_LIST) {
+      size_t size = fl_value_get_length(value);
+      uint8_t* buffer = native_context_menu_buffer_new(size);
+      if (buffer == nullptr) continue;
+      memcpy(buffer, fl_value_get_uint8_list(value), size);
+      buffers->push_back(buffer);
+      fl_value_set_string_take(
+          replayed, "buffer",
+          fl_value_new_int(reinterpret_cast<intptr_t>(buffer)));
+      fl_value_set_string_take(replayed, "bufferSize",
+                               fl_value_new_int(size));
+    } else {
+      fl_value_set(replayed, key, value);
+    }
+  }
+  return replayed;
+}
+
+}  // namespace
+
+FlMethodResponse* MenuReplayer::replay_call(FlValue* call) {
+  if (fl_value_get_length(call) < 6 ||
+      fl_value_get_type(fl_value_get_list_value(call, 3)) !=
+          FL_VALUE_TYPE_STRING) {
+    return nullptr;
+  }
+  const gchar* method = fl_value_get_string(fl_value_get_list_value(call, 3));
+  FlValue* recorded_result = fl_value_get_list_value(call, 5);
+  std::vector<uint8_t*> buffers;
+  g_autoptr(FlValue) arguments = get_replayed_arguments(
+      fl_value_get_list_value(call, 4), handles, &buffers);
+  FlMethodResponse* response =
+      native_context_menu_plugin_handle_method(plugin, method, arguments);
+  for (uint8_t* buffer : buffers) native_context_menu_buffer_free(buffer);
+
+  if (strcmp(method, "registerMenu") == 0 &&
+      fl_value_get_type(recorded_result) == FL_VALUE_TYPE_INT &&
+      FL_IS_METHOD_SUCCESS_RESPONSE(response)) {
+    FlValue* result = fl_method_success_response_get_result(
+        FL_METHOD_SUCCESS_RESPONSE(response));
+    handles[fl_value_get_int(recorded_result)] = fl_value_get_int(result);
+  }
+  return response;
+}
+
+void MenuReplayer::replay_outcome(FlValue* outcome) {
+  GtkWidget* menu = native_context_menu_plugin_get_shown_menu(plugin);
+  if (menu == nullptr) return;
+  FlValue* value = fl_value_get_length(outcome) >= 3
+                       ? fl_value_get_list_value(outcome, 2)
+                       : nullptr;
+  FlValue* id = value != nullptr &&
+                        fl_value_get_type(value) == FL_VALUE_TYPE_MAP
+                    ? fl_value_lookup_string(value, "id")
+                    : nullptr;
+  GtkWidget* item =
+      id != nullptr && fl_value_get_type(id) == FL_VALUE_TYPE_INT
+          ? native_context_menu_plugin_get_shown_item(plugin,
+                                                      fl_value_get_int(id))
+          : nullptr;
+  if (item != nullptr) {
+    gtk_menu_shell_activate_item(GTK_MENU_SHELL(gtk_widget_get_parent(item)),
+                                 item, TRUE);
+  }
+  // Also closes the top-level menu of an item in a sub-menu never opened.
+  gtk_menu_shell_deactivate(GTK_MENU_SHELL(menu));
+}
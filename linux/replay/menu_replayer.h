@@ -0,0 +1,34 @@
+#ifndef NATIVE_CONTEXT_MENU_MENU_REPLAYER_H_
+#define NATIVE_CONTEXT_MENU_MENU_REPLAYER_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <map>
+
+#include "native_context_menu_plugin_private.h"
+
+// Feeds the calls of a trace read by `MenuTraceReader` back into `plugin`.
+// Menus registered by the recorded process, including packed ones, are
+// registered again, & the handles passed to later calls mapped to theirs.
+struct MenuReplayer {
+  NativeContextMenuPlugin* plugin;
+  // Handles of the menus registered by the recorded process, mapped to those
+  // registered by the replay.
+  std::map<int64_t, int64_t> handles = {};
+
+  explicit MenuReplayer(NativeContextMenuPlugin* plugin) : plugin(plugin) {}
+  MenuReplayer(const MenuReplayer&) = delete;
+  MenuReplayer& operator=(const MenuReplayer&) = delete;
+
+  // Replays the recorded `call` & returns its response, which the caller
+  // owns, or `nullptr` if the record is malformed.
+  FlMethodResponse* replay_call(FlValue* call);
+
+  // Replays the recorded `outcome` of the shown menu: a selected item is
+  // activated, which reports its selection, & the menu is dismissed
+  // otherwise, or if the item is missing from the replayed menu.
+  void replay_outcome(FlValue* outcome);
+};
+
+#endif  // NATIVE_CONTEXT_MENU_MENU_REPLAYER_H_
@@ -0,0 +1,75 @@
+#include <flutter_linux/flutter_linux.h>
+#include <gtest/gtest.h>
+#include <gtk/gtk.h>
+
+#include "icon_cache.h"
+#include "menu.h"
+
+namespace {
+
+// Menu item handlers, nothing is clicked by these tests.
+void ignore_signal(GtkWidget*, gpointer) {}
+const MenuCallbacks kCallbacks = {ignore_signal, ignore_signal, ignore_signal,
+                                  ignore_signal, ignore_signal, nullptr};
+
+// Returns a new item map showing the image file at `icon_path`.
+FlValue* make_icon_item(int64_t id, const gchar* icon_path) {
+  FlValue* item = fl_value_new_map();
+  fl_value_set_string_take(item, "id", fl_value_new_int(id));
+  fl_value_set_string_take(item, "title", fl_value_new_string("Item"));
+  fl_value_set_string_take(item, "iconPath", fl_value_new_string(icon_path));
+  return item;
+}
+
+// Returns a new `updateMenu` patch map of `op` on the item `id`.
+FlValue* make_patch(const gchar* op, int64_t id) {
+  FlValue* patch = fl_value_new_map();
+  fl_value_set_string_take(patch, "op", fl_value_new_string(op));
+  fl_value_set_string_take(patch, "id", fl_value_new_int(id));
+  return patch;
+}
+
+TEST(IconCacheTest, EvictsFailedDecodes) {
+  IconCache cache;
+  cache.set_budget(4 * kIconEntrySize);
+  // Icons which failed to decode are cached without pixels.
+  for (uint64_t hash = 0; hash < 100; hash++) {
+    cache.insert({hash, kMenuIconSize}, nullptr);
+  }
+  EXPECT_EQ(cache.entries.size(), 4u);
+  EXPECT_EQ(cache.size, 4 * kIconEntrySize);
+  EXPECT_EQ(cache.entries.front().key.hash, 99u);
+}
+
+TEST(IconCacheTest, IgnoresIconsOfReusedSlots) {
+  gtk_init(nullptr, nullptr);
+  IconCache cache;
+  g_autoptr(FlValue) items = fl_value_new_list();
+  fl_value_append_take(items, make_icon_item(1, "/nonexistent/old.png"));
+  auto menu = build_menu(items, &kCallbacks, nullptr, &cache);
+  ASSERT_NE(menu, nullptr);
+  NodeIndex node = menu->find(1);
+  uint64_t old_hash = menu->icons[menu->nodes[node].icon].hash;
+
+  // The item is removed & inserted again under the same id & slot, with
+  // another icon, while the old one is still being decoded.
+  g_autoptr(FlValue) remove = make_patch("remove", 1);
+  ASSERT_EQ(apply_menu_patch(*menu, remove), nullptr);
+  g_autoptr(FlValue) insert = make_patch("insert", 1);
+  fl_value_set_string_take(insert, "item",
+                           make_icon_item(1, "/nonexistent/new.png"));
+  ASSERT_EQ(apply_menu_patch(*menu, insert), nullptr);
+  ASSERT_EQ(menu->find(1), node);
+  uint64_t new_hash = menu->icons[menu->nodes[node].icon].hash;
+
+  g_autoptr(GdkPixbuf) pixbuf =
+      gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, kMenuIconSize,
+                     kMenuIconSize);
+  GtkImage* image = GTK_IMAGE(menu->node_widgets[node].image);
+  set_menu_item_icon(*menu, node, 1, old_hash, pixbuf);
+  EXPECT_EQ(gtk_image_get_pixbuf(image), nullptr);
+  set_menu_item_icon(*menu, node, 1, new_hash, pixbuf);
+  EXPECT_EQ(gtk_image_get_pixbuf(image), pixbuf);
+}
+
+}  // namespace
@@ -0,0 +1,63 @@
+#include <flutter_linux/flutter_linux.h>
+#include <gtest/gtest.h>
+#include <gtk/gtk.h>
+
+#include <memory>
+
+#include "menu.h"
+#include "menu_cache.h"
+
+namespace {
+
+// Menu item handlers, nothing is clicked by these tests.
+void ignore_signal(GtkWidget*, gpointer) {}
+const MenuCallbacks kCallbacks = {ignore_signal, ignore_signal, ignore_signal,
+                                  ignore_signal, ignore_signal, nullptr};
+
+// Check value of the menus built by `make_menu`, see `get_menu_cache_check`.
+constexpr uint64_t kCheck = uint64_t{1} << 32 | 4;
+
+// Builds a menu of a single item.
+std::unique_ptr<Menu> make_menu() {
+  g_autoptr(FlValue) items = fl_value_new_list();
+  FlValue* item = fl_value_new_map();
+  fl_value_set_string_take(item, "id", fl_value_new_int(0));
+  fl_value_set_string_take(item, "title", fl_value_new_string("Item"));
+  fl_value_append_take(items, item);
+  return build_menu(items, &kCallbacks, nullptr, nullptr);
+}
+
+TEST(MenuCacheTest, RelievesPressureAsMenusAreCached) {
+  gtk_init(nullptr, nullptr);
+  MenuCache cache;
+  cache.add_pressure(2, nullptr);
+  cache.insert(1, make_menu());
+  EXPECT_EQ(cache.pressure, 1u);
+  cache.insert(2, make_menu());
+  EXPECT_EQ(cache.pressure, 0u);
+  EXPECT_TRUE(cache.contains(1, kCheck));
+  // A menu of another shape under the same hash is not found.
+  EXPECT_FALSE(cache.contains(1, kCheck + 1));
+}
+
+TEST(MenuCacheTest, RestoresBudgetsOnceWarningsStop) {
+  gtk_init(nullptr, nullptr);
+  MenuCache cache;
+  cache.insert(1, make_menu());
+  // A critical warning evicts every menu but the shown one, & the next shows
+  // are not kept while warnings go on.
+  cache.add_pressure(64, cache.lookup(1));
+  EXPECT_TRUE(cache.contains(1, kCheck));
+  cache.insert(2, make_menu());
+  EXPECT_FALSE(cache.contains(1, kCheck));
+
+  // No warning is received for a while.
+  cache.pressure_time -= kMenuCachePressureTimeout;
+  cache.insert(1, make_menu());
+  cache.insert(2, make_menu());
+  EXPECT_EQ(cache.pressure, 0u);
+  EXPECT_NE(cache.lookup(1), nullptr);
+  EXPECT_EQ(cache.hits, 2u);
+}
+
+}  // namespace
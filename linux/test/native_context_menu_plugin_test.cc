@@ -0,0 +1,764 @@
+#include <flutter_linux/flutter_linux.h>
+#include <gtest/gtest.h>
+#include <gtk/gtk.h>
+
+#include <unistd.h>
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dart_api_dl.h"
+#include "menu_trace.h"
+#include "native_context_menu_plugin_private.h"
+#include "packed_menu.h"
+#include "replay/menu_replayer.h"
+
+namespace {
+
+// Show & dismiss cycles of the soak test, the first `kSoakWarmUpCycles` of
+// which fill the widget pool before the baseline is taken.
+constexpr int kSoakCycles = 100000;
+constexpr int kSoakWarmUpCycles = 1000;
+// Growth of the resident set allowed over the soak test, for allocator noise.
+constexpr int64_t kSoakRssSlack = 4 * 1024 * 1024;
+
+// Show & dismiss & show & select cycles of the outcome test, spread over the
+// engines.
+constexpr int kOutcomeCycles = 100000;
+
+// Port & message of the last post through `fake_post_c_object`.
+int64_t posted_port = 0;
+FlValue* posted_message = nullptr;
+
+// Returns the value of a posted `object`, arrays as lists.
+FlValue* read_c_object(Dart_CObject* object) {
+  switch (object->type) {
+    case Dart_CObject_kBool:
+      return fl_value_new_bool(object->value.as_bool);
+    case Dart_CObject_kInt64:
+      return fl_value_new_int(object->value.as_int64);
+    case Dart_CObject_kDouble:
+      return fl_value_new_float(object->value.as_double);
+    case Dart_CObject_kString:
+      return fl_value_new_string(object->value.as_string);
+    case Dart_CObject_kArray: {
+      FlValue* list = fl_value_new_list();
+      for (intptr_t i = 0; i < object->value.as_array.length; i++) {
+        fl_value_append_take(list,
+                             read_c_object(object->value.as_array.values[i]));
+      }
+      return list;
+    }
+    default:
+      return fl_value_new_null();
+  }
+}
+
+// Stands for `Dart_PostCObject`, keeps a copy of the posted message.
+bool fake_post_c_object(Dart_Port_DL port, Dart_CObject* message) {
+  posted_port = port;
+  g_clear_pointer(&posted_message, fl_value_unref);
+  posted_message = read_c_object(message);
+  return true;
+}
+
+// Returns the value of `key` in a map posted as a list of its keys & values,
+// or `nullptr` if it has none.
+FlValue* lookup_posted(FlValue* pairs, const gchar* key) {
+  for (size_t i = 0; i + 1 < fl_value_get_length(pairs); i += 2) {
+    FlValue* name = fl_value_get_list_value(pairs, i);
+    if (fl_value_get_type(name) == FL_VALUE_TYPE_STRING &&
+        strcmp(fl_value_get_string(name), key) == 0) {
+      return fl_value_get_list_value(pairs, i + 1);
+    }
+  }
+  return nullptr;
+}
+
+// Outcome of each port & request posted through `record_outcome`: the id of
+// the selected item, or -1 if the menu was dismissed. Outcomes posted again
+// for the same show are counted in `duplicate_outcomes`.
+std::map<std::pair<int64_t, int64_t>, int64_t> outcomes;
+int64_t duplicate_outcomes = 0;
+
+// Stands for `Dart_PostCObject`, records the outcome posted for a show.
+bool record_outcome(Dart_Port_DL port, Dart_CObject* message) {
+  g_autoptr(FlValue) outcome = read_c_object(message);
+  FlValue* request = lookup_posted(outcome, "request");
+  FlValue* id = lookup_posted(outcome, "id");
+  auto inserted = outcomes.emplace(
+      std::make_pair(port, request != nullptr ? fl_value_get_int(request) : -1),
+      id != nullptr ? fl_value_get_int(id) : -1);
+  if (!inserted.second) duplicate_outcomes++;
+  return true;
+}
+
+// Returns the resident set size of the process in bytes.
+int64_t get_rss() {
+  FILE* statm = fopen("/proc/self/statm", "r");
+  long size = 0, resident = 0;
+  if (statm != nullptr) {
+    if (fscanf(statm, "%ld %ld", &size, &resident) != 2) resident = 0;
+    fclose(statm);
+  }
+  return static_cast<int64_t>(resident) * sysconf(_SC_PAGESIZE);
+}
+
+// Several engines in one process, e.g. one per window, each registering the
+// plugin with its own registrar.
+class NativeContextMenuPluginTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    gtk_init(nullptr, nullptr);
+    for (size_t i = 0; i < engines.size(); i++) {
+      g_autoptr(FlDartProject) project = fl_dart_project_new();
+      engines[i] = fl_engine_new_headless(project);
+      g_autoptr(FlPluginRegistrar) registrar =
+          fl_plugin_registry_get_registrar_for_plugin(
+              FL_PLUGIN_REGISTRY(engines[i]), "NativeContextMenuPlugin");
+      plugins[i] = native_context_menu_plugin_new(registrar);
+    }
+  }
+
+  void TearDown() override {
+    for (size_t i = 0; i < engines.size(); i++) {
+      g_clear_object(&plugins[i]);
+      g_clear_object(&engines[i]);
+    }
+  }
+
+  // Calls `method` on `plugin` & returns its response.
+  FlMethodResponse* call(NativeContextMenuPlugin* plugin, const gchar* method,
+                         FlValue* arguments) {
+    return native_context_menu_plugin_handle_method(plugin, method, arguments);
+  }
+
+  // Registers a menu of `count` items on `plugin` & returns its handle.
+  int64_t register_menu(NativeContextMenuPlugin* plugin, int64_t count) {
+    g_autoptr(FlValue) items = fl_value_new_list();
+    for (int64_t id = 0; id < count; id++) {
+      FlValue* item = fl_value_new_map();
+      fl_value_set_string_take(item, "id", fl_value_new_int(id));
+      fl_value_set_string_take(item, "title", fl_value_new_string("Item"));
+      fl_value_append_take(items, item);
+    }
+    g_autoptr(FlValue) arguments = fl_value_new_map();
+    fl_value_set_string(arguments, "items", items);
+    g_autoptr(FlMethodResponse) response =
+        call(plugin, "registerMenu", arguments);
+    FlValue* result = fl_method_response_get_result(response, nullptr);
+    EXPECT_NE(result, nullptr);
+    return result != nullptr ? fl_value_get_int(result) : -1;
+  }
+
+  // Returns the `counter` of the stats `group` of `plugin`.
+  int64_t get_stat(NativeContextMenuPlugin* plugin, const gchar* group,
+                   const gchar* counter) {
+    g_autoptr(FlMethodResponse) response = call(plugin, "getStats", nullptr);
+    FlValue* stats = fl_method_response_get_result(response, nullptr);
+    return fl_value_get_int(fl_value_lookup_string(
+        fl_value_lookup_string(stats, group), counter));
+  }
+
+  // Returns the `live` stats group of `plugin`, which debug builds only have.
+  // The returned map is owned by `stats`.
+  FlValue* get_live_stats(NativeContextMenuPlugin* plugin, FlValue** stats) {
+    g_autoptr(FlMethodResponse) response = call(plugin, "getStats", nullptr);
+    *stats = fl_value_ref(fl_method_response_get_result(response, nullptr));
+    return fl_value_lookup_string(*stats, "live");
+  }
+
+  // Shows a menu of items with a sub-menu on `plugin` & returns its widget.
+  GtkWidget* show_menu(NativeContextMenuPlugin* plugin, int64_t request,
+                       int64_t port = 0) {
+    g_autoptr(FlValue) items = fl_value_new_list();
+    FlValue* sub_items = fl_value_new_list();
+    for (int64_t id = 0; id < 4; id++) {
+      FlValue* item = fl_value_new_map();
+      fl_value_set_string_take(item, "id", fl_value_new_int(id));
+      fl_value_set_string_take(item, "title", fl_value_new_string("Item"));
+      fl_value_append_take(id < 2 ? items : sub_items, item);
+    }
+    FlValue* parent = fl_value_new_map();
+    fl_value_set_string_take(parent, "id", fl_value_new_int(4));
+    fl_value_set_string_take(parent, "title", fl_value_new_string("More"));
+    fl_value_set_string_take(parent, "items", sub_items);
+    fl_value_append_take(items, parent);
+    g_autoptr(FlValue) arguments = fl_value_new_map();
+    fl_value_set_string(arguments, "items", items);
+    fl_value_set_string_take(arguments, "request", fl_value_new_int(request));
+    if (port != 0) {
+      fl_value_set_string_take(arguments, "port", fl_value_new_int(port));
+    }
+    g_autoptr(FlMethodResponse) shown = call(plugin, "showMenu", arguments);
+    EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(shown));
+    return native_context_menu_plugin_get_shown_menu(plugin);
+  }
+
+  // Shows a menu on `plugin` as `show_menu` & dismisses it, then runs the main
+  // loop until its outcome is reported & it is released.
+  void show_and_dismiss(NativeContextMenuPlugin* plugin, int64_t request,
+                        int64_t port = 0) {
+    GtkWidget* menu = show_menu(plugin, request, port);
+    ASSERT_NE(menu, nullptr);
+    gtk_menu_shell_deactivate(GTK_MENU_SHELL(menu));
+    while (g_main_context_iteration(nullptr, FALSE)) {
+    }
+    EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugin), nullptr);
+  }
+
+  // Shows a menu on `plugin` as `show_menu` & selects its first item as GTK
+  // does on a click, then runs the main loop until its outcome is reported.
+  void show_and_select(NativeContextMenuPlugin* plugin, int64_t request,
+                       int64_t port = 0) {
+    GtkWidget* menu = show_menu(plugin, request, port);
+    ASSERT_NE(menu, nullptr);
+    g_autoptr(GList) items = gtk_container_get_children(GTK_CONTAINER(menu));
+    ASSERT_NE(items, nullptr);
+    // Deactivates the menu, activates the item & emits "selection-done".
+    gtk_menu_shell_activate_item(GTK_MENU_SHELL(menu),
+                                 GTK_WIDGET(items->data), TRUE);
+    while (g_main_context_iteration(nullptr, FALSE)) {
+    }
+    EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugin), nullptr);
+  }
+
+  std::array<FlEngine*, 2> engines = {};
+  std::array<NativeContextMenuPlugin*, 2> plugins = {};
+};
+
+TEST_F(NativeContextMenuPluginTest, NumbersHandlesPerInstance) {
+  EXPECT_EQ(register_menu(plugins[0], 3), 1);
+  EXPECT_EQ(register_menu(plugins[0], 3), 2);
+  EXPECT_EQ(register_menu(plugins[1], 3), 1);
+  EXPECT_EQ(get_stat(plugins[0], "build", "count"), 2);
+  EXPECT_EQ(get_stat(plugins[1], "build", "count"), 1);
+}
+
+TEST_F(NativeContextMenuPluginTest, KeepsMenusOfEachInstance) {
+  int64_t handle = register_menu(plugins[0], 3);
+  ASSERT_EQ(register_menu(plugins[1], 3), handle);
+
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string_take(arguments, "handle", fl_value_new_int(handle));
+  g_autoptr(FlMethodResponse) disposed =
+      call(plugins[0], "disposeMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(disposed));
+  // Only the widgets of the disposed menu are pooled, by its own instance.
+  EXPECT_EQ(get_stat(plugins[0], "widgetPool", "size"), 3);
+  EXPECT_EQ(get_stat(plugins[1], "widgetPool", "size"), 0);
+
+  fl_value_set_string_take(arguments, "patches", fl_value_new_list());
+  g_autoptr(FlMethodResponse) missing =
+      call(plugins[0], "updateMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(missing));
+  g_autoptr(FlMethodResponse) updated =
+      call(plugins[1], "updateMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(updated));
+}
+
+TEST_F(NativeContextMenuPluginTest, ConfiguresEachInstance) {
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string_take(arguments, "widgetPoolSize", fl_value_new_int(0));
+  g_autoptr(FlMethodResponse) configured =
+      call(plugins[0], "configure", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(configured));
+
+  for (auto plugin : plugins) {
+    g_autoptr(FlValue) dispose = fl_value_new_map();
+    fl_value_set_string_take(
+        dispose, "handle", fl_value_new_int(register_menu(plugin, 3)));
+    g_object_unref(call(plugin, "disposeMenu", dispose));
+  }
+  EXPECT_EQ(get_stat(plugins[0], "widgetPool", "size"), 0);
+  EXPECT_EQ(get_stat(plugins[1], "widgetPool", "size"), 3);
+}
+
+TEST_F(NativeContextMenuPluginTest, FiltersPatchedItemsWithQuery) {
+  g_autoptr(FlValue) items = fl_value_new_list();
+  const char* titles[] = {"Copy", "Paste"};
+  for (int64_t id = 0; id < 2; id++) {
+    FlValue* item = fl_value_new_map();
+    fl_value_set_string_take(item, "id", fl_value_new_int(id));
+    fl_value_set_string_take(item, "title", fl_value_new_string(titles[id]));
+    fl_value_append_take(items, item);
+  }
+  g_autoptr(FlValue) registration = fl_value_new_map();
+  fl_value_set_string(registration, "items", items);
+  g_autoptr(FlMethodResponse) registered =
+      call(plugins[0], "registerMenu", registration);
+  FlValue* handle = fl_method_response_get_result(registered, nullptr);
+  ASSERT_NE(handle, nullptr);
+  g_autoptr(FlValue) show = fl_value_new_map();
+  fl_value_set_string(show, "handle", handle);
+  fl_value_set_string_take(show, "request", fl_value_new_int(1));
+  fl_value_set_string_take(show, "searchable", fl_value_new_bool(TRUE));
+  g_autoptr(FlMethodResponse) shown = call(plugins[0], "showMenu", show);
+  GtkWidget* menu = native_context_menu_plugin_get_shown_menu(plugins[0]);
+  ASSERT_NE(menu, nullptr);
+  GdkEvent* key = gdk_event_new(GDK_KEY_PRESS);
+  key->key.window = GDK_WINDOW(g_object_ref(gtk_widget_get_window(menu)));
+  key->key.keyval = GDK_KEY_p;
+  gtk_widget_event(menu, key);
+  gdk_event_free(key);
+
+  // One inserted item matches the query "p", the other does not.
+  g_autoptr(FlValue) patches = fl_value_new_list();
+  const char* inserted[] = {"Print", "Cut"};
+  for (int64_t id = 2; id < 4; id++) {
+    FlValue* item = fl_value_new_map();
+    fl_value_set_string_take(item, "id", fl_value_new_int(id));
+    fl_value_set_string_take(item, "title",
+                             fl_value_new_string(inserted[id - 2]));
+    FlValue* patch = fl_value_new_map();
+    fl_value_set_string_take(patch, "op", fl_value_new_string("insert"));
+    fl_value_set_string_take(patch, "index", fl_value_new_int(id));
+    fl_value_set_string_take(patch, "item", item);
+    fl_value_append_take(patches, patch);
+  }
+  g_autoptr(FlValue) update = fl_value_new_map();
+  fl_value_set_string(update, "handle", handle);
+  fl_value_set_string(update, "patches", patches);
+  g_autoptr(FlMethodResponse) updated = call(plugins[0], "updateMenu", update);
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(updated));
+
+  std::map<std::string, bool> visible;
+  g_autoptr(GList) children = gtk_container_get_children(GTK_CONTAINER(menu));
+  for (GList* it = children; it != nullptr; it = it->next) {
+    const gchar* label = gtk_menu_item_get_label(GTK_MENU_ITEM(it->data));
+    if (label != nullptr && strcmp(label, "p") != 0) {
+      visible[label] = gtk_widget_get_visible(GTK_WIDGET(it->data));
+    }
+  }
+  EXPECT_EQ(visible, (std::map<std::string, bool>({{"Copy", false},
+                                                   {"Cut", false},
+                                                   {"Paste", true},
+                                                   {"Print", true}})));
+  gtk_menu_shell_deactivate(GTK_MENU_SHELL(menu));
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+}
+
+TEST_F(NativeContextMenuPluginTest, KeepsOpenMenuOnInvalidShow) {
+  GtkWidget* menu = show_menu(plugins[0], 1);
+  ASSERT_NE(menu, nullptr);
+
+  g_autoptr(FlValue) unknown = fl_value_new_map();
+  fl_value_set_string_take(unknown, "handle", fl_value_new_int(42));
+  fl_value_set_string_take(unknown, "request", fl_value_new_int(2));
+  g_autoptr(FlMethodResponse) unknown_shown =
+      call(plugins[0], "showMenu", unknown);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(unknown_shown));
+  g_autoptr(FlValue) malformed = fl_value_new_map();
+  fl_value_set_string_take(malformed, "items", fl_value_new_string("Item"));
+  fl_value_set_string_take(malformed, "request", fl_value_new_int(3));
+  g_autoptr(FlMethodResponse) malformed_shown =
+      call(plugins[0], "showMenu", malformed);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(malformed_shown));
+  // Neither call supersedes the open menu.
+  EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugins[0]), menu);
+  EXPECT_TRUE(gtk_widget_get_visible(menu));
+
+  gtk_menu_shell_deactivate(GTK_MENU_SHELL(menu));
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+  EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugins[0]), nullptr);
+}
+
+TEST_F(NativeContextMenuPluginTest, RegistersMenusFromNativeBuffers) {
+  constexpr char kTitle[] = "Item";
+  const PackedMenuHeader header = {kPackedMenuVersion, 1, sizeof(kTitle) - 1};
+  const PackedMenuNode node = {0, -1, 0, 0, sizeof(kTitle) - 1};
+  const int64_t size = sizeof(header) + sizeof(node) + header.strings_size;
+  uint8_t* buffer = native_context_menu_buffer_new(size);
+  ASSERT_NE(buffer, nullptr);
+  memcpy(buffer, &header, sizeof(header));
+  memcpy(buffer + sizeof(header), &node, sizeof(node));
+  memcpy(buffer + sizeof(header) + sizeof(node), kTitle, header.strings_size);
+
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string_take(
+      arguments, "buffer",
+      fl_value_new_int(reinterpret_cast<intptr_t>(buffer)));
+  fl_value_set_string_take(arguments, "bufferSize", fl_value_new_int(size));
+  g_autoptr(FlMethodResponse) registered =
+      call(plugins[0], "registerMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(registered));
+
+  // A truncated menu is rejected.
+  fl_value_set_string_take(arguments, "bufferSize",
+                           fl_value_new_int(size - 1));
+  g_autoptr(FlMethodResponse) truncated =
+      call(plugins[0], "registerMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(truncated));
+
+  // Memory outside of a live buffer is never read.
+  fl_value_set_string_take(arguments, "bufferSize", fl_value_new_int(size));
+  fl_value_set_string_take(
+      arguments, "buffer",
+      fl_value_new_int(reinterpret_cast<intptr_t>(buffer + 1)));
+  g_autoptr(FlMethodResponse) overrun =
+      call(plugins[0], "registerMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(overrun));
+  uint8_t stack_menu[sizeof(header) + sizeof(node) + sizeof(kTitle)];
+  memcpy(stack_menu, buffer, size);
+  fl_value_set_string_take(
+      arguments, "buffer",
+      fl_value_new_int(reinterpret_cast<intptr_t>(stack_menu)));
+  g_autoptr(FlMethodResponse) foreign =
+      call(plugins[0], "registerMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(foreign));
+  native_context_menu_buffer_free(buffer);
+  fl_value_set_string_take(
+      arguments, "buffer",
+      fl_value_new_int(reinterpret_cast<intptr_t>(buffer)));
+  g_autoptr(FlMethodResponse) freed =
+      call(plugins[0], "registerMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(freed));
+  EXPECT_EQ(get_stat(plugins[0], "build", "count"), 1);
+}
+
+TEST_F(NativeContextMenuPluginTest, PostsOutcomesToDartPorts) {
+  Dart_PostCObject_DL = fake_post_c_object;
+  show_and_dismiss(plugins[0], 1, 42);
+  Dart_PostCObject_DL = nullptr;
+  EXPECT_EQ(posted_port, 42);
+  // The outcome map is posted as a list of its keys & values.
+  g_autoptr(FlValue) outcome = fl_value_new_list();
+  fl_value_append_take(outcome, fl_value_new_string("request"));
+  fl_value_append_take(outcome, fl_value_new_int(1));
+  fl_value_append_take(outcome, fl_value_new_string("reason"));
+  fl_value_append_take(outcome, fl_value_new_string("dismissed"));
+  ASSERT_NE(posted_message, nullptr);
+  EXPECT_TRUE(fl_value_equal(posted_message, outcome));
+  g_clear_pointer(&posted_message, fl_value_unref);
+
+  // Before the Dart API is initialized the outcome goes through the method
+  // channel.
+  posted_port = 0;
+  show_and_dismiss(plugins[0], 2, 42);
+  EXPECT_EQ(posted_port, 0);
+}
+
+TEST_F(NativeContextMenuPluginTest, ReportsEachOutcomeOnce) {
+  Dart_PostCObject_DL = record_outcome;
+  for (int cycle = 0; cycle < kOutcomeCycles; cycle++) {
+    // Each engine posts to its own port, & dismisses & selects in turn.
+    size_t engine = cycle % plugins.size();
+    if (cycle / plugins.size() % 2 == 0) {
+      show_and_dismiss(plugins[engine], cycle, engine + 1);
+    } else {
+      show_and_select(plugins[engine], cycle, engine + 1);
+    }
+  }
+  Dart_PostCObject_DL = nullptr;
+
+  EXPECT_EQ(duplicate_outcomes, 0);
+  EXPECT_EQ(outcomes.size(), static_cast<size_t>(kOutcomeCycles));
+  int64_t lost = 0;
+  int64_t mismatched = 0;
+  for (int cycle = 0; cycle < kOutcomeCycles; cycle++) {
+    size_t engine = cycle % plugins.size();
+    auto outcome = outcomes.find({engine + 1, cycle});
+    if (outcome == outcomes.end()) {
+      lost++;
+    } else if (outcome->second != (cycle / plugins.size() % 2 == 0 ? -1 : 0)) {
+      mismatched++;
+    }
+  }
+  EXPECT_EQ(lost, 0);
+  EXPECT_EQ(mismatched, 0);
+  outcomes.clear();
+}
+
+TEST_F(NativeContextMenuPluginTest, ShowsMenusCachedByHash) {
+  constexpr int64_t kHash = 0x5eed;
+  g_autoptr(FlValue) arguments = fl_value_new_map();
+  fl_value_set_string_take(arguments, "hash", fl_value_new_int(kHash));
+  fl_value_set_string_take(arguments, "request", fl_value_new_int(1));
+  g_autoptr(FlMethodResponse) missed = call(plugins[0], "showMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(missed));
+  EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugins[0]), nullptr);
+
+  // Dart then sends the items along with the hash.
+  g_autoptr(FlValue) items = fl_value_new_list();
+  FlValue* item = fl_value_new_map();
+  fl_value_set_string_take(item, "id", fl_value_new_int(0));
+  fl_value_set_string_take(item, "title", fl_value_new_string("Item"));
+  fl_value_append_take(items, item);
+  fl_value_set_string(arguments, "items", items);
+  g_autoptr(FlMethodResponse) built = call(plugins[0], "showMenu", arguments);
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(built));
+  GtkWidget* menu = native_context_menu_plugin_get_shown_menu(plugins[0]);
+  ASSERT_NE(menu, nullptr);
+  gtk_menu_shell_deactivate(GTK_MENU_SHELL(menu));
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+
+  // A menu of another shape whose hash collides is not shown.
+  g_autoptr(FlValue) hash_only = fl_value_new_map();
+  fl_value_set_string_take(hash_only, "hash", fl_value_new_int(kHash));
+  fl_value_set_string_take(hash_only, "check",
+                           fl_value_new_int(int64_t{2} << 32 | 8));
+  fl_value_set_string_take(hash_only, "request", fl_value_new_int(2));
+  g_autoptr(FlMethodResponse) collided =
+      call(plugins[0], "showMenu", hash_only);
+  EXPECT_TRUE(FL_IS_METHOD_ERROR_RESPONSE(collided));
+  EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugins[0]), nullptr);
+
+  // 1 item titled with 4 bytes.
+  fl_value_set_string_take(hash_only, "check",
+                           fl_value_new_int(int64_t{1} << 32 | 4));
+  g_autoptr(FlMethodResponse) hit = call(plugins[0], "showMenu", hash_only);
+  EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(hit));
+  // The cached menu is shown again, without building it.
+  EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugins[0]), menu);
+  EXPECT_EQ(get_stat(plugins[0], "build", "count"), 1);
+  EXPECT_EQ(get_stat(plugins[0], "menuCache", "hitRate"), 33);
+
+  // The shown menu is kept over the budget, the others are evicted.
+  g_autoptr(FlValue) budget = fl_value_new_map();
+  fl_value_set_string_take(budget, "menuCacheSize", fl_value_new_int(0));
+  g_object_unref(call(plugins[0], "configure", budget));
+  EXPECT_EQ(get_stat(plugins[0], "menuCache", "count"), 1);
+  gtk_menu_shell_deactivate(GTK_MENU_SHELL(menu));
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+  g_object_unref(call(plugins[0], "configure", budget));
+  EXPECT_EQ(get_stat(plugins[0], "menuCache", "count"), 0);
+  EXPECT_EQ(get_stat(plugins[1], "menuCache", "count"), 0);
+}
+
+TEST_F(NativeContextMenuPluginTest, RecordsTraces) {
+  g_autofree gchar* path = g_build_filename(
+      g_get_tmp_dir(), "native_context_menu_test.trace", nullptr);
+  g_autoptr(FlValue) start = fl_value_new_map();
+  fl_value_set_string_take(start, "traceFile", fl_value_new_string(path));
+  g_object_unref(call(plugins[0], "configure", start));
+  int64_t handle = register_menu(plugins[0], 3);
+  show_and_dismiss(plugins[0], 1);
+  g_autoptr(FlValue) stop = fl_value_new_map();
+  fl_value_set_string_take(stop, "traceFile", fl_value_new_string(""));
+  g_object_unref(call(plugins[0], "configure", stop));
+
+  MenuTraceReader reader;
+  ASSERT_TRUE(reader.open(path));
+  std::vector<std::string> records;
+  for (FlValue* record = reader.read(); record != nullptr;
+       record = reader.read()) {
+    if (fl_value_get_int(fl_value_get_list_value(record, 0)) ==
+        kMenuTraceCall) {
+      records.push_back(
+          fl_value_get_string(fl_value_get_list_value(record, 3)));
+      if (records.back() == "registerMenu") {
+        EXPECT_EQ(fl_value_get_int(fl_value_get_list_value(record, 5)),
+                  handle);
+      }
+    } else {
+      records.push_back("outcome");
+    }
+    fl_value_unref(record);
+  }
+  // Configuration calls are not recorded.
+  EXPECT_EQ(records, std::vector<std::string>(
+                         {"registerMenu", "showMenu", "outcome"}));
+  remove(path);
+}
+
+TEST_F(NativeContextMenuPluginTest, ReplaysPackedRegistrations) {
+  g_autofree gchar* path = g_build_filename(
+      g_get_tmp_dir(), "native_context_menu_packed_test.trace", nullptr);
+  g_autoptr(FlValue) start = fl_value_new_map();
+  fl_value_set_string_take(start, "traceFile", fl_value_new_string(path));
+  g_object_unref(call(plugins[0], "configure", start));
+  constexpr char kTitle[] = "Item";
+  const PackedMenuHeader header = {kPackedMenuVersion, 1, sizeof(kTitle) - 1};
+  const PackedMenuNode node = {0, -1, 0, 0, sizeof(kTitle) - 1};
+  std::vector<uint8_t> packed(sizeof(header) + sizeof(node) +
+                              header.strings_size);
+  memcpy(packed.data(), &header, sizeof(header));
+  memcpy(packed.data() + sizeof(header), &node, sizeof(node));
+  memcpy(packed.data() + sizeof(header) + sizeof(node), kTitle,
+         header.strings_size);
+  g_autoptr(FlValue) message =
+      fl_value_new_uint8_list(packed.data(), packed.size());
+  g_autoptr(FlValue) reply =
+      native_context_menu_plugin_handle_packed_message(plugins[0], message);
+  ASSERT_EQ(fl_value_get_length(reply), sizeof(int64_t));
+  int64_t handle;
+  memcpy(&handle, fl_value_get_uint8_list(reply), sizeof(handle));
+  g_autoptr(FlValue) show = fl_value_new_map();
+  fl_value_set_string_take(show, "handle", fl_value_new_int(handle));
+  fl_value_set_string_take(show, "request", fl_value_new_int(1));
+  g_autoptr(FlMethodResponse) shown = call(plugins[0], "showMenu", show);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(shown));
+  gtk_menu_shell_deactivate(
+      GTK_MENU_SHELL(native_context_menu_plugin_get_shown_menu(plugins[0])));
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+  g_autoptr(FlValue) stop = fl_value_new_map();
+  fl_value_set_string_take(stop, "traceFile", fl_value_new_string(""));
+  g_object_unref(call(plugins[0], "configure", stop));
+
+  // The replaying instance registers the packed menu under another handle.
+  register_menu(plugins[1], 1);
+  MenuReplayer replayer(plugins[1]);
+  MenuTraceReader reader;
+  ASSERT_TRUE(reader.open(path));
+  std::vector<std::string> calls;
+  for (FlValue* record = reader.read(); record != nullptr;
+       record = reader.read()) {
+    if (fl_value_get_int(fl_value_get_list_value(record, 0)) ==
+        kMenuTraceCall) {
+      calls.push_back(fl_value_get_string(fl_value_get_list_value(record, 3)));
+      g_autoptr(FlMethodResponse) response = replayer.replay_call(record);
+      EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response)) << calls.back();
+    }
+    fl_value_unref(record);
+  }
+  EXPECT_EQ(calls, std::vector<std::string>({"registerMenu", "showMenu"}));
+  ASSERT_EQ(replayer.handles.count(handle), 1u);
+  EXPECT_NE(replayer.handles[handle], handle);
+  GtkWidget* replayed = native_context_menu_plugin_get_shown_menu(plugins[1]);
+  ASSERT_NE(replayed, nullptr);
+  gtk_menu_shell_deactivate(GTK_MENU_SHELL(replayed));
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+  remove(path);
+}
+
+TEST_F(NativeContextMenuPluginTest, ReplaysMenusBuiltBeforeTracing) {
+  int64_t handle = register_menu(plugins[0], 3);
+  g_autoptr(FlValue) items = fl_value_new_list();
+  FlValue* item = fl_value_new_map();
+  fl_value_set_string_take(item, "id", fl_value_new_int(0));
+  fl_value_set_string_take(item, "title", fl_value_new_string("Item"));
+  fl_value_append_take(items, item);
+  g_autoptr(FlValue) cached = fl_value_new_map();
+  fl_value_set_string_take(cached, "hash", fl_value_new_int(0x5eed));
+  fl_value_set_string_take(cached, "check",
+                           fl_value_new_int(int64_t{1} << 32 | 4));
+  fl_value_set_string(cached, "items", items);
+  g_autoptr(FlMethodResponse) built = call(plugins[0], "showMenu", cached);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(built));
+  gtk_menu_shell_deactivate(
+      GTK_MENU_SHELL(native_context_menu_plugin_get_shown_menu(plugins[0])));
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+
+  g_autofree gchar* path = g_build_filename(
+      g_get_tmp_dir(), "native_context_menu_built_test.trace", nullptr);
+  g_autoptr(FlValue) start = fl_value_new_map();
+  fl_value_set_string_take(start, "traceFile", fl_value_new_string(path));
+  g_object_unref(call(plugins[0], "configure", start));
+  // The registered menu is shown & its last item selected.
+  g_autoptr(FlValue) show = fl_value_new_map();
+  fl_value_set_string_take(show, "handle", fl_value_new_int(handle));
+  fl_value_set_string_take(show, "request", fl_value_new_int(1));
+  g_autoptr(FlMethodResponse) shown = call(plugins[0], "showMenu", show);
+  ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(shown));
+  GtkWidget* menu = native_context_menu_plugin_get_shown_menu(plugins[0]);
+  g_autoptr(GList) children = gtk_container_get_children(GTK_CONTAINER(menu));
+  gtk_menu_shell_activate_item(GTK_MENU_SHELL(menu),
+                               GTK_WIDGET(g_list_nth_data(children, 2)), TRUE);
+  while (g_main_context_iteration(nullptr, FALSE)) {
+  }
+  // The cached menu is shown by its hash only, twice.
+  g_autoptr(FlValue) hash_only = fl_value_new_map();
+  fl_value_set_string_take(hash_only, "hash", fl_value_new_int(0x5eed));
+  fl_value_set_string_take(hash_only, "check",
+                           fl_value_new_int(int64_t{1} << 32 | 4));
+  for (int64_t request = 2; request <= 3; request++) {
+    fl_value_set_string_take(hash_only, "request", fl_value_new_int(request));
+    g_autoptr(FlMethodResponse) hit = call(plugins[0], "showMenu", hash_only);
+    ASSERT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(hit));
+    gtk_menu_shell_deactivate(GTK_MENU_SHELL(
+        native_context_menu_plugin_get_shown_menu(plugins[0])));
+    while (g_main_context_iteration(nullptr, FALSE)) {
+    }
+  }
+  g_autoptr(FlValue) stop = fl_value_new_map();
+  fl_value_set_string_take(stop, "traceFile", fl_value_new_string(""));
+  g_object_unref(call(plugins[0], "configure", stop));
+
+  MenuReplayer replayer(plugins[1]);
+  MenuTraceReader reader;
+  ASSERT_TRUE(reader.open(path));
+  std::vector<std::string> calls;
+  std::vector<bool> traced_items;
+  int activations = 0;
+  for (FlValue* record = reader.read(); record != nullptr;
+       record = reader.read()) {
+    if (fl_value_get_int(fl_value_get_list_value(record, 0)) ==
+        kMenuTraceCall) {
+      calls.push_back(fl_value_get_string(fl_value_get_list_value(record, 3)));
+      traced_items.push_back(fl_value_lookup_string(
+                                 fl_value_get_list_value(record, 4),
+                                 "items") != nullptr);
+      g_autoptr(FlMethodResponse) response = replayer.replay_call(record);
+      EXPECT_TRUE(FL_IS_METHOD_SUCCESS_RESPONSE(response)) << calls.back();
+      GtkWidget* selected =
+          native_context_menu_plugin_get_shown_item(plugins[1], 2);
+      if (selected != nullptr) {
+        g_signal_connect(selected, "activate",
+                         G_CALLBACK(+[](GtkWidget* widget, gpointer data) {
+                           (*static_cast<int*>(data))++;
+                         }),
+                         &activations);
+      }
+    } else {
+      replayer.replay_outcome(record);
+      while (g_main_context_iteration(nullptr, FALSE)) {
+      }
+      EXPECT_EQ(native_context_menu_plugin_get_shown_menu(plugins[1]),
+                nullptr);
+    }
+    fl_value_unref(record);
+  }
+  // The registered menu is traced when the trace starts & the cached one on
+  // its first show only.
+  EXPECT_EQ(calls, std::vector<std::string>(
+                       {"registerMenu", "showMenu", "showMenu", "showMenu"}));
+  EXPECT_EQ(traced_items, std::vector<bool>({true, false, true, false}));
+  EXPECT_EQ(activations, 1);
+  EXPECT_EQ(get_stat(plugins[1], "menuCache", "hits"), 1);
+  remove(path);
+}
+
+TEST_F(NativeContextMenuPluginTest, WarmsUpIntoWidgetPool) {
+  native_context_menu_plugin_warm_up(plugins[0]);
+  EXPECT_EQ(get_stat(plugins[0], "warmUp", "count"), 1);
+  EXPECT_EQ(get_stat(plugins[0], "widgetPool", "size"), 1);
+
+  // The first menu reuses the warmed-up item.
+  register_menu(plugins[0], 1);
+  EXPECT_EQ(get_stat(plugins[0], "widgetPool", "hits"), 1);
+  EXPECT_EQ(get_stat(plugins[1], "warmUp", "count"), 0);
+}
+
+TEST_F(NativeContextMenuPluginTest, ReleasesMenusOverSoak) {
+  for (int cycle = 0; cycle < kSoakWarmUpCycles; cycle++) {
+    show_and_dismiss(plugins[0], cycle);
+  }
+  g_autoptr(FlValue) baseline_stats = nullptr;
+  FlValue* baseline = get_live_stats(plugins[0], &baseline_stats);
+  int64_t baseline_rss = get_rss();
+
+  for (int cycle = kSoakWarmUpCycles; cycle < kSoakCycles; cycle++) {
+    show_and_dismiss(plugins[0], cycle);
+  }
+  g_autoptr(FlValue) live_stats = nullptr;
+  FlValue* live = get_live_stats(plugins[0], &live_stats);
+  // Counters are compared exactly, the dismissed menus are all released.
+  if (baseline != nullptr && live != nullptr) {
+    EXPECT_TRUE(fl_value_equal(live, baseline));
+  }
+  EXPECT_LT(get_rss() - baseline_rss, kSoakRssSlack);
+}
+
+}  // namespace
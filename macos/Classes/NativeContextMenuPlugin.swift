@@ -4,7 +4,14 @@ import FlutterMacOS
 public class NativeContextMenuPlugin: NSObject, FlutterPlugin, NSMenuDelegate {
     var contentView: NSView?
     var responded = false
+    // The menu shown by the last `showMenu` call & the `request` passed to it,
+    // echoed in its outcome so that Dart completes the right show.
+    var shownMenu: NSMenu?
+    var shownRequest = 0
     var channel: FlutterMethodChannel?;
+    // Menus created by `registerMenu`, keyed by their handle.
+    var menus: [Int: NSMenu] = [:]
+    var nextMenuHandle = 1
     
     public static func register(with registrar: FlutterPluginRegistrar) {
         let channel = FlutterMethodChannel(
@@ -27,14 +34,26 @@ public class NativeContextMenuPlugin: NSObject, FlutterPlugin, NSMenuDelegate {
     
     @objc func onItemSelected(_ sender: NSMenuItem) {
         let id = getMenuItemId(sender)
-        channel?.invokeMethod("onItemSelected", arguments: id, result: nil)
+        channel?.invokeMethod(
+            "onItemSelected",
+            arguments: ["request": shownRequest, "id": id],
+            result: nil)
     }
     
-    func onItemDismissed() {
-        channel?.invokeMethod("onMenuDismissed", arguments: nil, result: nil)
+    func onItemDismissed(reason: String = "dismissed") {
+        channel?.invokeMethod(
+            "onMenuDismissed",
+            arguments: ["request": shownRequest, "reason": reason],
+            result: nil)
     }
     
     public func menuDidClose(_ menu: NSMenu) {
+        // A superseded menu may close after the next one is shown.
+        var root = menu
+        while let supermenu = root.supermenu {
+            root = supermenu
+        }
+        guard root === shownMenu else { return }
         if let selectedItem = menu.highlightedItem {
             if !responded {
                 onItemSelected(selectedItem)
@@ -49,13 +68,33 @@ public class NativeContextMenuPlugin: NSObject, FlutterPlugin, NSMenuDelegate {
     public func handle(_ call: FlutterMethodCall, result: @escaping FlutterResult) {
         switch call.method {
         case "showMenu":
-            responded = false
+            // A menu still open is closed & reported as superseded first.
+            if let superseded = shownMenu, !responded {
+                onItemDismissed(reason: "superseded")
+                responded = true
+                superseded.cancelTrackingWithoutAnimation()
+            }
             let args = call.arguments as! NSDictionary
             let pos = args["position"] as! [Double]
-            let items = args["items"] as! [NSDictionary]
-            
-            let menu = createMenu(items)
+
+            let menu: NSMenu
+            if let handle = args["handle"] as? Int {
+                guard let registered = menus[handle] else {
+                    result(FlutterError(
+                        code: "invalid_handle",
+                        message: "No menu is registered with this handle.",
+                        details: nil))
+                    return
+                }
+                menu = registered
+            } else {
+                menu = createMenu(args["items"] as! [NSDictionary])
+            }
             
+            responded = false
+            shownMenu = menu
+            shownRequest = args["request"] as? Int ?? 0
+
             let x = pos[0]
             var y = pos[1]
             if !contentView!.isFlipped {
@@ -68,6 +107,19 @@ public class NativeContextMenuPlugin: NSObject, FlutterPlugin, NSMenuDelegate {
                 at: NSPoint(x: x, y: y),
                 in: contentView
             )
+        case "registerMenu":
+            let args = call.arguments as! NSDictionary
+            let handle = nextMenuHandle
+            nextMenuHandle += 1
+            menus[handle] = createMenu(args["items"] as! [NSDictionary])
+            result(handle)
+        case "disposeMenu":
+            let args = call.arguments as! NSDictionary
+            menus.removeValue(forKey: args["handle"] as! Int)
+            result(nil)
+        case "configure":
+            // None of the options are used on macOS.
+            result(nil)
         default:
             result(FlutterMethodNotImplemented)
         }
@@ -80,6 +132,9 @@ public class NativeContextMenuPlugin: NSObject, FlutterPlugin, NSMenuDelegate {
                 action: #selector(onItemSelected(_:)), keyEquivalent: "")
 
             menuItem.representedObject = item
+            // Check & radio items only show their state, picking one closes the
+            // menu as any other item.
+            menuItem.state = (item["checked"] as? Bool ?? false) ? .on : .off
             
             return menuItem
         }
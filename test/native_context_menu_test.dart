@@ -1 +1,590 @@
-void main() {}
+import 'dart:async';
+import 'dart:convert';
+import 'dart:typed_data';
+
+import 'package:flutter/foundation.dart';
+import 'package:flutter/gestures.dart';
+import 'package:flutter/services.dart';
+import 'package:flutter/widgets.dart';
+import 'package:flutter_test/flutter_test.dart';
+import 'package:native_context_menu/native_context_menu.dart';
+
+void main() {
+  TestWidgetsFlutterBinding.ensureInitialized();
+
+  group('registerMenu', () {
+    testWidgets('sends a packed node table with MenuEncoding.packed',
+        (tester) async {
+      ByteData? sent;
+      tester.binding.defaultBinaryMessenger.setMockMessageHandler(
+        'native_context_menu/packed',
+        (message) async {
+          sent = message;
+          return ByteData(8)..setInt64(0, 42, Endian.little);
+        },
+      );
+
+      final menu = await registerMenu(
+        [
+          MenuItem(title: 'Copy'),
+          MenuItem(
+            title: 'Share',
+            items: [MenuItem(title: 'Mail'), MenuItem(title: 'Copy')],
+          ),
+        ],
+        encoding: MenuEncoding.packed,
+      );
+
+      tester.binding.defaultBinaryMessenger
+          .setMockMessageHandler('native_context_menu/packed', null);
+      expect(menu.handle, 42);
+
+      final data = sent!;
+      expect(data.getUint32(0, Endian.little), 1);
+      expect(data.getUint32(4, Endian.little), 4);
+      // "Copy" is stored once.
+      expect(data.getUint32(8, Endian.little), 'CopyShareMail'.length);
+
+      final strings = Uint8List.sublistView(data, 12 + 4 * 20);
+      final nodes = List.generate(4, (i) {
+        final offset = 12 + i * 20;
+        final titleOffset = data.getUint32(offset + 12, Endian.little);
+        final titleLength = data.getUint32(offset + 16, Endian.little);
+
+        return [
+          data.getInt32(offset, Endian.little),
+          data.getInt32(offset + 4, Endian.little),
+          data.getUint32(offset + 8, Endian.little),
+          utf8.decode(
+            strings.sublist(titleOffset, titleOffset + titleLength),
+          ),
+        ];
+      });
+
+      expect(nodes, [
+        [0, -1, 0, 'Copy'],
+        [1, -1, 1, 'Share'],
+        [2, 1, 0, 'Mail'],
+        [3, 1, 0, 'Copy'],
+      ]);
+    });
+
+    testWidgets('falls back to the method channel without a packed handler',
+        (tester) async {
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async => call.method == 'registerMenu' ? 7 : null,
+      );
+
+      final menu = await registerMenu(
+        [MenuItem(title: 'Copy')],
+        encoding: MenuEncoding.packed,
+      );
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      expect(menu.handle, 7);
+    });
+
+    testWidgets('falls back to the packed channel without native buffers',
+        (tester) async {
+      ByteData? sent;
+      tester.binding.defaultBinaryMessenger.setMockMessageHandler(
+        'native_context_menu/packed',
+        (message) async {
+          sent = message;
+          return ByteData(8)..setInt64(0, 5, Endian.little);
+        },
+      );
+
+      // The plugin library is not loaded by the tests.
+      final menu = await registerMenu(
+        [MenuItem(title: 'Copy')],
+        encoding: MenuEncoding.nativeBuffer,
+      );
+
+      tester.binding.defaultBinaryMessenger
+          .setMockMessageHandler('native_context_menu/packed', null);
+      expect(menu.handle, 5);
+      expect(sent!.getUint32(4, Endian.little), 1);
+    });
+
+    testWidgets('sends menus with icons through the method channel',
+        (tester) async {
+      MethodCall? sent;
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          sent = call;
+          return 9;
+        },
+      );
+
+      final icon = Uint8List.fromList([0x89, 0x50, 0x4E, 0x47]);
+      final menu = await registerMenu(
+        [
+          MenuItem(
+            title: 'Share',
+            items: [MenuItem(title: 'Mail', icon: icon)],
+          ),
+        ],
+        encoding: MenuEncoding.packed,
+      );
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      expect(menu.handle, 9);
+      final items = (sent!.arguments as Map)['items'] as List;
+      expect(items[0]['items'][0]['icon'], icon);
+    });
+  });
+
+  group('itemsBuilder', () {
+    const codec = StandardMethodCodec();
+
+    // Sends a method call as the native side would & returns the reply.
+    Future<Object?> invokeFromNative(
+      WidgetTester tester,
+      String method, [
+      Object? arguments,
+    ]) {
+      final reply = Completer<ByteData?>();
+      tester.binding.defaultBinaryMessenger.handlePlatformMessage(
+        'native_context_menu',
+        codec.encodeMethodCall(MethodCall(method, arguments)),
+        reply.complete,
+      );
+
+      return reply.future.then((data) => codec.decodeEnvelope(data!));
+    }
+
+    testWidgets('builds sub-items when the native side requests them',
+        (tester) async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.linux;
+      final calls = <MethodCall>[];
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          calls.add(call);
+          return null;
+        },
+      );
+
+      var builds = 0;
+      final notes = MenuItem(title: 'Notes.txt');
+      final result = showContextMenu(ShowMenuArgs(1, Offset.zero, [
+        MenuItem(title: 'Open'),
+        MenuItem(
+          title: 'Open recent',
+          itemsBuilder: () {
+            builds++;
+            return [notes];
+          },
+        ),
+      ]));
+
+      expect(calls.single.arguments['items'][1]['dynamic'], true);
+      expect(await invokeFromNative(tester, 'onItemsRequested', 1), [
+        {'id': 2, 'title': 'Notes.txt', 'items': []},
+      ]);
+      await invokeFromNative(tester, 'onItemSelected', {
+        'request': calls.single.arguments['request'],
+        'id': 2,
+      });
+      expect(await result, same(notes));
+      expect(builds, 1);
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      debugDefaultTargetPlatformOverride = null;
+    });
+
+    testWidgets('reuses the ids of dynamic sub-items on every show',
+        (tester) async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.linux;
+      final shows = <MethodCall>[];
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          if (call.method == 'registerMenu') return 3;
+          if (call.method == 'showMenu') shows.add(call);
+          return null;
+        },
+      );
+
+      final menu = await registerMenu([
+        MenuItem(title: 'Open'),
+        MenuItem(
+          title: 'Open recent',
+          itemsBuilder: () => [MenuItem(title: 'Notes.txt')],
+        ),
+      ]);
+      for (var i = 0; i < 3; i++) {
+        final result = menu.show(1, Offset.zero);
+        expect(await invokeFromNative(tester, 'onItemsRequested', 1), [
+          {'id': 2, 'title': 'Notes.txt', 'items': []},
+        ]);
+        await invokeFromNative(tester, 'onMenuDismissed', {
+          'request': shows.last.arguments['request'],
+          'reason': 'dismissed',
+        });
+        expect(await result, null);
+      }
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      debugDefaultTargetPlatformOverride = null;
+    });
+  });
+
+  group('showContextMenu', () {
+    const codec = StandardMethodCodec();
+
+    testWidgets('streams the highlights of the shown menu', (tester) async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.linux;
+      final calls = <MethodCall>[];
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          calls.add(call);
+          return null;
+        },
+      );
+      var listened = false;
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu/highlights'),
+        (call) async {
+          listened = call.method == 'listen';
+          return null;
+        },
+      );
+      // Sends a batch of highlights as the native side would.
+      void sendHighlights(int request, List<Map<String, Object>> highlights) {
+        tester.binding.defaultBinaryMessenger.handlePlatformMessage(
+          'native_context_menu/highlights',
+          codec.encodeSuccessEnvelope({
+            'request': request,
+            'highlights': highlights,
+          }),
+          (_) {},
+        );
+      }
+
+      final batches = <List<MenuHighlight>>[];
+      final subscription = contextMenuHighlights.listen(batches.add);
+      await tester.pump();
+      expect(listened, true);
+
+      final copy = MenuItem(title: 'Copy');
+      final paste = MenuItem(title: 'Paste');
+      final result = showContextMenu(ShowMenuArgs(1, Offset.zero, [
+        copy,
+        paste,
+      ]));
+      final request = calls.single.arguments['request'] as int;
+      sendHighlights(request - 1, [
+        {'id': 0, 'highlighted': true},
+      ]);
+      sendHighlights(request, [
+        {'id': 0, 'highlighted': false},
+        {'id': 1, 'highlighted': true},
+      ]);
+      await tester.pump();
+
+      // The batch of the previous menu is dropped.
+      expect(batches, hasLength(1));
+      expect(batches.single.map((h) => h.item), [same(copy), same(paste)]);
+      expect(batches.single.map((h) => h.highlighted), [false, true]);
+
+      tester.binding.defaultBinaryMessenger.handlePlatformMessage(
+        'native_context_menu',
+        codec.encodeMethodCall(MethodCall('onMenuDismissed', {
+          'request': request,
+          'reason': 'dismissed',
+        })),
+        (_) {},
+      );
+      expect(await result, null);
+      await subscription.cancel();
+      await tester.pump();
+      expect(listened, false);
+
+      for (final channel in [
+        'native_context_menu',
+        'native_context_menu/highlights',
+      ]) {
+        tester.binding.defaultBinaryMessenger
+            .setMockMethodCallHandler(MethodChannel(channel), null);
+      }
+      debugDefaultTargetPlatformOverride = null;
+    });
+
+    testWidgets('applies the items toggled while the menu was shown',
+        (tester) async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.linux;
+      final calls = <MethodCall>[];
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          calls.add(call);
+          return null;
+        },
+      );
+
+      final toggles = <String>[];
+      final grid = MenuItem(
+        title: 'Grid',
+        type: MenuItemType.check,
+        onToggled: (checked) => toggles.add('Grid $checked'),
+      );
+      final list = MenuItem(
+        title: 'List',
+        type: MenuItemType.radio,
+        checked: true,
+        onToggled: (checked) => toggles.add('List $checked'),
+      );
+      final icons = MenuItem(
+        title: 'Icons',
+        type: MenuItemType.radio,
+        onToggled: (checked) => toggles.add('Icons $checked'),
+      );
+      final result = showContextMenu(ShowMenuArgs(
+        1,
+        Offset.zero,
+        [grid, list, icons],
+        keepOpen: true,
+      ));
+
+      final arguments = calls.single.arguments as Map;
+      expect(arguments['keepOpen'], true);
+      expect(arguments['items'][0]['type'], 'check');
+      expect(arguments['items'][1]['type'], 'radio');
+      expect(arguments['items'][1]['checked'], true);
+
+      tester.binding.defaultBinaryMessenger.handlePlatformMessage(
+        'native_context_menu',
+        codec.encodeMethodCall(MethodCall('onMenuDismissed', {
+          'request': arguments['request'],
+          'reason': 'dismissed',
+          'toggled': [
+            {'id': 0, 'checked': true},
+            {'id': 1, 'checked': false},
+            {'id': 2, 'checked': true},
+          ],
+        })),
+        (_) {},
+      );
+      expect(await result, null);
+      expect([grid.checked, list.checked, icons.checked], [true, false, true]);
+      expect(toggles, ['Grid true', 'List false', 'Icons true']);
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      debugDefaultTargetPlatformOverride = null;
+    });
+
+    testWidgets('sends the items of cached menus only on a miss',
+        (tester) async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.linux;
+      final calls = <Map>[];
+      final cached = <int>{};
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          final arguments = call.arguments as Map;
+          calls.add(arguments);
+          final hash = arguments['hash'] as int;
+          if (!arguments.containsKey('items') && !cached.contains(hash)) {
+            throw PlatformException(code: 'cache_miss');
+          }
+          cached.add(hash);
+          tester.binding.defaultBinaryMessenger.handlePlatformMessage(
+            'native_context_menu',
+            codec.encodeMethodCall(MethodCall('onItemSelected', {
+              'request': arguments['request'],
+              'id': 1,
+            })),
+            (_) {},
+          );
+          return null;
+        },
+      );
+      // Rows of a list, each with its own but identical items.
+      Future<MenuItem?> show(String title) {
+        return showContextMenu(ShowMenuArgs(
+          1,
+          Offset.zero,
+          [MenuItem(title: 'Open'), MenuItem(title: title)],
+          cached: true,
+        ));
+      }
+
+      expect((await show('Delete'))!.title, 'Delete');
+      expect((await show('Delete'))!.title, 'Delete');
+      expect((await show('Remove'))!.title, 'Remove');
+
+      expect(calls.map((call) => call.containsKey('items')), [
+        false,
+        true,
+        false,
+        false,
+        true,
+      ]);
+      expect(calls[2]['hash'], calls[0]['hash']);
+      expect(calls[3]['hash'], isNot(calls[0]['hash']));
+      // 2 items titled with 4 & 6 bytes, checked against the cached menu.
+      expect(calls[0]['check'], 2 << 32 | 10);
+      expect(calls[3]['check'], 2 << 32 | 10);
+      // The items are sent again under the request of the missed show.
+      expect(calls[1]['request'], calls[0]['request']);
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      debugDefaultTargetPlatformOverride = null;
+    });
+
+    testWidgets('completes each of overlapping shows exactly once',
+        (tester) async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.linux;
+      // Replies as the native side would: every show supersedes the menu still
+      // open, and some menus are then closed by the user.
+      int? openRequest;
+      void reply(String method, Map<String, Object?> arguments) {
+        tester.binding.defaultBinaryMessenger.handlePlatformMessage(
+          'native_context_menu',
+          codec.encodeMethodCall(MethodCall(method, arguments)),
+          (_) {},
+        );
+      }
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          final request = call.arguments['request'] as int;
+          if (openRequest != null) {
+            reply('onMenuDismissed', {
+              'request': openRequest,
+              'reason': 'superseded',
+            });
+          }
+          openRequest = request;
+          if (request % 3 == 0) {
+            reply('onItemSelected', {'request': request, 'id': 0});
+            openRequest = null;
+          } else if (request % 5 == 0) {
+            reply('onMenuDismissed', {
+              'request': request,
+              'reason': 'dismissed',
+            });
+            openRequest = null;
+          }
+          return null;
+        },
+      );
+
+      final copy = MenuItem(title: 'Copy');
+      final results = [
+        for (var i = 0; i < 500; i++)
+          showContextMenu(ShowMenuArgs(1, Offset.zero, [copy])),
+      ];
+      expect(debugPendingContextMenuShows, 500);
+
+      // The last menu is still open & completes once the user closes it.
+      await tester.pump();
+      expect(debugPendingContextMenuShows, openRequest == null ? 0 : 1);
+      if (openRequest != null) {
+        reply('onMenuDismissed', {
+          'request': openRequest,
+          'reason': 'dismissed',
+        });
+      }
+
+      final items = await Future.wait(results);
+      expect(debugPendingContextMenuShows, 0);
+      expect(items.whereType<MenuItem>(), everyElement(same(copy)));
+      expect(items.where((item) => item != null).length, greaterThan(0));
+      expect(items.where((item) => item == null).length, greaterThan(0));
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      debugDefaultTargetPlatformOverride = null;
+    });
+  });
+
+  group('ContextMenuRegion', () {
+    testWidgets('keeps its menu while rebuilt with equal items',
+        (tester) async {
+      debugDefaultTargetPlatformOverride = TargetPlatform.windows;
+      final calls = <String>[];
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        (call) async {
+          calls.add(call.method);
+          if (call.method == 'registerMenu') return 1;
+          if (call.method == 'showMenu') {
+            // Selects the first item, as the user would.
+            tester.binding.defaultBinaryMessenger.handlePlatformMessage(
+              'native_context_menu',
+              const StandardMethodCodec().encodeMethodCall(MethodCall(
+                'onItemSelected',
+                {'request': call.arguments['request'], 'id': 0},
+              )),
+              (_) {},
+            );
+          }
+          return null;
+        },
+      );
+
+      final selected = <MenuItem>[];
+      Future<void> showRegion(List<MenuItem> items) async {
+        await tester.pumpWidget(MediaQuery(
+          data: const MediaQueryData(),
+          child: ContextMenuRegion(
+            menuItems: items,
+            onItemSelected: selected.add,
+            child: const SizedBox(width: 100, height: 100),
+          ),
+        ));
+        final gesture = await tester.createGesture(
+          kind: PointerDeviceKind.mouse,
+          buttons: kSecondaryMouseButton,
+        );
+        await gesture.down(tester.getCenter(find.byType(SizedBox)));
+        await gesture.up();
+        await tester.pumpAndSettle();
+      }
+
+      final first = [MenuItem(title: 'Copy'), MenuItem(title: 'Paste')];
+      await showRegion(first);
+      // Items rebuilt along with the widget are equal to the first ones.
+      final equal = [MenuItem(title: 'Copy'), MenuItem(title: 'Paste')];
+      await showRegion(equal);
+      expect(calls, ['registerMenu', 'showMenu', 'showMenu']);
+      expect(selected, [same(first[0]), same(equal[0])]);
+
+      await showRegion([MenuItem(title: 'Cut'), MenuItem(title: 'Paste')]);
+      expect(calls.sublist(3), ['disposeMenu', 'registerMenu', 'showMenu']);
+
+      tester.binding.defaultBinaryMessenger.setMockMethodCallHandler(
+        const MethodChannel('native_context_menu'),
+        null,
+      );
+      debugDefaultTargetPlatformOverride = null;
+    });
+  });
+}
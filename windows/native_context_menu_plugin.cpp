@@ -11,6 +11,11 @@
 #include <future>
 #include <map>
 #include <memory>
+#include <utility>
+#include <vector>
+
+#include "menu_decoder.h"
+#include "menu_model.h"
 
 // Platform channel name.
 constexpr static auto kChannelName = "native_context_menu";
@@ -19,14 +24,127 @@ constexpr static auto kChannelName = "native_context_menu";
 // Pass `devicePixelRatio` and `position` from Dart to show menu at specified
 // coordinates. If it is not defined, WIN32 will use `GetCursorPos` to show the
 // context menu at the cursor's position.
+// Pass `handle` instead of `items` to show a menu created by `registerMenu`.
 constexpr static auto kShowMenu = "showMenu";
+// Register menu call.
+// Builds a menu from passed `items` & keeps it alive until `disposeMenu` is
+// called. Returns an integer handle which can be passed to `showMenu`.
+constexpr static auto kRegisterMenu = "registerMenu";
+// Dispose menu call.
+// Destroys a menu previously created by `registerMenu`.
+constexpr static auto kDisposeMenu = "disposeMenu";
+// Configure call.
+// Sets plugin options. None are used on Windows, the call is accepted so that
+// Dart can configure every platform alike.
+constexpr static auto kConfigure = "configure";
 
-// Called when an item is selected from the context menu.
+// Called when an item is selected from the context menu, with the `request` of
+// its show & the `id` of the item.
 constexpr static auto kOnItemSelected = "onItemSelected";
-// Called when menu is dismissed without clicking any item.
+// Called when menu is dismissed without clicking any item, with the `request`
+// of its show & one of the `reason`s below.
 constexpr static auto kOnMenuDismissed = "onMenuDismissed";
+constexpr static auto kDismissedReason = "dismissed";
+constexpr static auto kSupersededReason = "superseded";
 
 namespace {
+
+// Reads the items passed through the standard method codec, see
+// `decode_menu`.
+struct EncodableMenuReader {
+  using Items = const flutter::EncodableList*;
+  using Item = const flutter::EncodableValue*;
+
+  static size_t size(Items items) {
+    return items == nullptr ? 0 : items->size();
+  }
+
+  static Item at(Items items, size_t index) { return &(*items)[index]; }
+
+  // Walks the item map once, checking the type of every known field.
+  static const char* read(Item value, DecodedMenuItem<Items>& decoded) {
+    auto item = std::get_if<flutter::EncodableMap>(value);
+    if (item == nullptr) return kMenuItemNotMapError;
+    bool has_id = false;
+    for (const auto& [key, field] : *item) {
+      auto name = std::get_if<std::string>(&key);
+      if (name == nullptr) continue;
+      switch (menu_item_field(name->c_str(), name->size())) {
+        case MenuItemField::kId:
+          if (!std::holds_alternative<int32_t>(field) &&
+              !std::holds_alternative<int64_t>(field)) {
+            return kMenuItemIdError;
+          }
+          decoded.id = field.LongValue();
+          has_id = true;
+          break;
+        case MenuItemField::kTitle: {
+          auto title = std::get_if<std::string>(&field);
+          if (title == nullptr) return kMenuItemTitleError;
+          decoded.title = title->c_str();
+          decoded.title_length = title->size();
+          break;
+        }
+        case MenuItemField::kItems:
+          if (field.IsNull()) break;
+          decoded.items = std::get_if<flutter::EncodableList>(&field);
+          if (decoded.items == nullptr) return kMenuItemItemsError;
+          break;
+        case MenuItemField::kDynamic:
+          if (field.IsNull()) break;
+          if (!std::holds_alternative<bool>(field)) {
+            return kMenuItemDynamicError;
+          }
+          decoded.dynamic = std::get<bool>(field);
+          break;
+        // Icons are checked like on Linux, but not shown yet, so they are not
+        // kept in the model.
+        case MenuItemField::kIcon:
+          if (!field.IsNull() &&
+              !std::holds_alternative<std::vector<uint8_t>>(field)) {
+            return kMenuItemIconError;
+          }
+          break;
+        case MenuItemField::kIconPath:
+          if (!field.IsNull() && !std::holds_alternative<std::string>(field)) {
+            return kMenuItemIconPathError;
+          }
+          break;
+        case MenuItemField::kType: {
+          if (field.IsNull()) break;
+          auto type = std::get_if<std::string>(&field);
+          if (type == nullptr ||
+              !menu_item_type(type->c_str(), type->size(), &decoded.type)) {
+            return kMenuItemTypeError;
+          }
+          break;
+        }
+        case MenuItemField::kChecked:
+          if (field.IsNull()) break;
+          if (!std::holds_alternative<bool>(field)) {
+            return kMenuItemCheckedError;
+          }
+          decoded.checked = std::get<bool>(field);
+          break;
+        case MenuItemField::kUnknown:
+          break;
+      }
+    }
+    if (!has_id) return kMenuItemIdError;
+    if (decoded.title == nullptr) return kMenuItemTitleError;
+    return nullptr;
+  }
+};
+
+// Responds with the `invalid_menu` error for items rejected with `error`,
+// whose details are the id of the rejected item if it is known.
+void InvalidMenu(flutter::MethodResult<flutter::EncodableValue>& result,
+                 const MenuDecodeError& error) {
+  result.Error("invalid_menu", error.message,
+               error.id >= 0 ? flutter::EncodableValue(error.id)
+                             : flutter::EncodableValue());
+}
+
 class NativeContextMenuPlugin : public flutter::Plugin {
  public:
   static void RegisterWithRegistrar(flutter::PluginRegistrarWindows* registrar);
@@ -42,6 +160,10 @@ class NativeContextMenuPlugin : public flutter::Plugin {
   std::unique_ptr<flutter::MethodChannel<flutter::EncodableValue>> channel_ =
       nullptr;
   HMENU menu_handle_ = nullptr;
+  // Menus created by `registerMenu`, keyed by their handle. These are built
+  // once & shown any number of times.
+  std::map<int64_t, HMENU> menus_ = {};
+  int64_t next_menu_handle_ = 1;
   int32_t window_proc_id_ = -1;
   // Windows sends `WM_EXITMENULOOP` message even if a menu item is selected
   // before `WM_COMMAND`. For responding Dart the `id` of the selected menu
@@ -51,6 +173,12 @@ class NativeContextMenuPlugin : public flutter::Plugin {
   std::unique_ptr<std::thread> last_menu_thread_ = nullptr;
   bool last_menu_item_selected_ = false;
   bool is_menu_created_ = false;
+  // The `request` passed to the `showMenu` call of the tracked menu, echoed in
+  // its outcome so that Dart completes the right show.
+  int64_t shown_request_ = 0;
+  // Set when a superseded menu is ended, so that its `WM_EXITMENULOOP` does not
+  // report it again.
+  bool is_menu_superseded_ = false;
   // For safe conversion between `wchar_t[]` and `char[]`.
   std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> converter_;
 
@@ -58,7 +186,15 @@ class NativeContextMenuPlugin : public flutter::Plugin {
                                           WPARAM wparam, LPARAM lparam);
   HWND GetWindow();
 
-  void CreateMenu(HMENU menu, flutter::EncodableMap arguments);
+  // Builds a popup menu from the `items` of a method call. Returns `nullptr`
+  // & fills `error` if any item is invalid.
+  HMENU CreateMenu(const flutter::EncodableMap& arguments,
+                   MenuDecodeError& error);
+
+  void TrackMenu(HMENU menu, flutter::EncodableMap& arguments);
+
+  // Reports the tracked menu as dismissed for `reason` to Dart.
+  void SendMenuDismissed(int64_t request, const char* reason);
 
   void HandleMethodCall(
       const flutter::MethodCall<flutter::EncodableValue>& method_call,
@@ -94,6 +230,9 @@ NativeContextMenuPlugin::~NativeContextMenuPlugin() {
     last_menu_thread_->detach();
     last_menu_thread_.reset(nullptr);
   }
+  for (const auto& [handle, menu] : menus_) {
+    ::DestroyMenu(menu);
+  }
   registrar_->UnregisterTopLevelWindowProcDelegate(window_proc_id_);
 }
 
@@ -103,20 +242,27 @@ std::optional<LRESULT> NativeContextMenuPlugin::HandleWindowProc(
     case WM_COMMAND: {
       last_menu_item_selected_ = true;
       is_menu_created_ = false;
-      channel_->InvokeMethod(kOnItemSelected,
-                             std::make_unique<flutter::EncodableValue>(
-                                 static_cast<int32_t>(wparam)));
+      channel_->InvokeMethod(
+          kOnItemSelected,
+          std::make_unique<flutter::EncodableValue>(flutter::EncodableMap{
+              {flutter::EncodableValue("request"),
+               flutter::EncodableValue(shown_request_)},
+              {flutter::EncodableValue("id"),
+               flutter::EncodableValue(static_cast<int32_t>(wparam))},
+          }));
       break;
     }
     case WM_EXITMENULOOP: {
-      if (is_menu_created_) {
+      if (is_menu_superseded_) {
+        is_menu_superseded_ = false;
+      } else if (is_menu_created_) {
+        int64_t request = shown_request_;
         last_menu_thread_ = std::make_unique<std::thread>([=] {
           // Prevent WM_EXITMENULOOP being sent first in-case item was selected.
           std::this_thread::sleep_for(std::chrono::milliseconds(100));
-          if (!last_menu_item_selected_) {
-            channel_->InvokeMethod(kOnMenuDismissed,
-                                   std::make_unique<flutter::EncodableValue>(
-                                       flutter::EncodableValue(nullptr)));
+          // A menu shown meanwhile has already reported this one.
+          if (!last_menu_item_selected_ && request == shown_request_) {
+            SendMenuDismissed(request, kDismissedReason);
             is_menu_created_ = false;
           }
         });
@@ -133,30 +279,112 @@ HWND NativeContextMenuPlugin::GetWindow() {
   return ::GetAncestor(registrar_->GetView()->GetNativeWindow(), GA_ROOT);
 }
 
-void NativeContextMenuPlugin::CreateMenu(HMENU menu,
-                                         flutter::EncodableMap arguments) {
-  auto items = std::get<flutter::EncodableList>(
-      arguments[flutter::EncodableValue("items")]);
-  int32_t count = ::GetMenuItemCount(menu);
-  for (int32_t i = 0; i < count; i++) {
-    // Always remove at 0 because they shift every time.
-    ::RemoveMenu(menu, 0, MF_BYPOSITION);
+HMENU NativeContextMenuPlugin::CreateMenu(
+    const flutter::EncodableMap& arguments, MenuDecodeError& error) {
+  auto items = arguments.find(flutter::EncodableValue("items"));
+  auto list = items != arguments.end()
+                  ? std::get_if<flutter::EncodableList>(&items->second)
+                  : nullptr;
+  MenuModel model;
+  if (list == nullptr) {
+    error = {kMenuItemsNotListError, -1};
+    return nullptr;
   }
-  for (const auto& item_value : items) {
-    auto item = std::get<flutter::EncodableMap>(item_value);
-    int32_t id = std::get<int32_t>(item[flutter::EncodableValue("id")]);
-    auto title = std::get<std::string>(item[flutter::EncodableValue("title")]);
-    UINT_PTR item_id = id;
-    UINT uFlags = MF_STRING;
-    auto sub_items = std::get<flutter::EncodableList>(
-        item[flutter::EncodableValue("items")]);
-    if (sub_items.size() > 0) {
-      uFlags |= MF_POPUP;
-      HMENU sub_menu = ::CreatePopupMenu();
-      CreateMenu(sub_menu, item);
-      item_id = reinterpret_cast<UINT_PTR>(sub_menu);
+  if (!decode_menu<EncodableMenuReader>(list, model, &error)) return nullptr;
+  HMENU menu = ::CreatePopupMenu();
+  // Sub-items of each node yet to be appended to its popup menu. Walked with
+  // an explicit stack, so that sub-menus nest to any depth.
+  std::vector<std::pair<NodeIndex, HMENU>> stack = {{kRootNode, menu}};
+  while (!stack.empty()) {
+    auto [parent, parent_menu] = stack.back();
+    stack.pop_back();
+    for (NodeIndex node = model.nodes[parent].first_child; node != kNoNode;
+         node = model.nodes[node].next_sibling) {
+      UINT_PTR item_id = model.nodes[node].id;
+      UINT uFlags = MF_STRING;
+      // Check & radio items show their state, which is not toggled natively
+      // on Windows yet.
+      if (model.nodes[node].checked) uFlags |= MF_CHECKED;
+      if (model.nodes[node].child_count > 0) {
+        uFlags |= MF_POPUP;
+        HMENU sub_menu = ::CreatePopupMenu();
+        stack.push_back({node, sub_menu});
+        item_id = reinterpret_cast<UINT_PTR>(sub_menu);
+      }
+      ::AppendMenuW(parent_menu, uFlags, item_id,
+                    converter_.from_bytes(model.title(node)).c_str());
     }
-    ::AppendMenuW(menu, uFlags, item_id, converter_.from_bytes(title).c_str());
+  }
+  return menu;
+}
+
+void NativeContextMenuPlugin::SendMenuDismissed(int64_t request,
+                                                const char* reason) {
+  channel_->InvokeMethod(
+      kOnMenuDismissed,
+      std::make_unique<flutter::EncodableValue>(flutter::EncodableMap{
+          {flutter::EncodableValue("request"),
+           flutter::EncodableValue(request)},
+          {flutter::EncodableValue("reason"), flutter::EncodableValue(reason)},
+      }));
+}
+
+void NativeContextMenuPlugin::TrackMenu(HMENU menu,
+                                        flutter::EncodableMap& arguments) {
+  // A menu still open is closed & reported as superseded first. `showMenu`
+  // can arrive while it is open, as its modal loop keeps dispatching messages.
+  if (is_menu_created_ && !last_menu_item_selected_) {
+    SendMenuDismissed(shown_request_, kSupersededReason);
+    is_menu_superseded_ = true;
+    ::EndMenu();
+  }
+  auto request = arguments.find(flutter::EncodableValue("request"));
+  shown_request_ =
+      request != arguments.end() ? request->second.LongValue() : 0;
+  last_menu_item_selected_ = false;
+  is_menu_created_ = true;
+  if (last_menu_thread_ != nullptr) {
+    last_menu_thread_->detach();
+    last_menu_thread_.reset(nullptr);
+  }
+  std::optional<double> device_pixel_patio;
+  std::optional<flutter::EncodableList> position;
+  if (arguments.find(flutter::EncodableValue("devicePixelRatio")) !=
+      arguments.end()) {
+    device_pixel_patio = std::get<double>(
+        arguments[flutter::EncodableValue("devicePixelRatio")]);
+  }
+  if (arguments.find(flutter::EncodableValue("position")) != arguments.end()) {
+    position = std::get<flutter::EncodableList>(
+        arguments[flutter::EncodableValue("position")]);
+  }
+  HWND window = GetWindow();
+  // Pass `devicePixelRatio` and `position` from Dart to show menu at
+  // specified coordinates. If it is not defined, WIN32 will use
+  // `GetCursorPos` to show the context menu at the cursor's position.
+  if (device_pixel_patio && position) {
+    RECT rect;
+    ::GetWindowRect(window, &rect);
+    TITLEBARINFOEX title_bar_info;
+    title_bar_info.cbSize = sizeof(TITLEBARINFOEX);
+    ::SendMessage(window, WM_GETTITLEBARINFOEX, 0, (LPARAM)&title_bar_info);
+    int32_t title_bar_height = title_bar_info.rcTitleBar.bottom == 0
+                                   ? 0
+                                   : title_bar_info.rcTitleBar.bottom -
+                                         title_bar_info.rcTitleBar.top;
+    int32_t x = static_cast<int32_t>(
+        (std::get<double>(position.value()[0]) * device_pixel_patio.value()) +
+        rect.left);
+    int32_t y = static_cast<int32_t>(
+        (std::get<double>(position.value()[1]) * device_pixel_patio.value()) +
+        rect.top + title_bar_height);
+    ::TrackPopupMenu(menu, TPM_LEFTALIGN | TPM_LEFTBUTTON, x, y, 0, window,
+                     NULL);
+  } else {
+    POINT point;
+    ::GetCursorPos(&point);
+    ::TrackPopupMenu(menu, TPM_LEFTALIGN | TPM_LEFTBUTTON, point.x, point.y, 0,
+                     window, NULL);
   }
 }
 
@@ -164,56 +392,49 @@ void NativeContextMenuPlugin::HandleMethodCall(
     const flutter::MethodCall<flutter::EncodableValue>& method_call,
     std::unique_ptr<flutter::MethodResult<flutter::EncodableValue>> result) {
   if (method_call.method_name().compare(kShowMenu) == 0) {
-    last_menu_item_selected_ = false;
-    is_menu_created_ = true;
-    if (last_menu_thread_ != nullptr) {
-      last_menu_thread_->detach();
-      last_menu_thread_.reset(nullptr);
-    }
     auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
-    std::optional<double> device_pixel_patio;
-    std::optional<flutter::EncodableList> position;
-    if (arguments.find(flutter::EncodableValue("devicePixelRatio")) !=
-        arguments.end()) {
-      device_pixel_patio = std::get<double>(
-          arguments[flutter::EncodableValue("devicePixelRatio")]);
+    auto handle = arguments.find(flutter::EncodableValue("handle"));
+    if (handle != arguments.end()) {
+      auto menu = menus_.find(handle->second.LongValue());
+      if (menu == menus_.end()) {
+        result->Error("invalid_handle",
+                      "No menu is registered with this handle.");
+        return;
+      }
+      TrackMenu(menu->second, arguments);
+    } else {
+      MenuDecodeError error;
+      menu_handle_ = CreateMenu(arguments, error);
+      if (menu_handle_ == nullptr) {
+        InvalidMenu(*result, error);
+        return;
+      }
+      TrackMenu(menu_handle_, arguments);
     }
-    if (arguments.find(flutter::EncodableValue("position")) !=
-        arguments.end()) {
-      position = std::get<flutter::EncodableList>(
-          arguments[flutter::EncodableValue("position")]);
+    result->Success(nullptr);
+  } else if (method_call.method_name().compare(kRegisterMenu) == 0) {
+    auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+    MenuDecodeError error;
+    HMENU menu = CreateMenu(arguments, error);
+    if (menu == nullptr) {
+      InvalidMenu(*result, error);
+      return;
     }
-    menu_handle_ = CreatePopupMenu();
-    CreateMenu(menu_handle_, arguments);
-    HWND window = GetWindow();
-    // Pass `devicePixelRatio` and `position` from Dart to show menu at
-    // specified coordinates. If it is not defined, WIN32 will use
-    // `GetCursorPos` to show the context menu at the cursor's position.
-    if (device_pixel_patio && position) {
-      RECT rect;
-      ::GetWindowRect(window, &rect);
-      TITLEBARINFOEX title_bar_info;
-      title_bar_info.cbSize = sizeof(TITLEBARINFOEX);
-      ::SendMessage(window, WM_GETTITLEBARINFOEX, 0, (LPARAM)&title_bar_info);
-      int32_t title_bar_height = title_bar_info.rcTitleBar.bottom == 0
-                                     ? 0
-                                     : title_bar_info.rcTitleBar.bottom -
-                                           title_bar_info.rcTitleBar.top;
-      int32_t x = static_cast<int32_t>(
-          (std::get<double>(position.value()[0]) * device_pixel_patio.value()) +
-          rect.left);
-      int32_t y = static_cast<int32_t>(
-          (std::get<double>(position.value()[1]) * device_pixel_patio.value()) +
-          rect.top + title_bar_height);
-      ::TrackPopupMenu(menu_handle_, TPM_LEFTALIGN | TPM_LEFTBUTTON, x, y, 0,
-                       window, NULL);
-    } else {
-      POINT point;
-      ::GetCursorPos(&point);
-      ::TrackPopupMenu(menu_handle_, TPM_LEFTALIGN | TPM_LEFTBUTTON, point.x,
-                       point.y, 0, window, NULL);
+    int64_t handle = next_menu_handle_++;
+    menus_.emplace(handle, menu);
+    result->Success(flutter::EncodableValue(handle));
+  } else if (method_call.method_name().compare(kDisposeMenu) == 0) {
+    auto arguments = std::get<flutter::EncodableMap>(*method_call.arguments());
+    auto menu = menus_.find(
+        arguments[flutter::EncodableValue("handle")].LongValue());
+    // Unknown handles are ignored, disposing twice is harmless.
+    if (menu != menus_.end()) {
+      ::DestroyMenu(menu->second);
+      menus_.erase(menu);
     }
     result->Success(nullptr);
+  } else if (method_call.method_name().compare(kConfigure) == 0) {
+    result->Success(nullptr);
   } else {
     result->NotImplemented();
   }